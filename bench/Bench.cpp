@@ -0,0 +1,125 @@
+#include "StdInc.hpp"
+#include "Bench.hpp"
+#include "AllocStats.hpp"
+#include "Log.hpp"
+#include <chrono>
+
+
+using namespace grumat;
+
+
+BenchRunner::BenchRunner()
+	: m_MinTime(300)
+{
+}
+
+
+bool BenchRunner::IsEnabled(const char *name) const
+{
+	return m_Filter.empty() || strstr(name, m_Filter.c_str()) != NULL;
+}
+
+
+void BenchRunner::Measure(const char *name, uint64_t items, const std::function<void()> &fn)
+{
+	typedef std::chrono::steady_clock Clock_t;
+	if(!IsEnabled(name))
+		return;
+	// Warm up caches and buffers
+	fn();
+	const uint64_t allocs = AllocStats::GetCount();
+	const Clock_t::time_point start = Clock_t::now();
+	const Clock_t::duration min_time = std::chrono::milliseconds(m_MinTime);
+	Clock_t::duration elapsed;
+	uint64_t iters = 0;
+	do
+	{
+		fn();
+		++iters;
+		elapsed = Clock_t::now() - start;
+	}
+	while(elapsed < min_time || iters < 3);
+	BenchResult res;
+	res.m_Name = name;
+	res.m_Items = items;
+	res.m_Iterations = iters;
+	const double ops = (double)iters * items;
+	const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	res.m_NsPerOp = ns / ops;
+	res.m_AllocsPerOp = (AllocStats::GetCount() - allocs) / ops;
+	res.m_OpsPerSec = ops * 1e9 / ns;
+	m_Results.push_back(res);
+	std::cerr << format_n("%-28s %12.1f ns/op %10.2f allocs/op %14.0f ops/s\n"
+		, name, res.m_NsPerOp, res.m_AllocsPerOp, res.m_OpsPerSec);
+}
+
+
+void BenchRunner::WriteCsv(std::ostream &strm) const
+{
+	strm << "name,items,iterations,ns_per_op,allocs_per_op,ops_per_sec\n";
+	for(size_t i = 0; i < m_Results.size(); ++i)
+	{
+		const BenchResult &r = m_Results[i];
+		strm << format_n("%s,%llu,%llu,%.1f,%.3f,%.0f\n", r.m_Name.c_str()
+			, (unsigned long long)r.m_Items, (unsigned long long)r.m_Iterations
+			, r.m_NsPerOp, r.m_AllocsPerOp, r.m_OpsPerSec);
+	}
+}
+
+
+void BenchRunner::WriteJson(std::ostream &strm) const
+{
+	Json::Value root(Json::arrayValue);
+	for(size_t i = 0; i < m_Results.size(); ++i)
+	{
+		const BenchResult &r = m_Results[i];
+		Json::Value obj(Json::objectValue);
+		obj["name"] = r.m_Name;
+		obj["items"] = Json::Value((Json::UInt64)r.m_Items);
+		obj["iterations"] = Json::Value((Json::UInt64)r.m_Iterations);
+		obj["ns_per_op"] = r.m_NsPerOp;
+		obj["allocs_per_op"] = r.m_AllocsPerOp;
+		obj["ops_per_sec"] = r.m_OpsPerSec;
+		root.append(obj);
+	}
+	Json::StreamWriterBuilder wbuilder;
+	strm << Json::writeString(wbuilder, root) << std::endl;
+}
+
+
+static int Usage(const char *argv0)
+{
+	std::cerr << "USAGE: " << argv0 << " [--json] [--filter=<text>] [--min-time=<ms>]\n"
+			  << "    --json            : JSON output instead of CSV\n"
+			  << "    --filter=<text>   : only run cases containing <text>\n"
+			  << "    --min-time=<ms>   : minimum measuring time of each case (default 300)\n"
+			  << "Results are written to stdout; progress to stderr.\n";
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	BenchRunner runner;
+	bool json = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		if(strcmp(arg, "--json") == 0)
+			json = true;
+		else if(strncmp(arg, "--filter=", 9) == 0)
+			runner.m_Filter = arg + 9;
+		else if(strncmp(arg, "--min-time=", 11) == 0)
+			runner.m_MinTime = strtoull(arg + 11, NULL, 10);
+		else
+			return Usage(argv[0]);
+	}
+	// Only failures are of interest
+	SetLogLevel(ERROR);
+	RunBenchCases(runner);
+	if(json)
+		runner.WriteJson(std::cout);
+	else
+		runner.WriteCsv(std::cout);
+	return 0;
+}
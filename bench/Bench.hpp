@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+
+
+// Measurement of a single benchmark case
+class BenchResult
+{
+public:
+	std::string m_Name;
+	// Operations done by each iteration
+	uint64_t m_Items;
+	uint64_t m_Iterations;
+	double m_NsPerOp;
+	double m_AllocsPerOp;
+	double m_OpsPerSec;
+};
+
+
+// Repeats each case for a minimum time and collects the results
+class BenchRunner
+{
+public:
+	BenchRunner();
+
+	// False if 'name' is filtered out; cases skip their setup then
+	bool IsEnabled(const char *name) const;
+	// Runs 'fn', which does 'items' operations, until the minimum time is reached
+	void Measure(const char *name, uint64_t items, const std::function<void()> &fn);
+
+	void WriteCsv(std::ostream &strm) const;
+	void WriteJson(std::ostream &strm) const;
+
+public:
+	// Substring selecting cases; empty runs all
+	std::string m_Filter;
+	// Minimum measuring time of a case, in ms
+	uint64_t m_MinTime;
+	std::vector<BenchResult> m_Results;
+};
+
+
+// Registers all benchmark cases
+void RunBenchCases(BenchRunner &runner);
+
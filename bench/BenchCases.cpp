@@ -0,0 +1,330 @@
+#include "StdInc.hpp"
+#include "Bench.hpp"
+#include "AppConfig.hpp"
+#include "PidSample.hpp"
+#include "ProcSource.hpp"
+#include "ArgvCache.hpp"
+#include "Log.hpp"
+#include <atomic>
+
+
+using namespace grumat;
+using namespace PidSample;
+
+
+// Number of configured services, as in our largest installations
+static const size_t kServices = 500;
+
+
+// Deterministic pseudo random numbers; results must be comparable between runs
+class Rand
+{
+public:
+	Rand(uint64_t seed) : m_State(seed) {}
+	uint64_t Next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 7;
+		m_State ^= m_State << 17;
+		return m_State;
+	}
+	size_t Below(size_t n) { return Next() % n; }
+
+protected:
+	uint64_t m_State;
+};
+
+
+static std::string ServiceName(size_t i)
+{
+	return format_n("svc%03zu", i);
+}
+
+
+// Every tenth service is a script, matched by argv[1]
+static std::string ServiceCmdLine(size_t i)
+{
+	if(i % 10 == 9)
+		return format_n("/usr/bin/python3%c/opt/%s%c-D%c", 0, ServiceName(i).c_str(), 0, 0);
+	return format_n("/usr/sbin/%s%c-D%c", ServiceName(i).c_str(), 0, 0);
+}
+
+
+// Command line with '\0' separators, in the shapes found on real servers
+static std::string MakeCmdLine(Rand &rnd)
+{
+	std::string cmd;
+	switch(rnd.Below(10))
+	{
+	case 0:
+		// Kernel thread
+		break;
+	case 1:
+	case 2:
+		// Interpreter running a script
+		cmd = format_n("/usr/bin/python3.11%c/opt/app%zu/main.py%c--config%c/etc/app%zu.conf%c"
+			, 0, rnd.Below(1000), 0, 0, rnd.Below(1000), 0);
+		break;
+	case 3:
+		// Long argument list
+		cmd = format_n("/usr/lib/jvm/bin/java%c", 0);
+		for(size_t i = 0; i < 40; ++i)
+			cmd += format_n("-Dprop%zu=value%zu%c", i, rnd.Below(100000), 0);
+		break;
+	case 4:
+		// A configured service
+		cmd = ServiceCmdLine(rnd.Below(kServices));
+		break;
+	default:
+		cmd = format_n("/usr/bin/tool%zu%c--verbose%c", rnd.Below(5000), 0, 0);
+		break;
+	}
+	return cmd;
+}
+
+
+// Synthetic process table; counters grow on every read
+class FakeProcSource : public ProcSource
+{
+public:
+	FakeProcSource(size_t npids)
+		: m_Tick(0)
+	{
+		Rand rnd(npids);
+		m_Cmd.resize(npids + 1);
+		for(size_t i = 1; i <= npids; ++i)
+			m_Cmd[i] = MakeCmdLine(rnd);
+	}
+
+	virtual uint64_t GetClock() override
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+	virtual bool ListPids(std::vector<pid_t> &pids) override
+	{
+		pids.resize(m_Cmd.size() - 1);
+		for(size_t i = 0; i < pids.size(); ++i)
+			pids[i] = (pid_t)(i + 1);
+		return true;
+	}
+	virtual bool GetArgvView(ArgvView &res, pid_t pid, size_t max_args) override
+	{
+		res.Clear();
+		const std::string &cmd = m_Cmd[pid];
+		if(cmd.empty())
+			return false;
+		// Same copy the kernel does
+		res.m_Buffer.assign(cmd.begin(), cmd.end());
+		res.Parse(res.m_Buffer.data(), res.m_Buffer.size(), max_args);
+		return true;
+	}
+	virtual bool GetProcInfo(ProcInfo &info, pid_t pid) override
+	{
+		info.m_StartTime = (uint64_t)pid * 7;
+		info.m_PPid = 1;
+		return true;
+	}
+	virtual bool ReadSample(Sample &samp) override
+	{
+		const uint64_t tick = ++m_Tick;
+		samp.m_StartTime = (uint64_t)samp.m_Pid * 7;
+		samp.m_CpuTime = 1 + tick * 1000;
+		samp.m_SysTime = tick * 100;
+		samp.m_DiskReadBytes = tick * 4096;
+		samp.m_DiskWriteBytes = tick * 512;
+		return true;
+	}
+
+protected:
+	std::atomic<uint64_t> m_Tick;
+	std::vector<std::string> m_Cmd;
+};
+
+
+// Configuration file with 'kServices' sections
+static std::string WriteConfig(const char *fname)
+{
+	std::ofstream strm(fname);
+	strm << "# Generated by the benchmark\n"
+		 << "history = \"/tmp/is_server_busy_bench.hist\"\n"
+		 << "max_interval = 120\n"
+		 << "threads = 1\n\n";
+	for(size_t i = 0; i < kServices; ++i)
+	{
+		strm << '[' << ServiceName(i) << "]\n"
+			 << "cpu = 2.0\n"
+			 << "disk = 65536\t# bytes/s\n";
+		if(i % 10 == 9)
+			strm << "argv = 1\n";
+		strm << '\n';
+	}
+	return fname;
+}
+
+
+static void ConfigCases(BenchRunner &runner, const std::string &fname)
+{
+	runner.Measure("config.anyconfig_parse", kServices, [&]()
+	{
+		AnyConfig any;
+		any.Parse(fname.c_str());
+	});
+	runner.Measure("config.appconfig_parse", kServices, [&]()
+	{
+		AppConfig cfg;
+		cfg.Parse(fname.c_str());
+	});
+	if(runner.IsEnabled("string.split"))
+	{
+		std::vector<String> lines;
+		Rand rnd(1);
+		for(size_t i = 0; i < 1000; ++i)
+			lines.push_back(format_n("key%zu = \"some value %zu\"\t# comment", i, rnd.Below(100000)));
+		runner.Measure("string.split", lines.size(), [&]()
+		{
+			for(size_t i = 0; i < lines.size(); ++i)
+				lines[i].Split('=', 1);
+		});
+	}
+}
+
+
+static void MatchCases(BenchRunner &runner, const AppConfig &config)
+{
+	if(!runner.IsEnabled("match."))
+		return;
+	const size_t count = 10000;
+	Rand rnd(2);
+	std::vector<StringArray> argvs;
+	std::vector<ArgvView> views(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		std::string cmd = MakeCmdLine(rnd);
+		views[i].m_Buffer.assign(cmd.begin(), cmd.end());
+		views[i].Parse(views[i].m_Buffer.data(), views[i].m_Buffer.size(), SIZE_MAX);
+		argvs.push_back(views[i].ToArray());
+	}
+	size_t found = 0;
+	runner.Measure("match.name_array", count, [&]()
+	{
+		for(size_t i = 0; i < count; ++i)
+			found += config.MatchName(argvs[i]) != (size_t)-1;
+	});
+	runner.Measure("match.name_view", count, [&]()
+	{
+		for(size_t i = 0; i < count; ++i)
+			found += config.MatchName(views[i].GetData(), views[i].GetCount()) != (size_t)-1;
+	});
+	if(found == 0)
+		std::cerr << "WARNING: no process matched\n";
+}
+
+
+static void ArgvCases(BenchRunner &runner)
+{
+	// Real backend on this process
+	ProcSource &src = ProcSource::GetDefault();
+	const pid_t self = getpid();
+	StringArray argv;
+	runner.Measure("argv.get_self", 1, [&]()
+	{
+		src.GetArgv(argv, self);
+	});
+	ArgvView view;
+	runner.Measure("argv.view_self", 1, [&]()
+	{
+		src.GetArgvView(view, self, SIZE_MAX);
+	});
+	runner.Measure("argv.sample_self", 1, [&]()
+	{
+		Sample samp;
+		samp.m_Pid = self;
+		src.ReadSample(samp);
+	});
+}
+
+
+static void ScanCases(BenchRunner &runner, const AppConfig &config, size_t npids, const char *name, const char *cached_name)
+{
+	if(!runner.IsEnabled(name) && !runner.IsEnabled(cached_name))
+		return;
+	FakeProcSource src(npids);
+	runner.Measure(name, npids, [&]()
+	{
+		SampleSet samps(config, src);
+	});
+	ArgvCache cache;
+	runner.Measure(cached_name, npids, [&]()
+	{
+		SampleSet samps(config, src, &cache);
+	});
+}
+
+
+static void HistoryCases(BenchRunner &runner, AppConfig &config)
+{
+	if(!runner.IsEnabled("history."))
+		return;
+	// Large history: every sample matches a service
+	const size_t count = 10000;
+	SampleSet samps;
+	samps.m_Clock = 1000000000000ULL;
+	for(size_t i = 0; i < count; ++i)
+	{
+		Sample s;
+		s.m_Pid = (pid_t)(i + 100);
+		s.m_StartTime = i * 7;
+		const std::string cmd = ServiceCmdLine(i % kServices);
+		for(const char *arg = cmd.c_str(); arg < cmd.c_str() + cmd.size(); arg += strlen(arg) + 1)
+			s.m_Argv.push_back(arg);
+		s.m_Argv.push_back(format_n("--port=%zu", 1024 + i));
+		s.m_CpuTime = i * 1000 + 1;
+		s.m_SysTime = i * 100;
+		s.m_DiskReadBytes = i * 4096;
+		s.m_DiskWriteBytes = i * 512;
+		samps.m_Samples.emplace(s.m_Pid, s);
+		samps.m_Pid2Cfg[s.m_Pid] = i % kServices;
+	}
+	const AppConfig::HistoryFormat_e fmt = config.m_HistoryFormat;
+	SampleSet loaded;
+	config.m_HistoryFormat = AppConfig::hfJson;
+	runner.Measure("history.json_write", count, [&]()
+	{
+		samps.MakeRecord(config);
+	});
+	runner.Measure("history.json_read", count, [&]()
+	{
+		loaded.ReadRecord(config);
+	});
+	config.m_HistoryFormat = AppConfig::hfBinary;
+	runner.Measure("history.binary_write", count, [&]()
+	{
+		samps.MakeRecord(config);
+	});
+	runner.Measure("history.binary_read", count, [&]()
+	{
+		loaded.ReadRecord(config);
+	});
+	if(loaded.m_Samples.size() != count)
+		std::cerr << "WARNING: history round-trip lost samples\n";
+	config.m_HistoryFormat = fmt;
+	unlink(config.m_RecordFile.c_str());
+}
+
+
+void RunBenchCases(BenchRunner &runner)
+{
+	const std::string fname = WriteConfig("/tmp/is_server_busy_bench.conf");
+	AppConfig config;
+	if(!config.Parse(fname.c_str()))
+		return;
+	ConfigCases(runner, fname);
+	MatchCases(runner, config);
+	ArgvCases(runner);
+	ScanCases(runner, config, 10000, "scan.10k", "scan.10k_cached");
+	ScanCases(runner, config, 100000, "scan.100k", "scan.100k_cached");
+	HistoryCases(runner, config);
+	unlink(fname.c_str());
+}
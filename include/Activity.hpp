@@ -0,0 +1,69 @@
+#pragma once
+
+#include "PidSample.hpp"
+#include "Log.hpp"
+
+
+#define ACTIVE_STATE	0
+#define IDLE_STATE		1
+#define ERROR_STATE		100
+
+
+namespace PidSample
+{
+
+
+// Workload of a service along the evaluated interval
+class ServiceRate
+{
+public:
+	size_t m_Cfg;
+	// CPU usage in %
+	double m_Cpu;
+	// Disk transfers in bytes/s
+	int64_t m_DiskBytes;
+	int64_t m_ReadBytes;
+	int64_t m_WriteBytes;
+};
+
+
+// Compares samples against the thresholds of the configuration
+class Activity
+{
+public:
+	typedef std::map<size_t, Diff> DiffMap_t;
+
+	// 'lvl' is the log level for the verdict messages
+	Activity(const AppConfig &config, grumat::LogType_e lvl = grumat::INFO);
+
+	// Verdict of a current sample set against the history (NULL if not available)
+	int Evaluate(const SampleSet *old_samps, const SampleSet &samps);
+	// Verdict of a single service; samples must belong to the service
+	int EvaluateService(size_t icfg
+		, const SampleSet::SampleSet_t &old_samps, uint64_t old_clock
+		, const SampleSet::SampleSet_t &samps, uint64_t clock
+		);
+
+protected:
+	// Validates the interval between samples; returns false if not usable
+	bool CheckInterval(uint64_t old_clock, uint64_t clock, const char *name);
+	// Tests thresholds of a service, storing rates; returns true if active
+	bool CheckService(size_t icfg, const Diff &dif);
+
+public:
+	const AppConfig &m_Config;
+	grumat::LogType_e m_LogLevel;
+	// Shortest usable interval in ns; in-run samples accept any
+	uint64_t m_MinTimeDiff;
+	// Rates of all services are computed, instead of stopping at the first active one
+	bool m_AllRates;
+	// Interval of the last evaluation
+	uint64_t m_TimeDiff;
+	uint64_t m_Secs;
+	// Rates computed by the last evaluation
+	std::vector<ServiceRate> m_Rates;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,20 @@
+#pragma once
+
+
+namespace grumat
+{
+
+
+// Process wide heap usage, counted by the replaced operator new
+class AllocStats
+{
+public:
+	// Number of allocations since start
+	static uint64_t GetCount();
+	// Bytes requested since start
+	static uint64_t GetBytes();
+};
+
+
+}	// namespace grumat
+
@@ -2,6 +2,7 @@
 
 #include "String.hpp"
 #include "Path.hpp"
+#include "Automaton.hpp"
 
 
 namespace grumat
@@ -54,6 +55,11 @@ public:
 		, m_DiskRead(o.m_DiskRead)
 		, m_DiskWrite(o.m_DiskWrite)
 		, m_Argv(o.m_Argv)
+		, m_Match(o.m_Match)
+		, m_Regex(o.m_Regex)
+		, m_Children(o.m_Children)
+		, m_Cgroup(o.m_Cgroup)
+		, m_Interval(o.m_Interval)
 	{ }
 	~ProcessConfig() {}
 
@@ -63,6 +69,17 @@ public:
 	uint64_t m_DiskRead;
 	uint64_t m_DiskWrite;
 	size_t m_Argv;
+	// Glob on argv[m_Argv], replacing the name
+	grumat::String m_Match;
+	// Regex on the whole command line, replacing the name
+	grumat::String m_Regex;
+	// Descendant processes are accounted to this service
+	bool m_Children;
+	// cgroup v2 directory sampled as a whole, relative to the cgroup root;
+	// the section then matches no process
+	grumat::String m_Cgroup;
+	// Seconds between daemon samples of the section; 0 uses 'sample_interval'
+	size_t m_Interval;
 
 	bool IsClear() const { return m_Name.empty(); }
 	void Clear()
@@ -73,27 +90,160 @@ public:
 		m_DiskRead = 0;
 		m_DiskWrite = 0;
 		m_Argv = 0;
+		m_Match.Clear();
+		m_Regex.Clear();
+		m_Children = false;
+		m_Cgroup.Clear();
+		m_Interval = 0;
 	}
+	bool HasPattern() const { return !m_Match.empty() || !m_Regex.empty(); }
 	void Print(std::ostream &strm) const;
 };
 
 
+// Lookup tables of the service names, grouped by argv index, and an
+// automaton for the entries using patterns
+class ServiceMatcher
+{
+public:
+	// Keys refer to the names of 'procs', which must outlive the tables
+	bool Build(const std::vector<ProcessConfig> &procs);
+	// Same as Build(), taking the compiled patterns of SaveTables()
+	bool Load(const std::vector<ProcessConfig> &procs, grumat::BlobReader &rd);
+	void SaveTables(grumat::BlobWriter &wr) const { m_Patterns.SaveTables(wr); }
+	// Index of the first matching entry or (size_t)-1; names have
+	// priority over patterns
+	size_t Match(const std::string_view *argv, size_t argc) const;
+	// Number of leading arguments any entry needs; SIZE_MAX for all
+	size_t GetArgCount() const { return m_ArgCount; }
+	const char *GetError() const { return m_Patterns.GetError(); }
+
+	static std::string_view GetBaseName(std::string_view path);
+
+protected:
+	// Name tables; patterns are only collected if 'patterns' is set
+	void AddEntries(const std::vector<ProcessConfig> &procs, bool patterns);
+
+protected:
+	typedef std::unordered_map<std::string_view, size_t> Names_t;
+	class Group
+	{
+	public:
+		size_t m_Argv;
+		// Name to the lowest entry index
+		Names_t m_Names;
+	};
+	std::vector<Group> m_Groups;
+	grumat::Automaton m_Patterns;
+	size_t m_ArgCount;
+};
+
+
+// Header of the binary snapshot, see ConfigSnapshot.cpp
+struct SnapshotHeader;
+
+
 class AppConfig
 {
 public:
+	enum HistoryFormat_e
+	{
+		hfBinary,
+		hfJson,
+	};
+	// What the daemon sampler does when the evaluator queue is full
+	enum QueueFull_e
+	{
+		qfDrop,
+		qfBlock,
+	};
+
 	AppConfig();
+	// The matcher refers to m_Procs and is rebuilt on copies
+	AppConfig(const AppConfig &o);
+	AppConfig &operator=(const AppConfig &o);
 	bool Parse(const char *path);
+	// Parse() through the compiled snapshot '<path>.snap', refreshing it
+	bool Load(const char *path);
 	void Print(std::ostream &strm) const;
 	size_t MatchName(const grumat::StringArray &cmd_line) const;
+	size_t MatchName(const std::string_view *argv, size_t argc) const { return m_Matcher.Match(argv, argc); }
+	// Number of leading arguments needed by MatchName(); SIZE_MAX for all
+	size_t GetArgCount() const { return m_Matcher.GetArgCount(); }
+	// Changes whenever MatchName() could produce different results
+	uint64_t GetMatchHash() const;
+	// Index of the section called 'name' or (size_t)-1
+	size_t FindService(const char *name) const;
+	// Any section accounting descendant processes?
+	bool HasChildren() const;
+	// Any section sampling a cgroup?
+	bool HasCgroups() const;
+	// Any section matching processes? Otherwise no process is listed
+	bool NeedsScan() const;
+	// Seconds between daemon samples of section 'icfg'
+	size_t GetInterval(size_t icfg) const
+	{
+		return m_Procs[icfg].m_Interval ? m_Procs[icfg].m_Interval : m_SampleInterval;
+	}
 
 public:
 	grumat::Path m_RecordFile;
+	HistoryFormat_e m_HistoryFormat;
 	size_t m_IntervalThr;
+	// Milliseconds between two in-run samples; 0 uses the history
+	size_t m_Window;
+	// Process scan workers; 0 uses all CPUs
+	size_t m_Threads;
+	// Keeps matching results of known processes next to the history
+	bool m_ArgvCache;
+	// CPU time of whole processes from netlink taskstats (Linux, root only)
+	bool m_Taskstats;
+	// Daemon mode
+	grumat::Path m_SocketFile;
+	size_t m_SampleInterval;
+	size_t m_HistoryDepth;
+	// Snapshots waiting for the evaluator thread of the daemon
+	size_t m_QueueSize;
+	QueueFull_e m_QueueFull;
+	// Follows process creation through the kernel proc connector instead of
+	// scanning all processes every cycle (Linux, root only)
+	bool m_ProcEvents;
+	// Prometheus textfile, replaced after each check; empty disables
+	grumat::Path m_PromFile;
+	// Port of the localhost metrics endpoint of the daemon; 0 disables
+	size_t m_PromListen;
+	// POSIX shared memory object where the daemon publishes its verdict;
+	// empty disables
+	std::string m_ShmName;
+	// Alternate procfs tree, for test fixtures; empty uses the system
+	grumat::Path m_ProcRoot;
+	// Mount point of the cgroup v2 hierarchy
+	grumat::Path m_CgroupRoot;
+	// Keeps a compiled copy of the configuration for the next start
+	bool m_Snapshot;
+	// Directory of the long-term sample history; empty disables
+	grumat::Path m_TrendDir;
+	// Bytes kept by the long-term history before compacting
+	size_t m_TrendSize;
 	std::vector<ProcessConfig> m_Procs;
 
 protected:
-	bool Get(size_t &res, const grumat::KeyVal &kv);
-	bool Get(uint64_t &res, const grumat::KeyVal &kv);
+	// Parse() without ResolvePaths(); paths keep their configured form
+	bool ParseFile(const char *path);
+	// Resolves relative, '~' and '$VAR' paths against the current process
+	void ResolvePaths();
+	bool LoadSnapshot(const char *fname, const char *path);
+	// 'id' holds the identity of the configuration taken before parsing
+	bool SaveSnapshot(const char *fname, const SnapshotHeader &id) const;
+
+protected:
+	ServiceMatcher m_Matcher;
+
+protected:
+	// size_t and uint64_t are the same type on some platforms
+	bool Get(unsigned long &res, const grumat::KeyVal &kv);
+	bool Get(unsigned long long &res, const grumat::KeyVal &kv);
 	bool Get(double &res, const grumat::KeyVal &kv);
+	bool Get(bool &res, const grumat::KeyVal &kv);
 };
 
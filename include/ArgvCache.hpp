@@ -0,0 +1,41 @@
+#pragma once
+
+#include "String.hpp"
+
+
+namespace PidSample
+{
+
+
+// Results of the command line matching, keyed by pid and process start
+// time, so known processes skip the argv retrieval entirely
+class ArgvCache
+{
+public:
+	class Entry
+	{
+	public:
+		uint64_t m_StartTime;
+		// ProcInfo::m_ExecId; an exec() changes the command line
+		uint64_t m_ExecId;
+		// Matched configuration or (size_t)-1
+		size_t m_Cfg;
+		// Only kept for matched processes
+		grumat::StringArray m_Argv;
+	};
+	typedef std::unordered_map<pid_t, Entry> Entries_t;
+
+	// Loads a cache file; entries are dropped if 'cfg_hash' differs or if
+	// one refers to a configuration beyond 'cfg_count'
+	bool Load(const char *fname, uint64_t cfg_hash, size_t cfg_count);
+	bool Save(const char *fname, uint64_t cfg_hash) const;
+	// NULL if unknown, if the pid now belongs to another process or if the
+	// process has run another program since
+	const Entry *Find(pid_t pid, uint64_t start_time, uint64_t exec_id) const;
+
+public:
+	Entries_t m_Entries;
+};
+
+
+}	// PidSample
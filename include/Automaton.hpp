@@ -0,0 +1,116 @@
+#pragma once
+
+#include <bitset>
+#include "Blob.hpp"
+
+
+namespace grumat
+{
+
+
+/*
+** Combines many glob and regex patterns into a single DFA. Command line
+** arguments are scanned once as "arg0\0arg1\0...argN<EOT>"; the result is
+** the lowest id of all patterns that matched.
+**
+** Regex syntax is a subset of POSIX ERE: | ( ) * + ? . [...] and the
+** \d \w \s shorthands. '^' and '$' are only accepted at the ends of the
+** expression. Arguments are separated by spaces for the regex.
+*/
+class Automaton
+{
+public:
+	enum { kMaxStates = 4096 };
+
+	Automaton() { Clear(); }
+
+	void Clear();
+	// Glob on argument 'argv'; without a '/' only the base name is compared
+	bool AddGlob(std::string_view glob, size_t argv, size_t id);
+	// Regex searched in the whole command line
+	bool AddRegex(std::string_view re, size_t id);
+	// Builds the DFA from all patterns added so far
+	bool Compile();
+	// Reason of the last failure
+	const char *GetError() const { return m_Error; }
+	bool IsEmpty() const { return m_Starts.empty() && m_Start == 0; }
+	// Lowest id of the matching patterns or (size_t)-1
+	size_t Match(const std::string_view *argv, size_t argc) const;
+
+	// Compiled DFA only; a loaded automaton matches but takes no new patterns
+	void SaveTables(BlobWriter &wr) const;
+	bool LoadTables(BlobReader &rd);
+
+protected:
+	// 256 byte values and the end of text marker
+	enum { kEot = 256, kSymbols = 257 };
+	typedef std::bitset<kSymbols> Set_t;
+	typedef std::vector<std::pair<int, int> > Holes_t;
+
+	class Node
+	{
+	public:
+		enum Type_e
+		{
+			ntSet,
+			ntSplit,
+			ntAccept,
+		};
+		Type_e m_Type;
+		Set_t m_Set;
+		// -1 is unused
+		int m_Out;
+		int m_Out1;
+		size_t m_Id;
+	};
+	// Partial NFA with unconnected exits
+	class Frag
+	{
+	public:
+		int m_Start;
+		Holes_t m_Holes;
+	};
+	// Parser state of a single pattern
+	class Parser
+	{
+	public:
+		std::string_view m_Text;
+		size_t m_Pos;
+		bool m_Regex;
+		bool m_BaseName;
+	};
+
+	int AddNode(Node::Type_e type);
+	void Patch(const Holes_t &holes, int target);
+	Frag MakeSet(const Set_t &set);
+	Frag MakeEmpty();
+	Frag Concat(const Frag &a, const Frag &b);
+	Frag Alternate(const Frag &a, const Frag &b);
+	Frag Repeat(const Frag &a, char op);
+	void AddPattern(const Frag &f, size_t id);
+
+	bool ParseAlt(Parser &p, Frag &res);
+	bool ParseConcat(Parser &p, Frag &res);
+	bool ParseAtom(Parser &p, Frag &res);
+	bool ParseClass(Parser &p, Set_t &set);
+	bool ParseEscape(Parser &p, Set_t &set);
+	bool ParseGlob(Parser &p, Frag &res);
+	void FixSet(const Parser &p, Set_t &set) const;
+
+	void Closure(std::vector<int> &states, std::vector<int> &stack, std::vector<size_t> &marks, size_t stamp) const;
+
+protected:
+	std::vector<Node> m_Nodes;
+	std::vector<int> m_Starts;
+	// DFA; state 0 is the dead state
+	uint16_t m_Classes[kSymbols];
+	size_t m_ClassCount;
+	uint32_t m_Start;
+	std::vector<uint32_t> m_Trans;
+	std::vector<size_t> m_Accept;
+	const char *m_Error;
+};
+
+
+}	// namespace grumat
+
@@ -0,0 +1,67 @@
+#pragma once
+
+
+namespace grumat
+{
+
+
+// Appends native byte order values to a buffer
+class BlobWriter
+{
+public:
+	BlobWriter(std::string &buf) : m_Buf(buf) {}
+
+	void Put(const void *data, size_t len) { m_Buf.append((const char *)data, len); }
+	template<typename T> void Put(const T &v) { Put(&v, sizeof(v)); }
+	void PutString(std::string_view str)
+	{
+		Put((uint32_t)str.size());
+		Put(str.data(), str.size());
+	}
+
+protected:
+	std::string &m_Buf;
+};
+
+
+// Bounds checked reading of a BlobWriter output; fails for good once
+// the end is crossed
+class BlobReader
+{
+public:
+	BlobReader(const uint8_t *data, size_t len) : m_Pos(data), m_End(data + len) {}
+
+	bool IsValid() const { return m_Pos != NULL; }
+	bool Get(void *data, size_t len)
+	{
+		if(m_Pos == NULL || (size_t)(m_End - m_Pos) < len)
+		{
+			m_Pos = NULL;
+			return false;
+		}
+		memcpy(data, m_Pos, len);
+		m_Pos += len;
+		return true;
+	}
+	template<typename T> bool Get(T &v) { return Get(&v, sizeof(v)); }
+	bool GetString(std::string &str)
+	{
+		uint32_t len;
+		if(!Get(len) || (size_t)(m_End - m_Pos) < len)
+		{
+			m_Pos = NULL;
+			return false;
+		}
+		str.assign((const char *)m_Pos, len);
+		m_Pos += len;
+		return true;
+	}
+
+protected:
+	const uint8_t *m_Pos;
+	const uint8_t *m_End;
+};
+
+
+}	// namespace grumat
+
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Activity.hpp"
+#include "PromExporter.hpp"
+#include "Trend.hpp"
+#include "PidWatch.hpp"
+#include "SharedVerdict.hpp"
+#include "SpscRing.hpp"
+#include "TimerWheel.hpp"
+#include <memory>
+#include <condition_variable>
+
+
+namespace PidSample
+{
+
+
+// Fixed size ring with the latest samples of a service
+class ServiceHistory
+{
+public:
+	class Entry
+	{
+	public:
+		uint64_t m_Clock;
+		SampleSet::SampleSet_t m_Samples;
+	};
+
+	ServiceHistory() : m_Head(0), m_Count(0) {}
+
+	void SetCapacity(size_t n);
+	// Recycles the oldest slot for a new sample
+	Entry &Push(uint64_t clock);
+	// Most recent sample or NULL
+	const Entry *GetLatest() const;
+	// Most recent sample at least 'min_ns' older than the latest one, or NULL
+	// if there is none or it is older than 'max_secs'
+	const Entry *GetBaseline(uint64_t min_ns, uint64_t max_secs) const;
+	size_t GetCount() const { return m_Count; }
+
+protected:
+	const Entry &At(size_t age) const;
+
+protected:
+	std::vector<Entry> m_Ring;
+	// Position of the next write
+	size_t m_Head;
+	size_t m_Count;
+};
+
+
+// Resident sampler answering verdicts over a Unix domain socket. The main
+// thread samples; evaluation, history and metrics run on a second thread
+// fed through a bounded queue, and clients are answered by a third one
+class Daemon
+{
+public:
+	Daemon(const AppConfig &config);
+	~Daemon();
+
+	// Main loop; returns when SIGTERM or SIGINT is received
+	int Run();
+	// Asks a running daemon for its verdict
+	static int Query(const AppConfig &config);
+
+protected:
+	// Samples are shared read-only once queued
+	typedef std::shared_ptr<const SampleSet> Snapshot_t;
+
+	bool OpenSocket();
+	void OpenEvents();
+	// Samples the sections set in 'due'; empty for all
+	void TakeSample(const SampleSet::Due_t &due);
+	// Forgets exited processes without waiting for the next sample
+	void OnExits();
+	// Queues m_Pending; false if the queue is full
+	bool Enqueue();
+	void Serve();
+	// Client thread: a slow client cannot delay sampling
+	void ServeLoop();
+	// Evaluator thread
+	void EvaluateLoop();
+	int Evaluate(const Snapshot_t &cur);
+
+protected:
+	const AppConfig &m_Config;
+	int m_Listen;
+	// Sampler: latest complete snapshot, persisted on exit
+	SampleSet m_Last;
+	// Matching results of known processes, kept in memory only
+	ArgvCache m_Cache;
+	// Sections due on each tick; timer ids are section indexes
+	grumat::TimerWheel m_Wheel;
+	// Seconds per tick: the GCD of the section intervals
+	size_t m_Tick;
+	// Interval of each section, in ticks
+	std::vector<uint64_t> m_Periods;
+	// Process churn since the last sample, when following proc events
+	ProcEvents m_Events;
+	// Exit notification of the processes of m_Last
+	PidWatch m_Watch;
+	// Sample waiting for a free slot, with the 'block' policy
+	Snapshot_t m_Pending;
+	size_t m_Dropped;
+	grumat::SpscRing<Snapshot_t> m_Queue;
+	// Wakes the evaluator; the queue itself takes no lock
+	std::mutex m_WakeLock;
+	std::condition_variable m_Wake;
+	bool m_Stop;
+	// Wakes the client thread on stop
+	int m_StopPipe[2];
+	// Evaluator: rings of each service and previous sample
+	std::vector<ServiceHistory> m_History;
+	Snapshot_t m_Prev;
+	// Metrics of the last evaluation; scrapes do not sample
+	PromExporter m_Exporter;
+	// Verdict for readers of the shared memory
+	SharedVerdict m_Shm;
+	TrendStore m_Trend;
+	// Verdict answered to clients
+	std::atomic<int> m_State;
+};
+
+
+}	// PidSample
@@ -29,4 +29,26 @@ protected:
 };
 
 
+// Read-only memory mapping of a whole file
+class MMapFile
+{
+public:
+	MMapFile() : m_pData(NULL), m_Size(0) {}
+	~MMapFile() { Close(); }
+	bool Open(const char *fname);
+	void Close();
+	bool IsValid() const { return m_pData != NULL; }
+	const uint8_t *GetData() const { return m_pData; }
+	size_t GetSize() const { return m_Size; }
+
+protected:
+	const uint8_t *m_pData;
+	size_t m_Size;
+
+private:
+	MMapFile(const MMapFile &);
+	MMapFile &operator=(const MMapFile &);
+};
+
+
 } 	// namespace grumat
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "PidSample.hpp"
+#include "File.hpp"
+#include "Profiler.hpp"
+
+
+namespace PidSample
+{
+
+
+/*
+** Binary history layout; all values in native byte order:
+**
+**	HistoryHeader
+**	HistoryPid[m_PidCount]		sorted by pid
+**	uint32_t[m_ArgvCount]		offsets into the blob
+**	char[m_BlobSize]			interned '\0' terminated strings
+**	ProfileData					optional, if m_ProfileSize is not 0
+*/
+struct HistoryHeader
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_HeaderSize;
+	// Same as '__SysClock__' of the JSON record
+	uint64_t m_SysClock;
+	uint32_t m_PidCount;
+	uint32_t m_ArgvCount;
+	uint32_t m_BlobSize;
+	// Size of the trailing profile; older files have 0
+	uint32_t m_ProfileSize;
+};
+
+
+struct HistoryPid
+{
+	int32_t m_Pid;
+	// Range of the argv table
+	uint32_t m_ArgvFirst;
+	uint32_t m_ArgvCount;
+	// Blob offset + 1 of the inherited service name; 0 if none
+	uint32_t m_Service;
+	uint64_t m_StartTime;
+	uint64_t m_CpuTime;
+	uint64_t m_SysTime;
+	uint64_t m_DiskReadBytes;
+	uint64_t m_DiskWriteBytes;
+};
+
+
+// Validated read-only access to a mapped binary history
+class HistoryView
+{
+public:
+	enum { kVersion = 2 };
+	static const char kMagic[8];
+
+	HistoryView();
+	// Maps and validates the file
+	bool Open(const char *fname);
+	// Tests if the file starts with the binary history signature
+	static bool IsBinary(const char *fname);
+
+	uint64_t GetClock() const { return m_pHeader->m_SysClock; }
+	size_t GetPidCount() const { return m_pHeader->m_PidCount; }
+	const HistoryPid &GetPid(size_t i) const { return m_pPids[i]; }
+	// Binary search in the pid table; NULL if not found
+	const HistoryPid *Find(pid_t pid) const;
+	const char *GetArg(const HistoryPid &e, size_t i) const { return m_pBlob + m_pArgv[e.m_ArgvFirst + i]; }
+	const char *GetService(const HistoryPid &e) const { return e.m_Service ? m_pBlob + e.m_Service - 1 : NULL; }
+	// Profile of the check that wrote the file; false if not stored
+	bool GetProfile(ProfileData &prof) const;
+
+	// Serializes a sample set, replacing the file atomically
+	static bool Write(const char *fname, const SampleSet &samps, const ProfileData *prof = NULL);
+
+protected:
+	grumat::MMapFile m_File;
+	const HistoryHeader *m_pHeader;
+	const HistoryPid *m_pPids;
+	const uint32_t *m_pArgv;
+	const char *m_pBlob;
+};
+
+
+}	// PidSample
+
@@ -5,7 +5,7 @@ namespace grumat
 {
 
 
-std::string format_n(const char *fmt, ...);
+std::string format_n(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
 enum LogType_e
 {
@@ -27,4 +27,39 @@ bool SetLogFile(const char *name);
 // Stream for a specific level
 std::ostream &Log(LogType_e lvl);
 
-}	// namespace grumat
\ No newline at end of file
+
+// printf formatting into a buffer on the stack; longer output is truncated
+class Fmt
+{
+public:
+	Fmt(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+	const char *c_str() const { return m_Buf; }
+	size_t size() const { return m_Len; }
+
+protected:
+	char m_Buf[128];
+	size_t m_Len;
+};
+
+std::ostream &operator<<(std::ostream &strm, const Fmt &fmt);
+
+
+// Discards the value of a log statement, so LOG() can be an expression
+class LogVoidify
+{
+public:
+	void operator&(std::ostream &) {}
+};
+
+}	// namespace grumat
+
+
+// Lowest level compiled in; 'make LOG_MIN_LEVEL=1' removes DEBUG statements
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+// Tests a level, including the compile-time limit
+#define LOG_ACTIVE(lvl)	((int)(lvl) >= LOG_MIN_LEVEL && grumat::IsLogLevelActive(lvl))
+// Log statement; operands are not evaluated when the level is inactive
+#define LOG(lvl)	!LOG_ACTIVE(lvl) ? (void)0 : grumat::LogVoidify() & grumat::Log(lvl)
@@ -11,6 +11,7 @@ public:
 	Path() : std::string() { }
 	Path(const char *path) : std::string() { if (path != NULL) std::string::operator=(path); }
 	Path(const Path &path) : std::string(path) {}
+	Path &operator=(const Path &path) = default;
 	bool IsEmpty() const { return empty(); }
 	bool HasSlash() const { return !IsEmpty() && at(size()-1) == '/'; }
 	void AddSlash()
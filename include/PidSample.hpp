@@ -1,6 +1,9 @@
 #pragma once
 
 #include "AppConfig.hpp"
+#include "ProcSource.hpp"
+#include "ArgvCache.hpp"
+#include "ProcEvents.hpp"
 
 
 namespace PidSample
@@ -40,9 +43,16 @@ class Sample
 {
 public:
 	Sample();
-	Sample(pid_t pid, const grumat::StringArray &cmd_line);
+	Sample(pid_t pid, const grumat::StringArray &cmd_line, ProcSource &src = ProcSource::GetDefault());
 	Sample(const Sample &o);
+	Sample &operator=(const Sample &o) = default;
 	bool IsValid() const { return m_CpuTime != 0; }
+	// False when the pid was recycled by another process
+	bool IsSameProcess(const Sample &o) const
+	{
+		return m_Pid == o.m_Pid
+			&& (m_StartTime == 0 || o.m_StartTime == 0 || m_StartTime == o.m_StartTime);
+	}
 	void Print(std::ostream &strm, uint64_t tm_ticks) const;
 	Diff operator -(const Sample &o) const;
 
@@ -55,7 +65,10 @@ public:
 
 public:
 	pid_t m_Pid;
+	uint64_t m_StartTime;
 	grumat::StringArray m_Argv;
+	// Service inherited from an ancestor; empty for matched processes
+	std::string m_Service;
 	uint64_t m_CpuTime;
 	uint64_t m_SysTime;
 	uint64_t m_DiskReadBytes;
@@ -68,22 +81,73 @@ class SampleSet
 public:
 	typedef std::map<pid_t, Sample> SampleSet_t;
 	typedef std::map<pid_t, size_t> Pid2Cfg_t;
+	typedef std::vector<bool> Due_t;
 
 	SampleSet();
-	SampleSet(const AppConfig &config);
-
+	// Scans all processes; a cache avoids argv retrieval of known ones and is refreshed
+	SampleSet(const AppConfig &config, ProcSource &src = ProcSource::GetDefault(), ArgvCache *cache = NULL);
+
+	// Full scan where the sections not due keep their samples of 'prev'
+	void Rescan(const SampleSet &prev, const AppConfig &config, ProcSource &src = ProcSource::GetDefault(), ArgvCache *cache = NULL);
+	// Samples again the processes of 'prev', keeping their configuration;
+	// exited processes are dropped
+	void Resample(const SampleSet &prev, const AppConfig &config, ProcSource &src = ProcSource::GetDefault());
+	// Same result as a full scan, from 'prev' and the processes started or
+	// exited since; cost depends on the matched processes and the churn
+	void Update(const SampleSet &prev, const AppConfig &config, const ProcEvents &events, ProcSource &src = ProcSource::GetDefault());
+
+	// History record in the configured format
+	void MakeRecord(const AppConfig &config);
+	// Loads history, detecting its format
+	bool ReadRecord(const AppConfig &config);
 	void MakeJsonRecord(const AppConfig &config);
 	bool ReadJsonRecord(const AppConfig &config);
+	void MakeBinaryRecord(const AppConfig &config);
+	bool ReadBinaryRecord(const AppConfig &config);
 
 	void Print(std::ostream &strm) const;
 
+	// Key of the sample of a cgroup section; negative, so never a real pid
+	static pid_t GetCgroupPid(size_t icfg) { return -(pid_t)(icfg + 1); }
+	bool IsDue(size_t icfg) const { return m_Due.empty() || m_Due[icfg]; }
+	// Clock of the samples of a section; older than m_Clock if not due
+	uint64_t GetReadClock(size_t icfg) const { return m_ReadClocks.empty() ? m_Clock : m_ReadClocks[icfg]; }
+
 protected:
-	bool GetArgv(grumat::StringArray &res, pid_t pid);
+	typedef std::vector<std::pair<pid_t, pid_t> > Parents_t;
+	// Configuration and sample of each match of a worker
+	typedef std::vector<std::pair<size_t, Sample> > Matches_t;
+	// Lists and matches all processes
+	void Scan(const AppConfig &config, ProcSource &src, ArgvCache *cache, const SampleSet *prev);
+	// Matches processes reported by the events, and their descendants
+	void AddStarted(const AppConfig &config, const ProcEvents &events, ProcSource &src);
+	// Samples the sections reading a cgroup, one sample each
+	void AddCgroups(const AppConfig &config, ProcSource &src, const SampleSet *prev);
+	// Samples unmatched descendants of services accounting children
+	void AddDescendants(const AppConfig &config, ProcSource &src, std::vector<Parents_t> &parents, const SampleSet *prev);
+	// Adds the matches of all workers, reading the counters of those
+	// not carried from a previous set
+	void MergeMatches(std::vector<Matches_t> &found, const AppConfig &config, ProcSource &src);
+	// Reads 'samps' in batches, so backends can pipeline requests, and adds
+	// the processes still alive with their configuration in 'cfgs'
+	void AddSamples(std::vector<Sample> &samps, const std::vector<size_t> &cfgs, const AppConfig &config, ProcSource &src);
+	// Sample of 'prev' kept for a section not due, or NULL if it must be
+	// read; 'start' is 0 when unknown
+	const Sample *GetCarried(const SampleSet *prev, size_t icfg, pid_t pid, uint64_t start) const;
+	// Configuration of a sample loaded from history or (size_t)-1
+	static size_t MapSample(const AppConfig &config, const Sample &samp);
+	// Sets m_ReadClocks after sampling the sections due; others keep those of 'prev'
+	void CarryReadClocks(const SampleSet &prev);
 
 public:
 	uint64_t m_Clock;
 	SampleSet_t m_Samples;
 	Pid2Cfg_t m_Pid2Cfg;
+	// Sections read by this set, set before sampling; empty for all. The
+	// others keep older samples, not matching m_Clock
+	Due_t m_Due;
+	// Clock at which each section was read; empty when all were read now
+	std::vector<uint64_t> m_ReadClocks;
 };
 
 
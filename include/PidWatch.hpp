@@ -0,0 +1,52 @@
+#pragma once
+
+#include "PidSample.hpp"
+
+
+namespace PidSample
+{
+
+
+// Holds a pidfd for each sampled process and reports their exit as it
+// happens; a pidfd cannot refer to a recycled pid (Linux 5.3+ only)
+class PidWatch
+{
+public:
+	typedef std::unordered_set<pid_t> Pids_t;
+
+	PidWatch();
+	~PidWatch();
+
+	// False if pidfds are not supported
+	bool Open();
+	void Close();
+	bool IsOpen() const { return m_Poll >= 0; }
+	// Readable when a watched process exits
+	int GetSocket() const { return m_Poll; }
+	// Watches the processes of 'samps' and forgets the others; a new pidfd
+	// is only kept if the start time proves it is the sampled process
+	void Sync(const SampleSet &samps, ProcSource &src);
+	// Moves exited processes to m_Exited; never blocks
+	void Read();
+	// Removes the processes of m_Exited from 'samps' and clears it
+	size_t Drop(SampleSet &samps);
+
+public:
+	// Exited since the last Drop()
+	Pids_t m_Exited;
+
+protected:
+	void Unwatch(int fd);
+
+protected:
+	typedef std::unordered_map<pid_t, int> Fds_t;
+	// epoll instance of all pidfds
+	int m_Poll;
+	Fds_t m_Fds;
+	// Out of descriptors; processes stay watched by their start time only
+	bool m_Full;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <unordered_set>
+
+
+namespace PidSample
+{
+
+
+// Listener of the kernel proc connector, collecting the processes that
+// started, exec'd or exited between two samples (Linux only)
+class ProcEvents
+{
+public:
+	typedef std::unordered_set<pid_t> Pids_t;
+
+	ProcEvents();
+	~ProcEvents();
+
+	// Subscribes to the events; false if not available (needs CAP_NET_ADMIN)
+	bool Open();
+	void Close();
+	bool IsOpen() const { return m_Socket >= 0; }
+	int GetSocket() const { return m_Socket; }
+	// Drains the pending events; the socket is non-blocking
+	void Read();
+	// Events were dropped since Clear(); only a full scan is reliable
+	bool IsLost() const { return m_Lost; }
+	void Clear();
+
+public:
+	// Processes that forked or exec'd; their command line may have changed
+	Pids_t m_Started;
+	// Processes gone; a pid reused afterwards is in m_Started only
+	Pids_t m_Exited;
+
+protected:
+	void OnStart(pid_t pid);
+	void OnExit(pid_t pid);
+
+protected:
+	int m_Socket;
+	bool m_Lost;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "String.hpp"
+#include <mutex>
+
+
+namespace PidSample
+{
+
+
+class Sample;
+
+
+// Command line as views into a raw buffer; reusing an instance avoids
+// any allocation once its buffers have grown
+class ArgvView
+{
+public:
+	ArgvView() : m_Truncated(false) {}
+
+	void Clear() { m_Args.clear(); m_Truncated = false; }
+	size_t GetCount() const { return m_Args.size(); }
+	const std::string_view *GetData() const { return m_Args.data(); }
+	std::string_view operator[](size_t i) const { return m_Args[i]; }
+	// Splits '\0' terminated strings of 'buf', keeping up to 'max_args'
+	void Parse(const char *buf, size_t len, size_t max_args);
+	// Owned copy of the arguments
+	grumat::StringArray ToArray() const;
+
+public:
+	// Raw data the views refer to
+	std::vector<char> m_Buffer;
+	std::vector<std::string_view> m_Args;
+	// Arguments beyond the requested limit were not parsed
+	bool m_Truncated;
+};
+
+
+// Identity data of a process
+class ProcInfo
+{
+public:
+	// Opaque start time; together with the pid, identifies a process
+	uint64_t m_StartTime;
+	// Hash of the program name, which changes on exec() unlike the above
+	uint64_t m_ExecId;
+	pid_t m_PPid;
+};
+
+
+// Operating system facility that enumerates processes and reads their counters
+class ProcSource
+{
+public:
+	virtual ~ProcSource() {}
+
+	// Monotonic system clock, in nanoseconds
+	virtual uint64_t GetClock() = 0;
+	// Lists all pids of the system
+	virtual bool ListPids(std::vector<pid_t> &pids) = 0;
+	// Retrieves the command line of a process, up to 'max_args' arguments
+	virtual bool GetArgvView(ArgvView &res, pid_t pid, size_t max_args) = 0;
+	// Retrieves the complete command line of a process
+	bool GetArgv(grumat::StringArray &res, pid_t pid);
+	// Retrieves identity data of a process; much cheaper than GetArgv()
+	virtual bool GetProcInfo(ProcInfo &info, pid_t pid) = 0;
+	// Fills CPU (ns) and disk (bytes) counters and start time of the process in samp.m_Pid
+	virtual bool ReadSample(Sample &samp) = 0;
+	// ReadSample() of 'count' samples, setting ok[i] for each; may batch requests
+	virtual void ReadSamples(Sample *samps, size_t count, char *ok);
+	// CPU time of whole processes from taskstats, in ns; false if not permitted
+	virtual bool SetTaskstats(bool enable) { (void)enable; return false; }
+	// Reads processes from another tree, such as a test fixture; false if not supported
+	virtual bool SetRoot(const char *path) { (void)path; return false; }
+	// Fills CPU and disk counters of a cgroup v2 directory, relative to the cgroup
+	// root, including exited members; the start time identifies the cgroup
+	virtual bool ReadCgroup(Sample &samp, const char *path) { (void)samp; (void)path; return false; }
+	// Mount point of the cgroup v2 hierarchy; false if not supported
+	virtual bool SetCgroupRoot(const char *path) { (void)path; return false; }
+
+	// The native backend for the running platform
+	static ProcSource &GetDefault();
+
+protected:
+	// ProcInfo::m_ExecId of a program name
+	static uint64_t HashName(const char *name, size_t len);
+};
+
+
+#if defined(__APPLE__)
+
+// libproc/sysctl backend
+class DarwinProcSource : public ProcSource
+{
+public:
+	DarwinProcSource();
+
+	virtual uint64_t GetClock() override;
+	virtual bool ListPids(std::vector<pid_t> &pids) override;
+	virtual bool GetArgvView(ArgvView &res, pid_t pid, size_t max_args) override;
+	virtual bool GetProcInfo(ProcInfo &info, pid_t pid) override;
+	virtual bool ReadSample(Sample &samp) override;
+
+protected:
+	// Size of the argument space (KERN_ARGMAX)
+	size_t m_ArgMax;
+};
+
+#elif defined(__linux__)
+
+// procfs backend
+class LinuxProcSource : public ProcSource
+{
+public:
+	LinuxProcSource();
+
+	virtual uint64_t GetClock() override;
+	virtual bool ListPids(std::vector<pid_t> &pids) override;
+	virtual bool GetArgvView(ArgvView &res, pid_t pid, size_t max_args) override;
+	virtual bool GetProcInfo(ProcInfo &info, pid_t pid) override;
+	virtual bool ReadSample(Sample &samp) override;
+	virtual bool SetRoot(const char *path) override;
+	virtual bool ReadCgroup(Sample &samp, const char *path) override;
+	virtual bool SetCgroupRoot(const char *path) override;
+	virtual void ReadSamples(Sample *samps, size_t count, char *ok) override;
+	virtual bool SetTaskstats(bool enable) override;
+
+protected:
+	// Reads a file of the /proc/<pid> directory; returns number of bytes or -1
+	ssize_t ReadPidFile(pid_t pid, const char *name, char *buf, size_t size) const;
+	static ssize_t ReadFile(const char *path, char *buf, size_t size);
+	// Counters from procfs; CPU time has the resolution of a clock tick
+	bool ReadProcFiles(Sample &samp);
+	// Replaces the CPU time of the 'ok' samples, pipelining the requests;
+	// clears ok[i] for processes gone; false if the socket failed
+	bool QueryTaskstats(Sample *samps, size_t count, char *ok);
+
+protected:
+	// Length of a clock tick in ns
+	uint64_t m_TickNs;
+	// Mount point of procfs
+	std::string m_Root;
+	std::string m_CgroupRoot;
+	// Generic netlink socket and family of taskstats; -1 if disabled
+	int m_Taskstats;
+	uint16_t m_TsFamily;
+	uint32_t m_TsSeq;
+	// Scan workers share the socket
+	std::mutex m_TsLock;
+};
+
+#endif
+
+
+}	// PidSample
+
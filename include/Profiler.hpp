@@ -0,0 +1,97 @@
+#pragma once
+
+
+namespace PidSample
+{
+
+
+// Steps of a check, in execution order
+enum Phase_e
+{
+	phConfig,
+	phHistoryLoad,
+	phEnumerate,
+	phArgv,
+	phMatch,
+	phSample,
+	phHistoryWrite,
+	phEvaluate,
+	phCount
+};
+
+
+class PhaseStat
+{
+public:
+	uint64_t m_Calls;
+	// Phases run by workers add the time of all threads
+	uint64_t m_WallNs;
+	uint64_t m_CpuNs;
+};
+
+
+// Resource usage of a check; plain data, also stored in the binary history
+class ProfileData
+{
+public:
+	PhaseStat m_Phases[phCount];
+	// Totals of the process since the profiler was reset
+	uint64_t m_WallNs;
+	uint64_t m_CpuNs;
+	uint64_t m_Allocs;
+	uint64_t m_AllocBytes;
+	// High water mark of the resident memory, in bytes
+	uint64_t m_PeakRss;
+
+	void Print(std::ostream &strm) const;
+	void ToJson(Json::Value &obj) const;
+};
+
+
+// Process wide phase counters; inactive unless enabled
+class Profiler
+{
+public:
+	// Enabling also resets the counters
+	static void Enable(bool on);
+	static bool IsEnabled() { return s_Enabled; }
+	static void Reset();
+	static void Add(Phase_e ph, uint64_t wall_ns, uint64_t cpu_ns);
+	static void GetData(ProfileData &data);
+	static const char *GetName(Phase_e ph);
+
+protected:
+	static bool s_Enabled;
+};
+
+
+// Charges the time of a scope to a phase; costs a flag test when disabled
+class ProfileScope
+{
+public:
+	ProfileScope(Phase_e ph);
+	~ProfileScope() { Stop(); }
+	// Closes the current phase, if any, and continues timing 'ph'
+	void Switch(Phase_e ph)
+	{
+		if(Profiler::IsEnabled())
+		{
+			Stop();
+			Start(ph);
+		}
+	}
+	void Stop();
+
+protected:
+	void Start(Phase_e ph);
+
+protected:
+	bool m_Active;
+	Phase_e m_Phase;
+	uint64_t m_Wall;
+	uint64_t m_Cpu;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Activity.hpp"
+#include <mutex>
+
+
+namespace PidSample
+{
+
+
+// Publishes the last verdict and service rates in the Prometheus text format
+class PromExporter
+{
+public:
+	PromExporter(const AppConfig &config);
+	~PromExporter();
+
+	// Renders the results of an evaluation; 'samps' gives the process count of each service
+	void Update(const Activity &act, const SampleSet &samps, int verdict);
+	std::string GetText() const;
+	// Replaces the configured textfile atomically
+	bool WriteFile() const;
+
+	// Opens the localhost endpoint on the configured port
+	bool Listen();
+	// Listening socket or -1
+	int GetSocket() const { return m_Listen; }
+	// Answers pending scrapes with the last rendered text
+	void Serve();
+
+protected:
+	void Reply(int fd);
+
+protected:
+	const AppConfig &m_Config;
+	std::string m_Text;
+	// Scrapes are served by another thread than Update()
+	mutable std::mutex m_Lock;
+	int m_Listen;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Activity.hpp"
+#include <atomic>
+
+
+namespace PidSample
+{
+
+
+/*
+** POSIX shared memory segment written by the daemon after each check:
+** ShmHeader followed by m_Count ShmService entries, in section order.
+** The writer makes m_Seq odd while updating; a reader copies the data and
+** retries unless m_Seq was the same even value before and after the copy.
+** m_Seq is 0 until the first check is published.
+*/
+struct ShmHeader
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_HeaderSize;
+	uint32_t m_EntrySize;
+	uint32_t m_Count;
+	std::atomic<uint32_t> m_Seq;
+	int32_t m_Verdict;
+	// CLOCK_MONOTONIC_RAW of the check, in ns, to tell stale data
+	uint64_t m_Clock;
+	// Wall clock of the check, in ms
+	int64_t m_Time;
+	// Interval covered by the rates, in ns
+	uint64_t m_Interval;
+};
+
+
+struct ShmService
+{
+	// Truncated section name
+	char m_Name[48];
+	uint32_t m_Procs;
+	// Rates exist only for services running on both compared samples
+	uint32_t m_HasRate;
+	// CPU usage in %
+	double m_Cpu;
+	// Disk transfers in bytes/s
+	int64_t m_ReadBytes;
+	int64_t m_WriteBytes;
+};
+
+
+// Consistent copy of the segment
+class VerdictSnapshot
+{
+public:
+	int m_Verdict;
+	uint64_t m_Clock;
+	int64_t m_Time;
+	uint64_t m_Interval;
+	std::vector<ShmService> m_Services;
+};
+
+
+// Publishes the verdict of the daemon for readers that skip the socket
+class SharedVerdict
+{
+public:
+	enum { kVersion = 1 };
+	static const char kMagic[8];
+
+	SharedVerdict(const AppConfig &config);
+	~SharedVerdict();
+
+	// Creates the configured segment, sized for the sections (writer)
+	bool Create();
+	// Maps an existing segment read-only (reader)
+	bool Attach();
+	bool IsOpen() const { return m_Header != NULL; }
+	// Writes the results of an evaluation; 'samps' gives the process counts
+	void Publish(const Activity &act, const SampleSet &samps, int verdict);
+	// False if nothing is published or no consistent copy could be taken
+	bool Read(VerdictSnapshot &snap) const;
+
+	// Verdict published by a daemon or -1 if missing or older than the
+	// configured interval
+	static int Query(const AppConfig &config);
+
+protected:
+	void Close();
+
+protected:
+	const AppConfig &m_Config;
+	ShmHeader *m_Header;
+	size_t m_Size;
+	// Created by this instance, so removed on exit
+	bool m_Owner;
+};
+
+
+}	// PidSample
+
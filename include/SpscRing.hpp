@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+
+
+namespace grumat
+{
+
+
+// Bounded lock-free queue between exactly one producer and one consumer
+// thread; elements are moved in and out
+template <typename T>
+class SpscRing
+{
+public:
+	explicit SpscRing(size_t capacity)
+		: m_Slots(capacity + 1)
+		, m_Head(0)
+		, m_Tail(0)
+	{
+	}
+
+	// Producer only; 'val' is left untouched when the ring is full
+	bool TryPush(T &val)
+	{
+		const size_t tail = m_Tail.load(std::memory_order_relaxed);
+		const size_t next = Next(tail);
+		if(next == m_Head.load(std::memory_order_acquire))
+			return false;
+		m_Slots[tail] = std::move(val);
+		m_Tail.store(next, std::memory_order_release);
+		return true;
+	}
+	// Consumer only
+	bool TryPop(T &val)
+	{
+		const size_t head = m_Head.load(std::memory_order_relaxed);
+		if(head == m_Tail.load(std::memory_order_acquire))
+			return false;
+		val = std::move(m_Slots[head]);
+		m_Head.store(Next(head), std::memory_order_release);
+		return true;
+	}
+	bool IsEmpty() const
+	{
+		return m_Head.load(std::memory_order_acquire) == m_Tail.load(std::memory_order_acquire);
+	}
+	size_t GetCapacity() const { return m_Slots.size() - 1; }
+
+protected:
+	size_t Next(size_t pos) const { return pos + 1 == m_Slots.size() ? 0 : pos + 1; }
+
+protected:
+	// One slot stays free to tell a full ring from an empty one
+	std::vector<T> m_Slots;
+	// Written by the consumer and the producer respectively; apart, so
+	// each thread keeps its own cache line
+	alignas(64) std::atomic<size_t> m_Head;
+	alignas(64) std::atomic<size_t> m_Tail;
+};
+
+
+}	// namespace grumat
+
@@ -1,8 +1,16 @@
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <limits.h>
+#if defined(__APPLE__)
 #include <sys/proc_info.h>
 #include <libproc.h>
+#else
+#include <sys/param.h>
+#include <dirent.h>
+#endif
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 #include <pwd.h>
@@ -11,6 +19,9 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <string_view>
+#include <algorithm>
 #include <iomanip>
 #include <fstream>
 #include <json/value.h>
@@ -0,0 +1,55 @@
+#pragma once
+
+
+namespace grumat
+{
+
+
+// Hierarchical timing wheel: level 0 holds the timers of the next
+// kSlots ticks; each further level covers kSlots times more and is
+// cascaded to the level below when that one wraps. Scheduling and
+// expiry cost O(1) per timer, whatever the number of timers.
+class TimerWheel
+{
+public:
+	TimerWheel();
+
+	// Removes all timers and restarts at tick 0
+	void Clear();
+	// Fires timer 'id' at the absolute 'tick'; past ticks fire on the next one
+	void Schedule(size_t id, uint64_t tick);
+	// Moves the current tick up to 'tick', appending expired timers to 'fired'
+	void Advance(uint64_t tick, std::vector<size_t> &fired);
+	// Next tick that may fire a timer or needs a cascade; UINT64_MAX if idle
+	uint64_t GetNextTick() const;
+	uint64_t GetNow() const { return m_Now; }
+	size_t GetCount() const { return m_Count; }
+
+protected:
+	enum
+	{
+		kBits = 6,
+		kSlots = 1 << kBits,
+		kLevels = 4,
+	};
+	class Timer
+	{
+	public:
+		size_t m_Id;
+		uint64_t m_Tick;
+	};
+	typedef std::vector<Timer> Slot_t;
+
+	void Insert(const Timer &t);
+	// Redistributes the current slot of 'level' on the levels below
+	void Cascade(size_t level);
+
+protected:
+	Slot_t m_Wheel[kLevels][kSlots];
+	uint64_t m_Now;
+	size_t m_Count;
+};
+
+
+}	// namespace grumat
+
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "PidSample.hpp"
+
+
+namespace PidSample
+{
+
+
+/*
+** Long-term history: a directory of append-only segments named after the
+** wall clock of their first point ('%016llx.seg'). Segment layout:
+**
+**	TrendHeader
+**	char[m_NamesSize]			'\0' terminated service names
+**	records, each a varint payload size followed by:
+**		zigzag varint			delta-of-delta of the time
+**		varint[3]				increments of checks, active checks and sampled ns
+**		per service:
+**			varint				process count XOR the previous one
+**			varint[4]			increments of CPU ns, read and write bytes and
+**								sampled ns of the service
+**
+** Counters are cumulative, so compaction may drop points without changing
+** the totals. The first record of a segment is relative to zero.
+*/
+struct TrendHeader
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_HeaderSize;
+	// Wall clock of the first and last point, in ms
+	int64_t m_FirstTime;
+	int64_t m_LastTime;
+	uint32_t m_Count;
+	// Compaction passes done on the segment
+	uint32_t m_Level;
+	uint32_t m_NameCount;
+	uint32_t m_NamesSize;
+};
+
+
+// Counters of a service since it appeared in the history
+class TrendValues
+{
+public:
+	TrendValues() : m_Procs(0), m_CpuNs(0), m_ReadBytes(0), m_WriteBytes(0), m_SampledNs(0) {}
+
+	// Running processes at the check
+	uint64_t m_Procs;
+	uint64_t m_CpuNs;
+	uint64_t m_ReadBytes;
+	uint64_t m_WriteBytes;
+	// Time covered by the reads of the service; sections sampled on their
+	// own interval are not read on every check
+	uint64_t m_SampledNs;
+};
+
+
+class TrendPoint
+{
+public:
+	TrendPoint() : m_Time(0), m_Checks(0), m_Active(0), m_SampledNs(0) {}
+
+	// Wall clock in ms
+	int64_t m_Time;
+	uint64_t m_Checks;
+	// Checks finding the server active
+	uint64_t m_Active;
+	// Time covered by valid sample intervals
+	uint64_t m_SampledNs;
+	// Same order as the names of the segment
+	std::vector<TrendValues> m_Services;
+};
+
+
+// Append-only store of per-service counters and its queries
+class TrendStore
+{
+public:
+	enum { kVersion = 2 };
+	static const char kMagic[8];
+
+	TrendStore(const AppConfig &config);
+
+	// Adds a check of 'samps' against 'old_samps' (NULL without history)
+	bool Append(const SampleSet *old_samps, const SampleSet &samps, int verdict);
+	// Prints the rates of the points inside [from, to] (ms), by 'step' ms
+	// buckets or as a single one if 0; segments are streamed
+	bool Query(std::ostream &strm, int64_t from, int64_t to, int64_t step) const;
+
+	// Absolute or relative time ('-90m', 'now', epoch seconds, 'YYYY-MM-DD[ HH:MM[:SS]]') in ms
+	static bool ParseTime(const char *str, int64_t now, int64_t &res);
+	// Count of seconds with an optional 's', 'm', 'h' or 'd' suffix, in ms
+	static bool ParseDuration(const char *str, int64_t &res);
+	static int64_t GetWallClock();
+
+protected:
+	// Recovers the state of the newest segment, unless known and unchanged
+	bool LoadTail();
+	bool StartSegment(const std::vector<std::string> &names, int64_t time);
+	// Shrinks or deletes the oldest segments above the configured size
+	void Compact();
+	// Rewrites a segment keeping every other point
+	bool CompactSegment(const std::string &fname, size_t &new_size);
+	void ListSegments(std::vector<std::string> &segs) const;
+	std::string MakeSegmentName(int64_t time) const;
+	size_t GetSegmentLimit() const;
+
+protected:
+	const AppConfig &m_Config;
+	// Active segment
+	std::string m_File;
+	std::vector<std::string> m_Names;
+	size_t m_End;
+	uint32_t m_Count;
+	// Encoding base of the next record
+	TrendPoint m_Prev;
+	int64_t m_PrevDelta;
+	// Newest point; counters continue from it across segments
+	TrendPoint m_Last;
+	std::vector<std::string> m_LastNames;
+};
+
+
+}	// PidSample
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace grumat
+{
+
+
+// Runs a range of independent jobs on a few worker threads. Each worker
+// owns a contiguous share of the range and steals chunks from the others
+// once its own share is exhausted. Workers are started on demand and kept
+// until the pool is destroyed, so repeated runs do not respawn threads.
+class WorkPool
+{
+public:
+	// Called with the worker number (0..threads-1) and the job index
+	typedef std::function<void(size_t worker, size_t index)> Job_t;
+
+	WorkPool();
+	~WorkPool();
+
+	// Pool shared by the whole process
+	static WorkPool &GetDefault();
+	// Number of threads used for a request of 'threads' (0 is automatic)
+	static size_t GetThreadCount(size_t threads, size_t count);
+	// Blocks until all 'count' jobs are done; the caller is worker 0
+	void Run(size_t count, size_t threads, const Job_t &job);
+
+protected:
+	struct WorkShare;
+
+	// Thread body of worker 'self'; 'gen' is the last run it has seen
+	void WorkerLoop(size_t self, uint64_t gen);
+	// Runs jobs of the current run until none is left
+	void Work(size_t self);
+
+protected:
+	// Serializes callers of Run()
+	std::mutex m_RunLock;
+	// Guards the fields below
+	std::mutex m_Lock;
+	std::condition_variable m_Start;
+	std::condition_variable m_Done;
+	std::vector<std::thread> m_Workers;
+	// Incremented for each run; workers wait for a change
+	uint64_t m_Gen;
+	bool m_Stop;
+	// Current run
+	const Job_t *m_Job;
+	std::vector<WorkShare> m_Shares;
+	size_t m_Threads;
+	// Workers still running jobs of the current run
+	size_t m_Busy;
+};
+
+
+}	// namespace grumat
@@ -0,0 +1,186 @@
+#include "StdInc.hpp"
+#include "Activity.hpp"
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+Activity::Activity(const AppConfig &config, LogType_e lvl)
+	: m_Config(config)
+	, m_LogLevel(lvl)
+	, m_MinTimeDiff(1000000000ULL)
+	, m_AllRates(false)
+	, m_TimeDiff(0)
+	, m_Secs(0)
+{
+}
+
+
+bool Activity::CheckInterval(uint64_t old_clock, uint64_t clock, const char *name)
+{
+	std::string what = "Can't determine idle state";
+	if(name)
+		what = what + " of '" + name + '\'';
+	// History timestamp is ascending?
+	LOG(DEBUG) << "Validating clock values: before: " << old_clock << "; after: " << clock << std::endl;
+	if (clock <= old_clock)
+	{
+		LOG(WARN) << what << ". History timestamp is not ascending...\n";
+		return false;
+	}
+	// X s = X * 10ˆ9 ns
+	m_TimeDiff = (clock - old_clock);
+	LOG(DEBUG) << "Time difference: " << m_TimeDiff / 1000000 << " ms\n";
+	m_Secs = m_TimeDiff / 1000000000ULL;
+	if(m_TimeDiff < m_MinTimeDiff)
+	{
+		LOG(WARN) << what << ". History is too recent (< 1s)\n";
+		return false;
+	}
+	if (m_Secs > m_Config.m_IntervalThr)
+	{
+		LOG(WARN) << what << ". History is more than " << m_Config.m_IntervalThr << " s...\n";
+		return false;
+	}
+	return true;
+}
+
+
+bool Activity::CheckService(size_t icfg, const Diff &dif)
+{
+	const bool log_debug = LOG_ACTIVE(DEBUG);
+	bool active = false;
+	#define RET_ACTIVE(cond, ...)						\
+	{													\
+		if(cond)										\
+		{												\
+			LOG(m_LogLevel) << __VA_ARGS__				\
+				<< " Server activity confirmed...\n";	\
+			if (!log_debug) 							\
+				return true;							\
+			active = true;								\
+		}												\
+		else											\
+			LOG(DEBUG) << __VA_ARGS__ << '\n';			\
+	}
+	//
+	const ProcessConfig &pcfg = m_Config.m_Procs[icfg];
+	ServiceRate rate;
+	rate.m_Cfg = icfg;
+	rate.m_Cpu = dif.GetRelativeTime(m_TimeDiff);
+	// Fractional seconds; in-run windows are usually shorter than 1 s
+	const double secs = m_TimeDiff / 1e9;
+	rate.m_DiskBytes = (int64_t)(dif.GetTotalDiskBytes() / secs);
+	rate.m_ReadBytes = (int64_t)(dif.m_DiskReadBytes / secs);
+	rate.m_WriteBytes = (int64_t)(dif.m_DiskWriteBytes / secs);
+	m_Rates.push_back(rate);
+	RET_ACTIVE((rate.m_Cpu > pcfg.m_CPU), "Service '" << pcfg.m_Name << "' is using " << Fmt("%3.1f%%", rate.m_Cpu));
+	//
+	if(pcfg.m_DiskTotal)
+	{
+		RET_ACTIVE((rate.m_DiskBytes > (int64_t)pcfg.m_DiskTotal), "Service '" << pcfg.m_Name << "' transferred " << rate.m_DiskBytes << " disk bytes/s!");
+	}
+	//
+	if(pcfg.m_DiskRead)
+	{
+		RET_ACTIVE((rate.m_ReadBytes > (int64_t)pcfg.m_DiskRead), "Service '" << pcfg.m_Name << "' read " << rate.m_ReadBytes << " disk bytes/s!");
+	}
+	//
+	if(pcfg.m_DiskWrite)
+	{
+		RET_ACTIVE((rate.m_WriteBytes > (int64_t)pcfg.m_DiskWrite), "Service '" << pcfg.m_Name << "' wrote " << rate.m_WriteBytes << " disk bytes/s!");
+	}
+	#undef RET_ACTIVE
+	return active;
+}
+
+
+int Activity::Evaluate(const SampleSet *old_samps, const SampleSet &samps)
+{
+	const bool log_debug = LOG_ACTIVE(DEBUG);
+	m_Rates.clear();
+	LOG(DEBUG) << "Found " << samps.m_Samples.size() << " process running\n";
+	if (samps.m_Samples.size() == 0)
+	{
+		// No process match, Server can shutdown
+		LOG(m_LogLevel) << "No listed service was found. Server is allowed to shutdown...\n";
+		return IDLE_STATE;
+	}
+	// Can't read history JSON file
+	if (old_samps == NULL)
+	{
+		LOG(WARN) << "Can't determine idle state. No history was found...\n";
+		return ACTIVE_STATE;
+	}
+	if(!CheckInterval(old_samps->m_Clock, samps.m_Clock, NULL))
+		return ACTIVE_STATE;
+	LOG(DEBUG) << "Computing processes workload\n";
+	DiffMap_t m;
+	for (SampleSet::SampleSet_t::const_iterator it = samps.m_Samples.begin(); it != samps.m_Samples.end(); ++it)
+	{
+		// Check for new arrivals
+		SampleSet::SampleSet_t::const_iterator old = old_samps->m_Samples.find(it->first);
+		if (old == old_samps->m_Samples.end()
+			|| !it->second.IsSameProcess(old->second))
+		{
+			LOG(m_LogLevel) << "New service arrived! Wait until next turn to check activity...\n";
+			return ACTIVE_STATE;
+		}
+		Diff dif = it->second - old->second;
+		size_t icfg = samps.m_Pid2Cfg.at(it->first);
+		if (m.count(icfg) == 0)
+			m[icfg] = dif;
+		else
+			m[icfg] += dif;
+	}
+	//
+	int retcode = IDLE_STATE;
+	// Verify if computed process load overflows thresholds
+	LOG(DEBUG) << "Comparing workload thresholds\n";
+	for (DiffMap_t::const_iterator it = m.begin(); it != m.end(); ++it)
+	{
+		if(CheckService(it->first, it->second))
+		{
+			retcode = ACTIVE_STATE;
+			if(!log_debug && !m_AllRates)
+				return retcode;
+		}
+	}
+	if(retcode == IDLE_STATE)
+		LOG(m_LogLevel) << "No listed service has significant workload. Server is allowed to shutdown...\n";
+	return retcode;
+}
+
+
+int Activity::EvaluateService(size_t icfg
+	, const SampleSet::SampleSet_t &old_samps, uint64_t old_clock
+	, const SampleSet::SampleSet_t &samps, uint64_t clock
+	)
+{
+	const ProcessConfig &pcfg = m_Config.m_Procs[icfg];
+	// Service not running
+	if(samps.empty())
+		return IDLE_STATE;
+	if(!CheckInterval(old_clock, clock, pcfg.m_Name))
+		return ACTIVE_STATE;
+	Diff sum = { 0, 0, 0, 0 };
+	for (SampleSet::SampleSet_t::const_iterator it = samps.begin(); it != samps.end(); ++it)
+	{
+		SampleSet::SampleSet_t::const_iterator old = old_samps.find(it->first);
+		if (old == old_samps.end()
+			|| !it->second.IsSameProcess(old->second))
+		{
+			LOG(m_LogLevel) << "New process of service '" << pcfg.m_Name << "' arrived! Wait until next turn to check activity...\n";
+			return ACTIVE_STATE;
+		}
+		sum += it->second - old->second;
+	}
+	return CheckService(icfg, sum) ? ACTIVE_STATE : IDLE_STATE;
+}
+
+
+}	// PidSample
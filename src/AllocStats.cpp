@@ -0,0 +1,87 @@
+#include "StdInc.hpp"
+#include "AllocStats.hpp"
+#include <atomic>
+#include <new>
+
+
+// Relaxed counters; cheap enough to stay in the release build
+static std::atomic<uint64_t> s_Count(0);
+static std::atomic<uint64_t> s_Bytes(0);
+
+
+static void *CountedAlloc(size_t size)
+{
+	s_Count.fetch_add(1, std::memory_order_relaxed);
+	s_Bytes.fetch_add(size, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+
+void *operator new(size_t size)
+{
+	void *p = CountedAlloc(size);
+	if(p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return CountedAlloc(size);
+}
+
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return CountedAlloc(size);
+}
+
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
+
+
+namespace grumat
+{
+
+
+uint64_t AllocStats::GetCount()
+{
+	return s_Count.load(std::memory_order_relaxed);
+}
+
+
+uint64_t AllocStats::GetBytes()
+{
+	return s_Bytes.load(std::memory_order_relaxed);
+}
+
+
+}	// namespace grumat
@@ -34,7 +34,7 @@ std::string AnyConfig::ParseValue(const char *val, size_t line)
 				++val;
 				if(*val == 0)
 				{
-					Log(WARN) << "(" << line <<") Invalid escape char '\\' at end of line! Ignored...\n";
+					LOG(WARN) << "(" << line <<") Invalid escape char '\\' at end of line! Ignored...\n";
 					return res;
 				}
 			}
@@ -43,13 +43,13 @@ std::string AnyConfig::ParseValue(const char *val, size_t line)
 		// Validate
 		if(in_str)
 		{
-			Log(WARN) << "(" << line <<") Missing a closing string delimiter '" << in_str << "'! ";
+			LOG(WARN) << "(" << line <<") Missing a closing string delimiter '" << in_str << "'! ";
 			size_t n = res.GetLength();
 			res.TrimRight();
 			if(n != res.GetLength())
-				Log(WARN) << "Removing trailing spaces...\n";
+				LOG(WARN) << "Removing trailing spaces...\n";
 			else
-				Log(WARN) << "Accepting as is; please review line...\n";
+				LOG(WARN) << "Accepting as is; please review line...\n";
 			return res;
 		}
 		// validate line tail
@@ -57,7 +57,7 @@ std::string AnyConfig::ParseValue(const char *val, size_t line)
 			++val;
 		// Unknown text outside of the text quotes
 		if(*val && *val != '#')
-			Log(WARN) << "(" << line <<") Tail text '" << val << "' was ignored...";
+			LOG(WARN) << "(" << line <<") Tail text '" << val << "' was ignored...";
 	}
 	else
 	{
@@ -79,7 +79,7 @@ bool AnyConfig::Parse(const char *path)
 	FFile file(path, "r");
 	if(!file.IsValid())
 	{
-		Log(ERROR) << "Cannot open '" << path << "' configuration file!\n";
+		LOG(ERROR) << "Cannot open '" << path << "' configuration file!\n";
 		return false;
 	}
 	size_t line_count = 0;
@@ -108,7 +108,7 @@ bool AnyConfig::Parse(const char *path)
 			// merge section contents if previously defined
 			if(count(cur_name) != 0)
 			{
-				Log(ERROR) << "(" << line_count << "): Section name '" << cur_name << "' already used before!\n";
+				LOG(ERROR) << "(" << line_count << "): Section name '" << cur_name << "' already used before!\n";
 				return false;
 			}
 		}
@@ -117,7 +117,7 @@ bool AnyConfig::Parse(const char *path)
 			StringArray arr = line.Split('=', 1);
 			if(arr.size() != 2)
 			{
-				Log(ERROR) << "(" << line_count << "): Invalid configuration line found: " << line << std::endl;
+				LOG(ERROR) << "(" << line_count << "): Invalid configuration line found: " << line << std::endl;
 				return false;
 			}
 			cur_section.push_back(KeyVal(line_count, arr[0], ParseValue(arr[1], line_count)));
@@ -138,31 +138,82 @@ using namespace grumat;
 
 AppConfig::AppConfig()
 {
-	m_RecordFile = "/opt/local/var/run/is_server_busy.json";
+	m_RecordFile = "/opt/local/var/run/is_server_busy.hist";
+	m_HistoryFormat = hfBinary;
 	m_IntervalThr = 120;
+	m_Window = 0;
+	m_Threads = 1;
+	m_ArgvCache = true;
+	m_Taskstats = false;
+	m_SocketFile = "/opt/local/var/run/is_server_busy.sock";
+	m_SampleInterval = 10;
+	m_HistoryDepth = 0;
+	m_QueueSize = 4;
+	m_QueueFull = qfDrop;
+	m_ProcEvents = false;
+	m_PromListen = 0;
+	m_CgroupRoot = "/sys/fs/cgroup";
+	m_Snapshot = true;
+	m_TrendSize = 16 * 1024 * 1024;
+	m_Matcher.Build(m_Procs);
 }
 
 
-bool AppConfig::Get(size_t &res, const KeyVal &kv)
+AppConfig::AppConfig(const AppConfig &o)
+{
+	*this = o;
+}
+
+
+AppConfig &AppConfig::operator=(const AppConfig &o)
+{
+	m_RecordFile = o.m_RecordFile;
+	m_HistoryFormat = o.m_HistoryFormat;
+	m_IntervalThr = o.m_IntervalThr;
+	m_Window = o.m_Window;
+	m_Threads = o.m_Threads;
+	m_ArgvCache = o.m_ArgvCache;
+	m_Taskstats = o.m_Taskstats;
+	m_SocketFile = o.m_SocketFile;
+	m_SampleInterval = o.m_SampleInterval;
+	m_HistoryDepth = o.m_HistoryDepth;
+	m_QueueSize = o.m_QueueSize;
+	m_QueueFull = o.m_QueueFull;
+	m_ProcEvents = o.m_ProcEvents;
+	m_PromFile = o.m_PromFile;
+	m_PromListen = o.m_PromListen;
+	m_ShmName = o.m_ShmName;
+	m_ProcRoot = o.m_ProcRoot;
+	m_CgroupRoot = o.m_CgroupRoot;
+	m_Snapshot = o.m_Snapshot;
+	m_TrendDir = o.m_TrendDir;
+	m_TrendSize = o.m_TrendSize;
+	m_Procs = o.m_Procs;
+	m_Matcher.Build(m_Procs);
+	return *this;
+}
+
+
+bool AppConfig::Get(unsigned long &res, const KeyVal &kv)
 {
 	size_t pos;
 	res = std::stoul(kv.value, &pos);
 	if(pos == 0)
 	{
-		Log(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
+		LOG(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
 		return false;
 	}
 	return true;
 }
 
 
-bool AppConfig::Get(uint64_t &res, const KeyVal &kv)
+bool AppConfig::Get(unsigned long long &res, const KeyVal &kv)
 {
 	size_t pos;
 	res = std::stoull(kv.value, &pos);
 	if(pos == 0)
 	{
-		Log(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
+		LOG(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
 		return false;
 	}
 	return true;
@@ -175,7 +226,24 @@ bool AppConfig::Get(double &res, const KeyVal &kv)
 	res = std::stod(kv.value, &pos);
 	if(pos == 0)
 	{
-		Log(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
+		LOG(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be a numeric value!\n";
+		return false;
+	}
+	return true;
+}
+
+
+bool AppConfig::Get(bool &res, const KeyVal &kv)
+{
+	String val(kv.value);
+	val.MakeUpper();
+	if(val == "YES" || val == "TRUE" || val == "ON" || val == "1")
+		res = true;
+	else if(val == "NO" || val == "FALSE" || val == "OFF" || val == "0")
+		res = false;
+	else
+	{
+		LOG(ERROR) << "(" << kv.line << "): Value for key '" << kv.key << "' should be 'yes' or 'no'!\n";
 		return false;
 	}
 	return true;
@@ -183,6 +251,27 @@ bool AppConfig::Get(double &res, const KeyVal &kv)
 
 
 bool AppConfig::Parse(const char *path)
+{
+	if(!ParseFile(path))
+		return false;
+	ResolvePaths();
+	return true;
+}
+
+
+void AppConfig::ResolvePaths()
+{
+	Path *paths[] = { &m_RecordFile, &m_SocketFile, &m_ProcRoot, &m_CgroupRoot, &m_TrendDir, &m_PromFile };
+	for(size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+	{
+		// Empty values disable features
+		if(!paths[i]->empty())
+			paths[i]->MakeAbsolute();
+	}
+}
+
+
+bool AppConfig::ParseFile(const char *path)
 {
 	m_Procs.clear();
 	AnyConfig config;
@@ -201,16 +290,145 @@ bool AppConfig::Parse(const char *path)
 				if(key == "HISTORY")
 				{
 					m_RecordFile = sect[i].value.c_str();
-					m_RecordFile.MakeAbsolute();
+				}
+				else if(key == "HISTORY_FORMAT")
+				{
+					String val(sect[i].value);
+					val.MakeUpper();
+					if(val == "BINARY")
+						m_HistoryFormat = hfBinary;
+					else if(val == "JSON")
+						m_HistoryFormat = hfJson;
+					else
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' should be 'binary' or 'json'!\n";
+						return false;
+					}
 				}
 				else if(key == "MAX_INTERVAL")
 				{
 					if(!Get(m_IntervalThr, sect[i]))
 						return false;
 				}
+				else if(key == "WINDOW")
+				{
+					if(!Get(m_Window, sect[i]))
+						return false;
+				}
+				else if(key == "THREADS")
+				{
+					if(!Get(m_Threads, sect[i]))
+						return false;
+				}
+				else if(key == "ARGV_CACHE")
+				{
+					if(!Get(m_ArgvCache, sect[i]))
+						return false;
+				}
+				else if(key == "TASKSTATS")
+				{
+					if(!Get(m_Taskstats, sect[i]))
+						return false;
+				}
+				else if(key == "SOCKET")
+				{
+					m_SocketFile = sect[i].value.c_str();
+				}
+				else if(key == "SAMPLE_INTERVAL")
+				{
+					if(!Get(m_SampleInterval, sect[i]))
+						return false;
+					if(m_SampleInterval == 0)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' cannot be zero!\n";
+						return false;
+					}
+				}
+				else if(key == "PROC_EVENTS")
+				{
+					if(!Get(m_ProcEvents, sect[i]))
+						return false;
+				}
+				else if(key == "PROC_ROOT")
+				{
+					m_ProcRoot = sect[i].value.c_str();
+				}
+				else if(key == "CGROUP_ROOT")
+				{
+					m_CgroupRoot = sect[i].value.c_str();
+				}
+				else if(key == "HISTORY_DEPTH")
+				{
+					if(!Get(m_HistoryDepth, sect[i]))
+						return false;
+				}
+				else if(key == "QUEUE_SIZE")
+				{
+					if(!Get(m_QueueSize, sect[i]))
+						return false;
+					if(m_QueueSize == 0)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' cannot be zero!\n";
+						return false;
+					}
+				}
+				else if(key == "QUEUE_FULL")
+				{
+					String val(sect[i].value);
+					val.MakeUpper();
+					if(val == "DROP")
+						m_QueueFull = qfDrop;
+					else if(val == "BLOCK")
+						m_QueueFull = qfBlock;
+					else
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' should be 'drop' or 'block'!\n";
+						return false;
+					}
+				}
+				else if(key == "CONFIG_SNAPSHOT")
+				{
+					if(!Get(m_Snapshot, sect[i]))
+						return false;
+				}
+				else if(key == "TREND")
+				{
+					m_TrendDir = sect[i].value.c_str();
+				}
+				else if(key == "TREND_SIZE")
+				{
+					if(!Get(m_TrendSize, sect[i]))
+						return false;
+				}
+				else if(key == "PROM_FILE")
+				{
+					m_PromFile = sect[i].value.c_str();
+				}
+				else if(key == "SHM")
+				{
+					m_ShmName = sect[i].value;
+					// Portable names are '/name' without further slashes
+					if(!m_ShmName.empty() && m_ShmName[0] != '/')
+						m_ShmName.insert(0, 1, '/');
+					if(m_ShmName.find('/', 1) != std::string::npos || m_ShmName.size() > NAME_MAX)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' is not a valid shared memory name!\n";
+						return false;
+					}
+				}
+				else if(key == "PROM_LISTEN")
+				{
+					if(!Get(m_PromListen, sect[i]))
+						return false;
+					if(m_PromListen > 65535)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' is not a valid port!\n";
+						return false;
+					}
+				}
 				else
 				{
-					Log(ERROR) << "(" << sect[i].line << "): Invalid configuration key '" << sect[i].key << "' found!\n";
+					LOG(ERROR) << "(" << sect[i].line << "): Invalid configuration key '" << sect[i].key << "' found!\n";
 					return false;
 				}
 			}
@@ -220,6 +438,7 @@ bool AppConfig::Parse(const char *path)
 			ProcessConfig cur_cfg;
 			cur_cfg.m_Name = it->first;
 			const Section &sect = it->second;
+			size_t cgroup_line = 0;
 			for(size_t i = 0; i < sect.size(); ++i)
 			{
 				String key(sect[i].key);
@@ -249,15 +468,82 @@ bool AppConfig::Parse(const char *path)
 					if(!Get(cur_cfg.m_Argv, sect[i]))
 						return false;
 				}
+				else if(key == "CHILDREN")
+				{
+					if(!Get(cur_cfg.m_Children, sect[i]))
+						return false;
+				}
+				else if(key == "INTERVAL")
+				{
+					if(!Get(cur_cfg.m_Interval, sect[i]))
+						return false;
+					// Samples further apart never provide a baseline
+					if(cur_cfg.m_Interval == 0 || cur_cfg.m_Interval > m_IntervalThr)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Value for key '" << sect[i].key << "' should be between 1 and 'max_interval'!\n";
+						return false;
+					}
+				}
+				else if(key == "CGROUP")
+				{
+					// Relative to the cgroup root
+					const char *val = sect[i].value.c_str();
+					while(*val == '/')
+						++val;
+					cur_cfg.m_Cgroup = val;
+					cgroup_line = sect[i].line;
+					if(cur_cfg.m_Cgroup.empty() || cur_cfg.m_Cgroup.find("..") != std::string::npos)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Invalid cgroup '" << sect[i].value << "'!\n";
+						return false;
+					}
+				}
+				else if(key == "MATCH" || key == "REGEX")
+				{
+					// Syntax is checked here to report the line
+					Automaton test;
+					bool ok;
+					if(key == "MATCH")
+					{
+						cur_cfg.m_Match = sect[i].value;
+						ok = test.AddGlob(cur_cfg.m_Match.c_str(), 0, 0);
+					}
+					else
+					{
+						cur_cfg.m_Regex = sect[i].value;
+						ok = test.AddRegex(cur_cfg.m_Regex.c_str(), 0);
+					}
+					if(!ok)
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Invalid pattern '" << sect[i].value << "': " << test.GetError() << "!\n";
+						return false;
+					}
+					if(!cur_cfg.m_Match.empty() && !cur_cfg.m_Regex.empty())
+					{
+						LOG(ERROR) << "(" << sect[i].line << "): Keys 'match' and 'regex' cannot be combined!\n";
+						return false;
+					}
+				}
 				else
 				{
-					Log(ERROR) << "(" << sect[i].line << "): Invalid configuration key '" << sect[i].key << "' found!\n";
+					LOG(ERROR) << "(" << sect[i].line << "): Invalid configuration key '" << sect[i].key << "' found!\n";
 					return false;
 				}
 			}
+			// Processes are not listed for cgroup sections
+			if(!cur_cfg.m_Cgroup.empty() && (cur_cfg.HasPattern() || cur_cfg.m_Children || cur_cfg.m_Argv))
+			{
+				LOG(ERROR) << "(" << cgroup_line << "): Key 'cgroup' cannot be combined with 'argv', 'match', 'regex' or 'children'!\n";
+				return false;
+			}
 			m_Procs.push_back(cur_cfg);
 		}
 	}
+	if(!m_Matcher.Build(m_Procs))
+	{
+		LOG(ERROR) << "Cannot build service patterns: " << m_Matcher.GetError() << "!\n";
+		return false;
+	}
 	return true;
 }
 
@@ -266,6 +552,15 @@ void ProcessConfig::Print(std::ostream &strm) const
 {
 	strm << "Argv: " << m_Argv << std::endl;
 	strm << "Name: " << m_Name << std::endl;
+	if(!m_Match.empty())
+		strm << "Match: " << m_Match << std::endl;
+	if(!m_Regex.empty())
+		strm << "Regex: " << m_Regex << std::endl;
+	strm << "Children: " << (m_Children ? "yes" : "no") << std::endl;
+	if(!m_Cgroup.empty())
+		strm << "Cgroup: " << m_Cgroup << std::endl;
+	if(m_Interval)
+		strm << "Interval: " << m_Interval << std::endl;
 	strm << "CPU: " << m_CPU << std::endl;
 	strm << "Disk Total: " << m_DiskTotal << std::endl;
 	strm << "Disk Read: " << m_DiskRead << std::endl;
@@ -283,30 +578,189 @@ void AppConfig::Print(std::ostream &strm) const
 }
 
 
-size_t AppConfig::MatchName(const StringArray &cmd_line) const
+std::string_view ServiceMatcher::GetBaseName(std::string_view path)
+{
+	// Same as Path::StripToName()
+	if(path.empty() || path.back() == '/')
+		return std::string_view();
+	size_t found = path.rfind('/');
+	if(found != std::string_view::npos)
+		path.remove_prefix(found + 1);
+	return path;
+}
+
+
+bool ServiceMatcher::Build(const std::vector<ProcessConfig> &procs)
+{
+	AddEntries(procs, true);
+	return m_Patterns.IsEmpty() || m_Patterns.Compile();
+}
+
+
+bool ServiceMatcher::Load(const std::vector<ProcessConfig> &procs, BlobReader &rd)
+{
+	AddEntries(procs, false);
+	return m_Patterns.LoadTables(rd);
+}
+
+
+void ServiceMatcher::AddEntries(const std::vector<ProcessConfig> &procs, bool patterns)
+{
+	m_Groups.clear();
+	m_Patterns.Clear();
+	m_ArgCount = 0;
+	for(size_t i = 0; i < procs.size(); ++i)
+	{
+		const ProcessConfig &proc = procs[i];
+		const size_t idx = proc.m_Argv;
+		// Sampled through its cgroup only
+		if(!proc.m_Cgroup.empty())
+			continue;
+		if(!proc.m_Regex.empty())
+		{
+			if(patterns)
+				m_Patterns.AddRegex(proc.m_Regex.c_str(), i);
+			// Needs the whole command line
+			m_ArgCount = SIZE_MAX;
+			continue;
+		}
+		if(m_ArgCount < idx + 1)
+			m_ArgCount = idx + 1;
+		if(!proc.m_Match.empty())
+		{
+			if(patterns)
+				m_Patterns.AddGlob(proc.m_Match.c_str(), idx, i);
+			continue;
+		}
+		std::vector<Group>::iterator g = m_Groups.begin();
+		while(g != m_Groups.end() && g->m_Argv != idx)
+			++g;
+		if(g == m_Groups.end())
+		{
+			g = m_Groups.insert(g, Group());
+			g->m_Argv = idx;
+		}
+		// Does not replace an entry of lower index
+		g->m_Names.emplace(proc.m_Name, i);
+	}
+}
+
+
+size_t ServiceMatcher::Match(const std::string_view *argv, size_t argc) const
 {
+	size_t best = (size_t)-1;
 	// search by exact path first
-	for(size_t i = 0; i < m_Procs.size(); ++i)
+	for(size_t g = 0; g < m_Groups.size(); ++g)
 	{
-		const size_t idx = m_Procs[i].m_Argv;
-		if(idx < cmd_line.size())
+		const Group &grp = m_Groups[g];
+		if(grp.m_Argv < argc)
 		{
-			if(m_Procs[i].m_Name == cmd_line[idx])
-				return i;
+			Names_t::const_iterator it = grp.m_Names.find(argv[grp.m_Argv]);
+			if(it != grp.m_Names.end() && it->second < best)
+				best = it->second;
 		}
 	}
-	for(size_t i = 0; i < m_Procs.size(); ++i)
+	if(best != (size_t)-1)
+		return best;
+	// search by process name
+	for(size_t g = 0; g < m_Groups.size(); ++g)
 	{
-		const size_t idx = m_Procs[i].m_Argv;
-		if(idx < cmd_line.size())
+		const Group &grp = m_Groups[g];
+		if(grp.m_Argv < argc)
 		{
-			// search by process name
-			Path proc_name(cmd_line[idx]);
-			proc_name.StripToName();
-			if(m_Procs[i].m_Name == proc_name)
-				return i;
+			Names_t::const_iterator it = grp.m_Names.find(GetBaseName(argv[grp.m_Argv]));
+			if(it != grp.m_Names.end() && it->second < best)
+				best = it->second;
 		}
 	}
-	return -1;
+	if(best != (size_t)-1 || m_Patterns.IsEmpty())
+		return best;
+	// All patterns in a single pass
+	return m_Patterns.Match(argv, argc);
+}
+
+
+size_t AppConfig::MatchName(const StringArray &cmd_line) const
+{
+	// Only arguments up to the highest configured index are examined
+	const size_t argc = std::min(cmd_line.size(), m_Matcher.GetArgCount());
+	std::string_view stack_views[16];
+	std::vector<std::string_view> heap_views;
+	std::string_view *views = stack_views;
+	if(argc > 16)
+	{
+		heap_views.resize(argc);
+		views = heap_views.data();
+	}
+	for(size_t i = 0; i < argc; ++i)
+		views[i] = cmd_line[i];
+	return m_Matcher.Match(views, argc);
+}
+
+
+uint64_t AppConfig::GetMatchHash() const
+{
+	// FNV-1a over everything that affects matching
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](const void *data, size_t len)
+	{
+		const uint8_t *p = (const uint8_t *)data;
+		for(size_t i = 0; i < len; ++i)
+			hash = (hash ^ p[i]) * 1099511628211ULL;
+	};
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		const ProcessConfig &proc = m_Procs[i];
+		mix(proc.m_Name.c_str(), proc.m_Name.size() + 1);
+		uint64_t argv = proc.m_Argv;
+		mix(&argv, sizeof(argv));
+		mix(proc.m_Match.c_str(), proc.m_Match.size() + 1);
+		mix(proc.m_Regex.c_str(), proc.m_Regex.size() + 1);
+		mix(proc.m_Cgroup.c_str(), proc.m_Cgroup.size() + 1);
+	}
+	return hash;
+}
+
+
+size_t AppConfig::FindService(const char *name) const
+{
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		if(m_Procs[i].m_Name == name)
+			return i;
+	}
+	return (size_t)-1;
+}
+
+
+bool AppConfig::HasChildren() const
+{
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		if(m_Procs[i].m_Children)
+			return true;
+	}
+	return false;
+}
+
+
+bool AppConfig::HasCgroups() const
+{
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		if(!m_Procs[i].m_Cgroup.empty())
+			return true;
+	}
+	return false;
 }
 
+
+bool AppConfig::NeedsScan() const
+{
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		if(m_Procs[i].m_Cgroup.empty())
+			return true;
+	}
+	return false;
+}
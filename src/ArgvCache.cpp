@@ -0,0 +1,157 @@
+#include "StdInc.hpp"
+#include "ArgvCache.hpp"
+#include "File.hpp"
+#include "Log.hpp"
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+/*
+** File layout: CacheHeader followed by m_Count records, each one a
+** CacheEntry followed by m_Size bytes of '\0' terminated arguments.
+*/
+struct CacheHeader
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_Count;
+	uint64_t m_CfgHash;
+};
+
+
+struct CacheEntry
+{
+	int32_t m_Pid;
+	int32_t m_Cfg;
+	uint64_t m_StartTime;
+	uint64_t m_ExecId;
+	uint32_t m_Argc;
+	uint32_t m_Size;
+};
+
+
+static const char kMagic[8] = { 'I', 'S', 'B', 'A', 'R', 'G', 'V', 0 };
+static const uint32_t kVersion = 2;
+
+
+bool ArgvCache::Load(const char *fname, uint64_t cfg_hash, size_t cfg_count)
+{
+	m_Entries.clear();
+	MMapFile file;
+	if(!file.Open(fname))
+		return false;
+	const uint8_t *p = file.GetData();
+	const uint8_t *maxp = p + file.GetSize();
+	const CacheHeader *hdr = (const CacheHeader *)p;
+	if(file.GetSize() < sizeof(CacheHeader)
+		|| memcmp(hdr->m_Magic, kMagic, sizeof(kMagic)) != 0
+		|| hdr->m_Version != kVersion)
+	{
+		LOG(WARN) << "Ignoring invalid argv cache '" << fname << "'\n";
+		return false;
+	}
+	// Configuration changed; all results are stale
+	if(hdr->m_CfgHash != cfg_hash)
+		return false;
+	m_Entries.reserve(hdr->m_Count);
+	p += sizeof(CacheHeader);
+	for(uint32_t i = 0; i < hdr->m_Count; ++i)
+	{
+		CacheEntry ce;
+		if((size_t)(maxp - p) < sizeof(ce))
+			break;
+		memcpy(&ce, p, sizeof(ce));
+		p += sizeof(ce);
+		if((size_t)(maxp - p) < ce.m_Size)
+			break;
+		// Indexes the per configuration tables; a bad file cannot be trusted
+		if(ce.m_Cfg >= 0 && (size_t)ce.m_Cfg >= cfg_count)
+		{
+			LOG(WARN) << "Ignoring invalid argv cache '" << fname << "'\n";
+			m_Entries.clear();
+			return false;
+		}
+		Entry &e = m_Entries[ce.m_Pid];
+		e.m_StartTime = ce.m_StartTime;
+		e.m_ExecId = ce.m_ExecId;
+		e.m_Cfg = ce.m_Cfg < 0 ? (size_t)-1 : ce.m_Cfg;
+		const char *arg = (const char *)p;
+		const char *end = arg + ce.m_Size;
+		for(uint32_t a = 0; a < ce.m_Argc && arg < end; ++a)
+		{
+			const char *eos = (const char *)memchr(arg, 0, end - arg);
+			if(eos == NULL)
+				eos = end;
+			e.m_Argv.push_back(String(arg, eos - arg));
+			arg = eos + 1;
+		}
+		p += ce.m_Size;
+	}
+	return true;
+}
+
+
+bool ArgvCache::Save(const char *fname, uint64_t cfg_hash) const
+{
+	std::string buf;
+	CacheHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.m_Magic, kMagic, sizeof(kMagic));
+	hdr.m_Version = kVersion;
+	hdr.m_Count = m_Entries.size();
+	hdr.m_CfgHash = cfg_hash;
+	buf.append((const char *)&hdr, sizeof(hdr));
+	for(Entries_t::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it)
+	{
+		const Entry &e = it->second;
+		CacheEntry ce;
+		memset(&ce, 0, sizeof(ce));
+		ce.m_Pid = it->first;
+		ce.m_Cfg = e.m_Cfg == (size_t)-1 ? -1 : (int32_t)e.m_Cfg;
+		ce.m_StartTime = e.m_StartTime;
+		ce.m_ExecId = e.m_ExecId;
+		ce.m_Argc = e.m_Argv.size();
+		for(size_t a = 0; a < e.m_Argv.size(); ++a)
+			ce.m_Size += e.m_Argv[a].size() + 1;
+		buf.append((const char *)&ce, sizeof(ce));
+		for(size_t a = 0; a < e.m_Argv.size(); ++a)
+			buf.append(e.m_Argv[a].c_str(), e.m_Argv[a].size() + 1);
+	}
+	// Replace atomically, as for the history
+	std::string tmp(fname);
+	tmp += ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if(fp == NULL)
+	{
+		LOG(WARN) << "Cannot create argv cache '" << tmp << "'!\n";
+		return false;
+	}
+	bool ok = fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+	ok = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname) != 0)
+	{
+		LOG(WARN) << "Failed to write argv cache '" << fname << "'!\n";
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+const ArgvCache::Entry *ArgvCache::Find(pid_t pid, uint64_t start_time, uint64_t exec_id) const
+{
+	Entries_t::const_iterator it = m_Entries.find(pid);
+	if(it == m_Entries.end()
+		|| it->second.m_StartTime != start_time
+		|| it->second.m_ExecId != exec_id)
+		return NULL;
+	return &it->second;
+}
+
+
+}	// PidSample
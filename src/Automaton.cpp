@@ -0,0 +1,616 @@
+#include "StdInc.hpp"
+#include "Automaton.hpp"
+
+
+namespace grumat
+{
+
+
+void Automaton::Clear()
+{
+	m_Nodes.clear();
+	m_Starts.clear();
+	memset(m_Classes, 0, sizeof(m_Classes));
+	m_ClassCount = 1;
+	m_Start = 0;
+	// Dead state only
+	m_Trans.assign(1, 0);
+	m_Accept.assign(1, (size_t)-1);
+	m_Error = NULL;
+}
+
+
+int Automaton::AddNode(Node::Type_e type)
+{
+	Node n;
+	n.m_Type = type;
+	n.m_Out = -1;
+	n.m_Out1 = -1;
+	n.m_Id = (size_t)-1;
+	m_Nodes.push_back(n);
+	return (int)m_Nodes.size() - 1;
+}
+
+
+void Automaton::Patch(const Holes_t &holes, int target)
+{
+	for(Holes_t::const_iterator it = holes.begin(); it != holes.end(); ++it)
+	{
+		Node &n = m_Nodes[it->first];
+		if(it->second)
+			n.m_Out1 = target;
+		else
+			n.m_Out = target;
+	}
+}
+
+
+Automaton::Frag Automaton::MakeSet(const Set_t &set)
+{
+	Frag f;
+	f.m_Start = AddNode(Node::ntSet);
+	m_Nodes[f.m_Start].m_Set = set;
+	f.m_Holes.emplace_back(f.m_Start, 0);
+	return f;
+}
+
+
+Automaton::Frag Automaton::MakeEmpty()
+{
+	Frag f;
+	f.m_Start = AddNode(Node::ntSplit);
+	f.m_Holes.emplace_back(f.m_Start, 0);
+	return f;
+}
+
+
+Automaton::Frag Automaton::Concat(const Frag &a, const Frag &b)
+{
+	Patch(a.m_Holes, b.m_Start);
+	Frag f;
+	f.m_Start = a.m_Start;
+	f.m_Holes = b.m_Holes;
+	return f;
+}
+
+
+Automaton::Frag Automaton::Alternate(const Frag &a, const Frag &b)
+{
+	Frag f;
+	f.m_Start = AddNode(Node::ntSplit);
+	m_Nodes[f.m_Start].m_Out = a.m_Start;
+	m_Nodes[f.m_Start].m_Out1 = b.m_Start;
+	f.m_Holes = a.m_Holes;
+	f.m_Holes.insert(f.m_Holes.end(), b.m_Holes.begin(), b.m_Holes.end());
+	return f;
+}
+
+
+Automaton::Frag Automaton::Repeat(const Frag &a, char op)
+{
+	int split = AddNode(Node::ntSplit);
+	m_Nodes[split].m_Out = a.m_Start;
+	Frag f;
+	f.m_Holes.emplace_back(split, 1);
+	switch(op)
+	{
+	case '*':
+		Patch(a.m_Holes, split);
+		f.m_Start = split;
+		break;
+	case '+':
+		Patch(a.m_Holes, split);
+		f.m_Start = a.m_Start;
+		break;
+	default:	// '?'
+		f.m_Start = split;
+		f.m_Holes.insert(f.m_Holes.end(), a.m_Holes.begin(), a.m_Holes.end());
+		break;
+	}
+	return f;
+}
+
+
+void Automaton::AddPattern(const Frag &f, size_t id)
+{
+	int acc = AddNode(Node::ntAccept);
+	m_Nodes[acc].m_Id = id;
+	Patch(f.m_Holes, acc);
+	m_Starts.push_back(f.m_Start);
+}
+
+
+void Automaton::FixSet(const Parser &p, Set_t &set) const
+{
+	// Arguments are joined by spaces for a regex, but globs never cross them
+	if(p.m_Regex)
+		set[0] = set[' '];
+	else
+		set.reset(0);
+	set.reset(kEot);
+}
+
+
+bool Automaton::ParseEscape(Parser &p, Set_t &set)
+{
+	if(p.m_Pos >= p.m_Text.size())
+	{
+		m_Error = "trailing '\\'";
+		return false;
+	}
+	const char ch = p.m_Text[p.m_Pos++];
+	if(p.m_Regex)
+	{
+		switch(ch)
+		{
+		case 'd':
+			for(int c = '0'; c <= '9'; ++c)
+				set.set(c);
+			return true;
+		case 'w':
+			for(int c = 0; c < 256; ++c)
+			{
+				if(isalnum(c) || c == '_')
+					set.set(c);
+			}
+			return true;
+		case 's':
+			set.set(' ');
+			set.set('\t');
+			set.set('\n');
+			set.set('\r');
+			set.set('\f');
+			set.set('\v');
+			return true;
+		}
+	}
+	set.set((uint8_t)ch);
+	return true;
+}
+
+
+bool Automaton::ParseClass(Parser &p, Set_t &set)
+{
+	const std::string_view &t = p.m_Text;
+	bool negate = false;
+	if(p.m_Pos < t.size()
+		&& (t[p.m_Pos] == '^' || (!p.m_Regex && t[p.m_Pos] == '!')))
+	{
+		negate = true;
+		++p.m_Pos;
+	}
+	// A leading ']' is a literal
+	for(bool first = true; ; first = false)
+	{
+		if(p.m_Pos >= t.size())
+		{
+			m_Error = "missing ']'";
+			return false;
+		}
+		const char ch = t[p.m_Pos++];
+		if(ch == ']' && !first)
+			break;
+		if(ch == '\\')
+		{
+			if(!ParseEscape(p, set))
+				return false;
+			continue;
+		}
+		uint8_t lo = ch;
+		uint8_t hi = ch;
+		if(p.m_Pos + 1 < t.size() && t[p.m_Pos] == '-' && t[p.m_Pos + 1] != ']')
+		{
+			hi = t[p.m_Pos + 1];
+			p.m_Pos += 2;
+			if(hi < lo)
+			{
+				m_Error = "invalid range in '[...]'";
+				return false;
+			}
+		}
+		for(unsigned c = lo; c <= hi; ++c)
+			set.set(c);
+	}
+	if(negate)
+		set.flip();
+	return true;
+}
+
+
+bool Automaton::ParseAtom(Parser &p, Frag &res)
+{
+	const std::string_view &t = p.m_Text;
+	const char ch = t[p.m_Pos++];
+	Set_t set;
+	switch(ch)
+	{
+	case '(':
+		if(!ParseAlt(p, res))
+			return false;
+		if(p.m_Pos >= t.size() || t[p.m_Pos] != ')')
+		{
+			m_Error = "missing ')'";
+			return false;
+		}
+		++p.m_Pos;
+		return true;
+	case '*':
+	case '+':
+	case '?':
+		m_Error = "nothing to repeat";
+		return false;
+	case '{':
+		m_Error = "bounded repetition is not supported";
+		return false;
+	case '^':
+	case '$':
+		m_Error = "anchors are only supported at the ends";
+		return false;
+	case '.':
+		set.set();
+		break;
+	case '[':
+		if(!ParseClass(p, set))
+			return false;
+		break;
+	case '\\':
+		if(!ParseEscape(p, set))
+			return false;
+		break;
+	default:
+		set.set((uint8_t)ch);
+		break;
+	}
+	FixSet(p, set);
+	res = MakeSet(set);
+	return true;
+}
+
+
+bool Automaton::ParseConcat(Parser &p, Frag &res)
+{
+	const std::string_view &t = p.m_Text;
+	res = MakeEmpty();
+	while(p.m_Pos < t.size() && t[p.m_Pos] != '|' && t[p.m_Pos] != ')')
+	{
+		Frag atom;
+		if(!ParseAtom(p, atom))
+			return false;
+		while(p.m_Pos < t.size()
+			&& (t[p.m_Pos] == '*' || t[p.m_Pos] == '+' || t[p.m_Pos] == '?'))
+		{
+			atom = Repeat(atom, t[p.m_Pos++]);
+		}
+		res = Concat(res, atom);
+	}
+	return true;
+}
+
+
+bool Automaton::ParseAlt(Parser &p, Frag &res)
+{
+	if(!ParseConcat(p, res))
+		return false;
+	while(p.m_Pos < p.m_Text.size() && p.m_Text[p.m_Pos] == '|')
+	{
+		++p.m_Pos;
+		Frag rhs;
+		if(!ParseConcat(p, rhs))
+			return false;
+		res = Alternate(res, rhs);
+	}
+	return true;
+}
+
+
+bool Automaton::ParseGlob(Parser &p, Frag &res)
+{
+	const std::string_view &t = p.m_Text;
+	Set_t wild;
+	wild.set();
+	if(p.m_BaseName)
+		wild.reset('/');
+	FixSet(p, wild);
+	res = MakeEmpty();
+	while(p.m_Pos < t.size())
+	{
+		const char ch = t[p.m_Pos++];
+		Set_t set;
+		switch(ch)
+		{
+		case '*':
+			res = Concat(res, Repeat(MakeSet(wild), '*'));
+			continue;
+		case '?':
+			set = wild;
+			break;
+		case '[':
+			if(!ParseClass(p, set))
+				return false;
+			break;
+		case '\\':
+			if(!ParseEscape(p, set))
+				return false;
+			break;
+		default:
+			set.set((uint8_t)ch);
+			break;
+		}
+		FixSet(p, set);
+		res = Concat(res, MakeSet(set));
+	}
+	return true;
+}
+
+
+bool Automaton::AddGlob(std::string_view glob, size_t argv, size_t id)
+{
+	Parser p;
+	p.m_Text = glob;
+	p.m_Pos = 0;
+	p.m_Regex = false;
+	p.m_BaseName = (glob.find('/') == std::string_view::npos);
+	const size_t mark = m_Nodes.size();
+	Frag body;
+	if(!ParseGlob(p, body))
+	{
+		m_Nodes.resize(mark);
+		return false;
+	}
+	Set_t arg_char;
+	arg_char.set();
+	arg_char.reset(0);
+	arg_char.reset(kEot);
+	Set_t sep;
+	sep.set(0);
+	// Skip the preceding arguments
+	Frag f = MakeEmpty();
+	for(size_t i = 0; i < argv; ++i)
+		f = Concat(f, Concat(Repeat(MakeSet(arg_char), '*'), MakeSet(sep)));
+	// Skip the directory part
+	if(p.m_BaseName)
+	{
+		Set_t slash;
+		slash.set('/');
+		f = Concat(f, Repeat(Concat(Repeat(MakeSet(arg_char), '*'), MakeSet(slash)), '?'));
+	}
+	// The whole argument must match
+	Set_t end = sep;
+	end.set(kEot);
+	f = Concat(f, Concat(body, MakeSet(end)));
+	AddPattern(f, id);
+	return true;
+}
+
+
+bool Automaton::AddRegex(std::string_view re, size_t id)
+{
+	Parser p;
+	p.m_Text = re;
+	p.m_Pos = 0;
+	p.m_Regex = true;
+	p.m_BaseName = false;
+	const bool anchor_start = (!re.empty() && re[0] == '^');
+	if(anchor_start)
+		p.m_Text.remove_prefix(1);
+	// A trailing '$' is an anchor unless escaped
+	bool anchor_end = false;
+	if(!p.m_Text.empty() && p.m_Text.back() == '$')
+	{
+		size_t escapes = 0;
+		for(size_t i = p.m_Text.size() - 1; i > 0 && p.m_Text[i - 1] == '\\'; --i)
+			++escapes;
+		if((escapes & 1) == 0)
+		{
+			anchor_end = true;
+			p.m_Text.remove_suffix(1);
+		}
+	}
+	const size_t mark = m_Nodes.size();
+	Frag body;
+	bool ok = ParseAlt(p, body);
+	if(ok && p.m_Pos != p.m_Text.size())
+	{
+		m_Error = "unmatched ')'";
+		ok = false;
+	}
+	if(!ok)
+	{
+		m_Nodes.resize(mark);
+		return false;
+	}
+	Set_t all;
+	all.set();
+	all.reset(kEot);
+	Frag f = anchor_start ? MakeEmpty() : Repeat(MakeSet(all), '*');
+	f = Concat(f, body);
+	if(anchor_end)
+	{
+		Set_t eot;
+		eot.set(kEot);
+		f = Concat(f, MakeSet(eot));
+	}
+	AddPattern(f, id);
+	return true;
+}
+
+
+void Automaton::Closure(std::vector<int> &states, std::vector<int> &stack, std::vector<size_t> &marks, size_t stamp) const
+{
+	stack.assign(states.begin(), states.end());
+	states.clear();
+	while(!stack.empty())
+	{
+		const int n = stack.back();
+		stack.pop_back();
+		if(n < 0 || marks[n] == stamp)
+			continue;
+		marks[n] = stamp;
+		const Node &node = m_Nodes[n];
+		if(node.m_Type == Node::ntSplit)
+		{
+			stack.push_back(node.m_Out);
+			stack.push_back(node.m_Out1);
+		}
+		else
+			states.push_back(n);
+	}
+	std::sort(states.begin(), states.end());
+}
+
+
+bool Automaton::Compile()
+{
+	// Symbols accepted by exactly the same nodes share a class
+	std::map<std::vector<bool>, uint16_t> sigs;
+	std::vector<int> reps;
+	for(int c = 0; c < kSymbols; ++c)
+	{
+		std::vector<bool> sig;
+		for(size_t n = 0; n < m_Nodes.size(); ++n)
+		{
+			if(m_Nodes[n].m_Type == Node::ntSet)
+				sig.push_back(m_Nodes[n].m_Set[c]);
+		}
+		std::pair<std::map<std::vector<bool>, uint16_t>::iterator, bool> ins = sigs.emplace(sig, (uint16_t)reps.size());
+		if(ins.second)
+			reps.push_back(c);
+		m_Classes[c] = ins.first->second;
+	}
+	m_ClassCount = reps.size();
+	// Subset construction
+	std::map<std::vector<int>, uint32_t> ids;
+	std::vector<std::vector<int> > states;
+	std::vector<int> stack;
+	std::vector<size_t> marks(m_Nodes.size(), 0);
+	size_t stamp = 0;
+	states.push_back(std::vector<int>());
+	ids.emplace(states.back(), 0);
+	std::vector<int> cur(m_Starts);
+	Closure(cur, stack, marks, ++stamp);
+	m_Start = ids.emplace(cur, (uint32_t)states.size()).first->second;
+	if(m_Start != 0)
+		states.push_back(cur);
+	m_Trans.clear();
+	m_Accept.clear();
+	for(size_t s = 0; s < states.size(); ++s)
+	{
+		cur = states[s];
+		size_t acc = (size_t)-1;
+		for(size_t i = 0; i < cur.size(); ++i)
+		{
+			const Node &node = m_Nodes[cur[i]];
+			if(node.m_Type == Node::ntAccept && node.m_Id < acc)
+				acc = node.m_Id;
+		}
+		m_Accept.push_back(acc);
+		for(size_t c = 0; c < m_ClassCount; ++c)
+		{
+			std::vector<int> next;
+			for(size_t i = 0; i < cur.size(); ++i)
+			{
+				const Node &node = m_Nodes[cur[i]];
+				if(node.m_Type == Node::ntSet && node.m_Set[reps[c]])
+					next.push_back(node.m_Out);
+			}
+			Closure(next, stack, marks, ++stamp);
+			std::pair<std::map<std::vector<int>, uint32_t>::iterator, bool> ins = ids.emplace(next, (uint32_t)states.size());
+			if(ins.second)
+			{
+				if(states.size() >= kMaxStates)
+				{
+					m_Error = "patterns are too complex";
+					m_Start = 0;
+					return false;
+				}
+				states.push_back(next);
+			}
+			m_Trans.push_back(ins.first->second);
+		}
+	}
+	return true;
+}
+
+
+size_t Automaton::Match(const std::string_view *argv, size_t argc) const
+{
+	if(m_Start == 0)
+		return (size_t)-1;
+	const uint32_t *trans = m_Trans.data();
+	const size_t *accept = m_Accept.data();
+	const size_t ncls = m_ClassCount;
+	uint32_t s = m_Start;
+	size_t best = accept[s];
+	// Single pass; acceptance is sticky so the scan stops at the dead state
+	for(size_t i = 0; i == 0 || i < argc; ++i)
+	{
+		if(i < argc)
+		{
+			const uint8_t *p = (const uint8_t *)argv[i].data();
+			const uint8_t *end = p + argv[i].size();
+			for(; p != end; ++p)
+			{
+				s = trans[s * ncls + m_Classes[*p]];
+				if(accept[s] < best)
+					best = accept[s];
+				if(s == 0)
+					return best;
+			}
+		}
+		s = trans[s * ncls + m_Classes[i + 1 < argc ? 0 : kEot]];
+		if(accept[s] < best)
+			best = accept[s];
+		if(s == 0)
+			return best;
+	}
+	return best;
+}
+
+
+void Automaton::SaveTables(BlobWriter &wr) const
+{
+	wr.Put((uint32_t)m_ClassCount);
+	wr.Put((uint32_t)m_Accept.size());
+	wr.Put(m_Start);
+	wr.Put(m_Classes, sizeof(m_Classes));
+	wr.Put(m_Trans.data(), m_Trans.size() * sizeof(uint32_t));
+	for(size_t i = 0; i < m_Accept.size(); ++i)
+		wr.Put((uint64_t)m_Accept[i]);
+}
+
+
+bool Automaton::LoadTables(BlobReader &rd)
+{
+	Clear();
+	uint32_t classes, states;
+	if(!rd.Get(classes) || !rd.Get(states) || !rd.Get(m_Start)
+		|| classes == 0 || classes > kSymbols || states == 0 || states > kMaxStates + 1
+		|| m_Start >= states
+		|| !rd.Get(m_Classes, sizeof(m_Classes)))
+	{
+		Clear();
+		return false;
+	}
+	m_ClassCount = classes;
+	m_Trans.resize((size_t)states * classes);
+	m_Accept.resize(states);
+	bool ok = rd.Get(m_Trans.data(), m_Trans.size() * sizeof(uint32_t));
+	for(size_t i = 0; ok && i < states; ++i)
+	{
+		uint64_t acc = 0;
+		ok = rd.Get(acc);
+		m_Accept[i] = (size_t)acc;
+	}
+	// Out of range values would index outside the tables
+	for(size_t c = 0; ok && c < kSymbols; ++c)
+		ok = m_Classes[c] < classes;
+	for(size_t i = 0; ok && i < m_Trans.size(); ++i)
+		ok = m_Trans[i] < states;
+	if(!ok)
+		Clear();
+	return ok;
+}
+
+
+}	// namespace grumat
+
@@ -0,0 +1,293 @@
+#include "StdInc.hpp"
+#include "AppConfig.hpp"
+#include "File.hpp"
+#include "Log.hpp"
+#include <sys/stat.h>
+
+
+using namespace grumat;
+
+
+/*
+** File layout: SnapshotHeader followed by m_DataSize bytes written by a
+** BlobWriter: the global keys, the sections and the compiled patterns.
+** Bump kVersion whenever a configuration key is added.
+*/
+struct SnapshotHeader
+{
+	char m_Magic[8];
+	uint32_t m_Version;
+	uint32_t m_HeaderSize;
+	// Identity of the configuration file when the snapshot was taken
+	uint64_t m_MTime;
+	uint64_t m_Size;
+	uint64_t m_Inode;
+	uint64_t m_PathHash;
+	// FNV-1a of the data, against partial or damaged files
+	uint64_t m_DataHash;
+	uint64_t m_DataSize;
+};
+
+
+static const char kMagic[8] = { 'I', 'S', 'B', 'S', 'N', 'A', 'P', 0 };
+static const uint32_t kVersion = 9;
+
+
+static uint64_t Fnv1a(const void *data, size_t len)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	const uint8_t *p = (const uint8_t *)data;
+	for(size_t i = 0; i < len; ++i)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	return hash;
+}
+
+
+// Fills the identity fields for 'path'; false if it cannot be read
+static bool StatConfig(SnapshotHeader &hdr, const char *path)
+{
+	struct stat st;
+	if(stat(path, &st) != 0)
+		return false;
+#if defined(__APPLE__)
+	hdr.m_MTime = (uint64_t)st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+#else
+	hdr.m_MTime = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+	hdr.m_Size = st.st_size;
+	hdr.m_Inode = st.st_ino;
+	hdr.m_PathHash = Fnv1a(path, strlen(path));
+	return true;
+}
+
+
+bool AppConfig::Load(const char *path)
+{
+	const std::string fname = std::string(path) + ".snap";
+	if(LoadSnapshot(fname.c_str(), path))
+	{
+		LOG(DEBUG) << "Configuration loaded from snapshot '" << fname << "'\n";
+		ResolvePaths();
+		return true;
+	}
+	SnapshotHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	// Stored as identity of the new snapshot, so an edit during the parse
+	// makes it stale
+	const bool known = StatConfig(hdr, path);
+	if(!ParseFile(path))
+		return false;
+	// Paths are stored as configured, so another directory, user or
+	// environment resolves them as a fresh parse would
+	if(!m_Snapshot)
+		unlink(fname.c_str());
+	else if(known)
+		SaveSnapshot(fname.c_str(), hdr);
+	ResolvePaths();
+	return true;
+}
+
+
+bool AppConfig::LoadSnapshot(const char *fname, const char *path)
+{
+	MMapFile file;
+	if(!file.Open(fname))
+		return false;
+	const SnapshotHeader *hdr = (const SnapshotHeader *)file.GetData();
+	SnapshotHeader cur;
+	if(file.GetSize() < sizeof(SnapshotHeader)
+		|| memcmp(hdr->m_Magic, kMagic, sizeof(kMagic)) != 0
+		|| hdr->m_Version != kVersion
+		|| hdr->m_HeaderSize != sizeof(SnapshotHeader)
+		|| hdr->m_DataSize != file.GetSize() - sizeof(SnapshotHeader))
+	{
+		LOG(WARN) << "Ignoring invalid configuration snapshot '" << fname << "'\n";
+		return false;
+	}
+	// Configuration was edited or replaced
+	if(!StatConfig(cur, path)
+		|| cur.m_MTime != hdr->m_MTime
+		|| cur.m_Size != hdr->m_Size
+		|| cur.m_Inode != hdr->m_Inode
+		|| cur.m_PathHash != hdr->m_PathHash)
+		return false;
+	const uint8_t *data = file.GetData() + sizeof(SnapshotHeader);
+	if(Fnv1a(data, hdr->m_DataSize) != hdr->m_DataHash)
+	{
+		LOG(WARN) << "Ignoring damaged configuration snapshot '" << fname << "'\n";
+		return false;
+	}
+
+	BlobReader rd(data, hdr->m_DataSize);
+	AppConfig cfg;
+	uint32_t fmt = 0;
+	uint64_t interval = 0, window = 0, threads = 0, sample = 0, depth = 0, queue = 0, prom = 0, trend_size = 0;
+	uint32_t queue_full = 0;
+	uint8_t argv_cache = 0, taskstats = 0, proc_events = 0;
+	uint32_t count = 0;
+	rd.GetString(cfg.m_RecordFile);
+	rd.Get(fmt);
+	rd.Get(interval);
+	rd.Get(window);
+	rd.Get(threads);
+	rd.Get(argv_cache);
+	rd.Get(taskstats);
+	rd.GetString(cfg.m_SocketFile);
+	rd.Get(sample);
+	rd.Get(depth);
+	rd.Get(queue);
+	rd.Get(queue_full);
+	rd.Get(proc_events);
+	rd.GetString(cfg.m_PromFile);
+	rd.Get(prom);
+	rd.GetString(cfg.m_ShmName);
+	rd.GetString(cfg.m_ProcRoot);
+	rd.GetString(cfg.m_CgroupRoot);
+	rd.GetString(cfg.m_TrendDir);
+	rd.Get(trend_size);
+	rd.Get(count);
+	cfg.m_HistoryFormat = fmt == hfJson ? hfJson : hfBinary;
+	cfg.m_IntervalThr = interval;
+	cfg.m_Window = window;
+	cfg.m_Threads = threads;
+	cfg.m_ArgvCache = argv_cache != 0;
+	cfg.m_Taskstats = taskstats != 0;
+	cfg.m_SampleInterval = sample;
+	cfg.m_HistoryDepth = depth;
+	cfg.m_QueueSize = queue;
+	cfg.m_QueueFull = queue_full == qfBlock ? qfBlock : qfDrop;
+	cfg.m_ProcEvents = proc_events != 0;
+	cfg.m_PromListen = prom;
+	cfg.m_TrendSize = trend_size;
+	for(uint32_t i = 0; i < count && rd.IsValid(); ++i)
+	{
+		ProcessConfig proc;
+		uint64_t argv = 0;
+		uint8_t children = 0;
+		uint64_t period = 0;
+		rd.GetString(proc.m_Name);
+		rd.Get(proc.m_CPU);
+		rd.Get(proc.m_DiskTotal);
+		rd.Get(proc.m_DiskRead);
+		rd.Get(proc.m_DiskWrite);
+		rd.Get(argv);
+		rd.GetString(proc.m_Match);
+		rd.GetString(proc.m_Regex);
+		rd.Get(children);
+		rd.GetString(proc.m_Cgroup);
+		rd.Get(period);
+		proc.m_Argv = argv;
+		proc.m_Interval = period;
+		proc.m_Children = children != 0;
+		cfg.m_Procs.push_back(proc);
+	}
+	if(!rd.IsValid())
+	{
+		LOG(WARN) << "Ignoring invalid configuration snapshot '" << fname << "'\n";
+		return false;
+	}
+	// Tables refer to the names of m_Procs; load them in place
+	m_RecordFile = cfg.m_RecordFile;
+	m_HistoryFormat = cfg.m_HistoryFormat;
+	m_IntervalThr = cfg.m_IntervalThr;
+	m_Window = cfg.m_Window;
+	m_Threads = cfg.m_Threads;
+	m_ArgvCache = cfg.m_ArgvCache;
+	m_Taskstats = cfg.m_Taskstats;
+	m_SocketFile = cfg.m_SocketFile;
+	m_SampleInterval = cfg.m_SampleInterval;
+	m_HistoryDepth = cfg.m_HistoryDepth;
+	m_QueueSize = cfg.m_QueueSize;
+	m_QueueFull = cfg.m_QueueFull;
+	m_ProcEvents = cfg.m_ProcEvents;
+	m_PromFile = cfg.m_PromFile;
+	m_PromListen = cfg.m_PromListen;
+	m_ShmName = cfg.m_ShmName;
+	m_ProcRoot = cfg.m_ProcRoot;
+	m_CgroupRoot = cfg.m_CgroupRoot;
+	m_Snapshot = true;
+	m_TrendDir = cfg.m_TrendDir;
+	m_TrendSize = cfg.m_TrendSize;
+	m_Procs.swap(cfg.m_Procs);
+	if(!m_Matcher.Load(m_Procs, rd))
+	{
+		LOG(WARN) << "Ignoring invalid configuration snapshot '" << fname << "'\n";
+		m_Procs.clear();
+		m_Matcher.Build(m_Procs);
+		return false;
+	}
+	return true;
+}
+
+
+bool AppConfig::SaveSnapshot(const char *fname, const SnapshotHeader &id) const
+{
+	SnapshotHeader hdr = id;
+	memcpy(hdr.m_Magic, kMagic, sizeof(kMagic));
+	hdr.m_Version = kVersion;
+	hdr.m_HeaderSize = sizeof(hdr);
+
+	std::string data;
+	BlobWriter wr(data);
+	wr.PutString(m_RecordFile);
+	wr.Put((uint32_t)m_HistoryFormat);
+	wr.Put((uint64_t)m_IntervalThr);
+	wr.Put((uint64_t)m_Window);
+	wr.Put((uint64_t)m_Threads);
+	wr.Put((uint8_t)m_ArgvCache);
+	wr.Put((uint8_t)m_Taskstats);
+	wr.PutString(m_SocketFile);
+	wr.Put((uint64_t)m_SampleInterval);
+	wr.Put((uint64_t)m_HistoryDepth);
+	wr.Put((uint64_t)m_QueueSize);
+	wr.Put((uint32_t)m_QueueFull);
+	wr.Put((uint8_t)m_ProcEvents);
+	wr.PutString(m_PromFile);
+	wr.Put((uint64_t)m_PromListen);
+	wr.PutString(m_ShmName);
+	wr.PutString(m_ProcRoot);
+	wr.PutString(m_CgroupRoot);
+	wr.PutString(m_TrendDir);
+	wr.Put((uint64_t)m_TrendSize);
+	wr.Put((uint32_t)m_Procs.size());
+	for(size_t i = 0; i < m_Procs.size(); ++i)
+	{
+		const ProcessConfig &proc = m_Procs[i];
+		wr.PutString(proc.m_Name);
+		wr.Put(proc.m_CPU);
+		wr.Put(proc.m_DiskTotal);
+		wr.Put(proc.m_DiskRead);
+		wr.Put(proc.m_DiskWrite);
+		wr.Put((uint64_t)proc.m_Argv);
+		wr.PutString(proc.m_Match);
+		wr.PutString(proc.m_Regex);
+		wr.Put((uint8_t)proc.m_Children);
+		wr.PutString(proc.m_Cgroup);
+		wr.Put((uint64_t)proc.m_Interval);
+	}
+	m_Matcher.SaveTables(wr);
+	hdr.m_DataSize = data.size();
+	hdr.m_DataHash = Fnv1a(data.data(), data.size());
+
+	// Concurrent checks may be loading it; replace atomically
+	std::string tmp(fname);
+	tmp += ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if(fp == NULL)
+	{
+		// Read-only configuration directory; parsing keeps working
+		LOG(DEBUG) << "Cannot create configuration snapshot '" << tmp << "'\n";
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(data.data(), 1, data.size(), fp) == data.size();
+	ok = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname) != 0)
+	{
+		LOG(WARN) << "Failed to write configuration snapshot '" << fname << "'!\n";
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
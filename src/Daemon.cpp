@@ -0,0 +1,569 @@
+#include "StdInc.hpp"
+#include "Daemon.hpp"
+#include "Profiler.hpp"
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <thread>
+#include <numeric>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+static volatile sig_atomic_t s_Stop = 0;
+
+
+static void OnStopSignal(int)
+{
+	s_Stop = 1;
+}
+
+
+static bool MakeSocketAddress(struct sockaddr_un &addr, const Path &path)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(path.length() >= sizeof(addr.sun_path))
+	{
+		LOG(ERROR) << "Socket path '" << path << "' is too long!\n";
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+	return true;
+}
+
+
+void ServiceHistory::SetCapacity(size_t n)
+{
+	m_Ring.clear();
+	m_Ring.resize(n);
+	m_Head = 0;
+	m_Count = 0;
+}
+
+
+ServiceHistory::Entry &ServiceHistory::Push(uint64_t clock)
+{
+	Entry &e = m_Ring[m_Head];
+	e.m_Clock = clock;
+	e.m_Samples.clear();
+	m_Head = (m_Head + 1) % m_Ring.size();
+	if(m_Count < m_Ring.size())
+		++m_Count;
+	return e;
+}
+
+
+const ServiceHistory::Entry &ServiceHistory::At(size_t age) const
+{
+	return m_Ring[(m_Head + m_Ring.size() - 1 - age) % m_Ring.size()];
+}
+
+
+const ServiceHistory::Entry *ServiceHistory::GetLatest() const
+{
+	return m_Count ? &At(0) : NULL;
+}
+
+
+const ServiceHistory::Entry *ServiceHistory::GetBaseline(uint64_t min_ns, uint64_t max_secs) const
+{
+	if(m_Count == 0)
+		return NULL;
+	const uint64_t clock = At(0).m_Clock;
+	for(size_t age = 1; age < m_Count; ++age)
+	{
+		const Entry &e = At(age);
+		if(clock - e.m_Clock < min_ns)
+			continue;
+		// Same limit as a one-shot check; e.g. after a suspend
+		if((clock - e.m_Clock) / 1000000000ULL > max_secs)
+			break;
+		return &e;
+	}
+	return NULL;
+}
+
+
+Daemon::Daemon(const AppConfig &config)
+	: m_Config(config)
+	, m_Listen(-1)
+	, m_Tick(0)
+	, m_Dropped(0)
+	, m_Queue(config.m_QueueSize)
+	, m_Stop(false)
+	, m_Exporter(config)
+	, m_Shm(config)
+	, m_Trend(config)
+	, m_State(ACTIVE_STATE)
+{
+	m_History.resize(m_Config.m_Procs.size());
+	m_Periods.resize(m_Config.m_Procs.size());
+	for(size_t i = 0; i < m_History.size(); ++i)
+	{
+		size_t depth = m_Config.m_HistoryDepth;
+		if(depth == 0)
+			depth = m_Config.m_IntervalThr / m_Config.GetInterval(i) + 1;
+		if(depth < 2)
+			depth = 2;
+		m_History[i].SetCapacity(depth);
+		m_Tick = std::gcd(m_Tick, m_Config.GetInterval(i));
+	}
+	if(m_Tick == 0)
+		m_Tick = m_Config.m_SampleInterval;
+	for(size_t i = 0; i < m_Periods.size(); ++i)
+		m_Periods[i] = m_Config.GetInterval(i) / m_Tick;
+	m_StopPipe[0] = m_StopPipe[1] = -1;
+}
+
+
+Daemon::~Daemon()
+{
+	for(size_t i = 0; i < 2; ++i)
+	{
+		if(m_StopPipe[i] >= 0)
+			close(m_StopPipe[i]);
+	}
+	if(m_Listen >= 0)
+	{
+		close(m_Listen);
+		unlink(m_Config.m_SocketFile.c_str());
+	}
+}
+
+
+bool Daemon::OpenSocket()
+{
+	struct sockaddr_un addr;
+	if(!MakeSocketAddress(addr, m_Config.m_SocketFile))
+		return false;
+	m_Listen = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(m_Listen < 0)
+	{
+		LOG(ERROR) << "Cannot create socket (error code " << errno << ")\n";
+		return false;
+	}
+	fcntl(m_Listen, F_SETFD, FD_CLOEXEC);
+	fcntl(m_Listen, F_SETFL, fcntl(m_Listen, F_GETFL) | O_NONBLOCK);
+	// Remove stale socket of a previous instance
+	unlink(addr.sun_path);
+	if(bind(m_Listen, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| listen(m_Listen, 16) != 0)
+	{
+		LOG(ERROR) << "Cannot listen on '" << m_Config.m_SocketFile << "' (error code " << errno << ")\n";
+		close(m_Listen);
+		m_Listen = -1;
+		return false;
+	}
+	// Any local user may ask for the verdict
+	chmod(addr.sun_path, 0666);
+	return true;
+}
+
+
+void Daemon::OpenEvents()
+{
+	if(!m_Config.m_ProcEvents || !m_Config.NeedsScan())
+		return;
+	// Events describe the live system, not a fixture tree
+	if(!m_Config.m_ProcRoot.empty())
+	{
+		LOG(WARN) << "Process events are ignored with 'proc_root'\n";
+		return;
+	}
+	if(m_Events.Open())
+		LOG(INFO) << "Following process events\n";
+	else
+		LOG(WARN) << "Process events are not available; scanning all processes on each sample\n";
+}
+
+
+void Daemon::OnExits()
+{
+	m_Watch.Read();
+	const size_t n = m_Watch.Drop(m_Last);
+	if(n)
+		LOG(DEBUG) << n << " sampled process(es) exited\n";
+}
+
+
+void Daemon::TakeSample(const SampleSet::Due_t &due)
+{
+	ProcSource &src = ProcSource::GetDefault();
+	SampleSet cur;
+	cur.m_Due = due;
+	OnExits();
+	if(m_Events.IsOpen())
+	{
+		m_Events.Read();
+		// Exec'd processes keep their start time; drop stale matches
+		for(ProcEvents::Pids_t::const_iterator it = m_Events.m_Started.begin(); it != m_Events.m_Started.end(); ++it)
+			m_Cache.m_Entries.erase(*it);
+		for(ProcEvents::Pids_t::const_iterator it = m_Events.m_Exited.begin(); it != m_Events.m_Exited.end(); ++it)
+			m_Cache.m_Entries.erase(*it);
+	}
+	if(m_Events.IsOpen() && !m_Events.IsLost() && m_Last.m_Clock)
+		cur.Update(m_Last, m_Config, m_Events, src);
+	else
+	{
+		if(m_Events.IsLost())
+			LOG(WARN) << "Process events were lost; scanning all processes\n";
+		cur.Rescan(m_Last, m_Config, src, m_Config.m_ArgvCache ? &m_Cache : NULL);
+	}
+	// Events read from now on apply to 'cur'
+	m_Events.Clear();
+	// A process exiting meanwhile may have been read under a recycled pid
+	m_Watch.Read();
+	m_Watch.Drop(cur);
+	m_Watch.Sync(cur, src);
+	m_Watch.Drop(cur);
+	m_Last = std::move(cur);
+}
+
+
+bool Daemon::Enqueue()
+{
+	if(!m_Queue.TryPush(m_Pending))
+		return false;
+	m_Pending.reset();
+	// Taking the lock orders the push before the wait of the evaluator
+	{
+		std::lock_guard<std::mutex> lock(m_WakeLock);
+	}
+	m_Wake.notify_one();
+	return true;
+}
+
+
+void Daemon::EvaluateLoop()
+{
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_WakeLock);
+			m_Wake.wait(lock, [this] { return m_Stop || !m_Queue.IsEmpty(); });
+		}
+		// Queued samples are evaluated before stopping
+		Snapshot_t cur;
+		if(!m_Queue.TryPop(cur))
+			return;
+		int state;
+		{
+			ProfileScope prof(phEvaluate);
+			state = Evaluate(cur);
+		}
+		// Reset by the sampler; the report covers the sample and its evaluation
+		if(Profiler::IsEnabled())
+		{
+			ProfileData data;
+			Profiler::GetData(data);
+			LOG(INFO) << "**Profile**\n";
+			data.Print(Log(INFO));
+		}
+		if(state != m_State.load())
+		{
+			LOG(INFO) << "Server is now " << (state == ACTIVE_STATE ? "active" : "idle") << '\n';
+			m_State.store(state);
+		}
+	}
+}
+
+
+int Daemon::Evaluate(const Snapshot_t &cur)
+{
+	// Distribute the snapshot to the ring of each service read by it
+	std::vector<ServiceHistory::Entry *> slots(m_History.size(), NULL);
+	for(size_t i = 0; i < m_History.size(); ++i)
+	{
+		if(cur->IsDue(i))
+			slots[i] = &m_History[i].Push(cur->m_Clock);
+	}
+	for(SampleSet::SampleSet_t::const_iterator it = cur->m_Samples.begin(); it != cur->m_Samples.end(); ++it)
+	{
+		ServiceHistory::Entry *slot = slots[cur->m_Pid2Cfg.at(it->first)];
+		if(slot)
+			slot->m_Samples.emplace(it->first, it->second);
+	}
+	// Verdict messages are only relevant when debugging
+	Activity act(m_Config, DEBUG);
+	bool found = false;
+	int state = IDLE_STATE;
+	for(size_t i = 0; i < m_History.size(); ++i)
+	{
+		const ServiceHistory::Entry *last = m_History[i].GetLatest();
+		if(last == NULL || last->m_Samples.empty())
+			continue;
+		found = true;
+		const ServiceHistory::Entry *base = m_History[i].GetBaseline(act.m_MinTimeDiff, m_Config.m_IntervalThr);
+		if(base == NULL)
+		{
+			LOG(DEBUG) << "Service '" << m_Config.m_Procs[i].m_Name << "' has not enough history\n";
+			state = ACTIVE_STATE;
+		}
+		else if(act.EvaluateService(i, base->m_Samples, base->m_Clock, last->m_Samples, last->m_Clock) == ACTIVE_STATE)
+			state = ACTIVE_STATE;
+	}
+	if(!found)
+		LOG(DEBUG) << "No listed service was found\n";
+	if(m_Config.m_PromListen || !m_Config.m_PromFile.empty())
+	{
+		m_Exporter.Update(act, *cur, state);
+		if(!m_Config.m_PromFile.empty())
+			m_Exporter.WriteFile();
+	}
+	m_Shm.Publish(act, *cur, state);
+	if(!m_Config.m_TrendDir.empty())
+	{
+		// Counters are cumulative, so dropped samples only widen the interval
+		m_Trend.Append(m_Prev.get(), *cur, state);
+		m_Prev = cur;
+	}
+	return state;
+}
+
+
+void Daemon::Serve()
+{
+	char reply[16];
+	int len = snprintf(reply, sizeof(reply), "%d\n", m_State.load());
+	for(;;)
+	{
+		int fd = accept(m_Listen, NULL, NULL);
+		if(fd < 0)
+			break;
+		if(write(fd, reply, len) != len)
+			LOG(WARN) << "Failed to answer a client (error code " << errno << ")\n";
+		close(fd);
+	}
+}
+
+
+void Daemon::ServeLoop()
+{
+	const int fds[3] = { m_StopPipe[0], m_Listen, m_Exporter.GetSocket() };
+	struct pollfd pfd[3];
+	nfds_t n = 0;
+	for(size_t i = 0; i < 3; ++i)
+	{
+		if(fds[i] < 0)
+			continue;
+		pfd[n].fd = fds[i];
+		pfd[n].events = POLLIN;
+		++n;
+	}
+	for(;;)
+	{
+		for(nfds_t i = 0; i < n; ++i)
+			pfd[i].revents = 0;
+		if(poll(pfd, n, -1) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			LOG(ERROR) << "Cannot wait for clients (error code " << errno << ")\n";
+			return;
+		}
+		// Stop requested by the sampler
+		if(pfd[0].revents)
+			return;
+		for(nfds_t i = 1; i < n; ++i)
+		{
+			if((pfd[i].revents & POLLIN) == 0)
+				continue;
+			if(pfd[i].fd == m_Listen)
+				Serve();
+			else
+				m_Exporter.Serve();
+		}
+	}
+}
+
+
+int Daemon::Run()
+{
+	if(!OpenSocket())
+		return ERROR_STATE;
+	if(m_Config.m_PromListen && !m_Exporter.Listen())
+		return ERROR_STATE;
+	if(!m_Config.m_ShmName.empty() && !m_Shm.Create())
+		return ERROR_STATE;
+	if(pipe(m_StopPipe) != 0)
+	{
+		LOG(ERROR) << "Cannot create pipe (error code " << errno << ")\n";
+		return ERROR_STATE;
+	}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnStopSignal;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	// Before the first scan, so no process start is missed
+	OpenEvents();
+	// pidfds refer to live processes, not to a fixture tree
+	if(m_Config.m_ProcRoot.empty() && m_Watch.Open())
+		LOG(DEBUG) << "Watching sampled processes through pidfds\n";
+	LOG(INFO) << "Daemon listening on '" << m_Config.m_SocketFile << "', sampling every " << m_Config.m_SampleInterval << " s\n";
+	for(size_t i = 0; i < m_Config.m_Procs.size(); ++i)
+	{
+		if(m_Config.m_Procs[i].m_Interval)
+			LOG(DEBUG) << "Service '" << m_Config.m_Procs[i].m_Name << "' is sampled every " << m_Config.m_Procs[i].m_Interval << " s\n";
+	}
+
+	// Signals are handled by the sampler, whose poll() they interrupt
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	std::thread eval(&Daemon::EvaluateLoop, this);
+	std::thread serve(&Daemon::ServeLoop, this);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	ProcSource &src = ProcSource::GetDefault();
+	const uint64_t tick_ns = m_Tick * 1000000000ULL;
+	const uint64_t start = src.GetClock();
+	uint64_t next = start;
+	// The first sample reads all sections
+	std::vector<size_t> fired(m_Periods.size());
+	std::iota(fired.begin(), fired.end(), 0);
+	m_Wheel.Clear();
+	bool delayed = false;
+	while(!s_Stop)
+	{
+		if(m_Pending && !Enqueue())
+		{
+			if(!delayed)
+				LOG(WARN) << "Evaluation is late; sampling is delayed\n";
+			delayed = true;
+		}
+		else
+			delayed = false;
+		uint64_t now = src.GetClock();
+		if(now >= next && !m_Pending)
+		{
+			const uint64_t tick = (now - start) / tick_ns;
+			m_Wheel.Advance(tick, fired);
+			// Sections due on the same tick share one sampling pass
+			SampleSet::Due_t due(m_Periods.size(), false);
+			for(size_t i = 0; i < fired.size(); ++i)
+			{
+				const size_t id = fired[i];
+				due[id] = true;
+				// Aligned on multiples of the period, so sections stay grouped
+				m_Wheel.Schedule(id, (tick / m_Periods[id] + 1) * m_Periods[id]);
+			}
+			const uint64_t next_tick = m_Wheel.GetNextTick();
+			next = next_tick == UINT64_MAX ? UINT64_MAX : start + next_tick * tick_ns;
+			// Ticks only cascading the wheel sample nothing
+			if(fired.empty() && m_Last.m_Clock)
+				continue;
+			if(fired.size() == m_Periods.size())
+				due.clear();
+			else
+				LOG(DEBUG) << fired.size() << " of " << m_Periods.size() << " services due\n";
+			fired.clear();
+			// Each cycle is profiled alone
+			if(Profiler::IsEnabled())
+				Profiler::Reset();
+			TakeSample(due);
+			m_Pending = std::make_shared<const SampleSet>(m_Last);
+			if(!Enqueue() && m_Config.m_QueueFull == AppConfig::qfDrop)
+			{
+				m_Pending.reset();
+				++m_Dropped;
+				LOG(WARN) << "Evaluation is late; sample dropped (" << m_Dropped << " so far)\n";
+			}
+			continue;
+		}
+		// Events are drained as they come, so bursts do not overflow the socket
+		const int fds[2] = { m_Events.GetSocket(), m_Watch.GetSocket() };
+		struct pollfd pfd[2];
+		nfds_t n = 0;
+		for(size_t i = 0; i < 2; ++i)
+		{
+			if(fds[i] < 0)
+				continue;
+			pfd[n].fd = fds[i];
+			pfd[n].events = POLLIN;
+			pfd[n].revents = 0;
+			++n;
+		}
+		int timeout = now < next ? (int)std::min<uint64_t>((next - now) / 1000000 + 1, INT_MAX) : 0;
+		// A blocked sample retries as soon as the evaluator frees a slot
+		if(m_Pending && (timeout == 0 || timeout > 10))
+			timeout = 10;
+		if(poll(pfd, n, timeout) > 0)
+		{
+			for(nfds_t i = 0; i < n; ++i)
+			{
+				if((pfd[i].revents & POLLIN) == 0)
+					continue;
+				if(pfd[i].fd == m_Events.GetSocket())
+					m_Events.Read();
+				else
+					OnExits();
+			}
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_WakeLock);
+		m_Stop = true;
+	}
+	m_Wake.notify_one();
+	if(write(m_StopPipe[1], "", 1) != 1)
+		LOG(WARN) << "Cannot stop the client thread (error code " << errno << ")\n";
+	serve.join();
+	eval.join();
+	LOG(INFO) << "Daemon stopped\n";
+	// Allows one-shot checks to continue where the daemon left; carried
+	// samples would not match the clock of the record
+	if(m_Last.m_Clock && !m_Last.m_Due.empty())
+		TakeSample(SampleSet::Due_t());
+	if(m_Last.m_Clock)
+		m_Last.MakeRecord(m_Config);
+	return EXIT_SUCCESS;
+}
+
+
+int Daemon::Query(const AppConfig &config)
+{
+	struct sockaddr_un addr;
+	if(!MakeSocketAddress(addr, config.m_SocketFile))
+		return ERROR_STATE;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		LOG(ERROR) << "Cannot create socket (error code " << errno << ")\n";
+		return ERROR_STATE;
+	}
+	struct timeval tv = { 5, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		LOG(ERROR) << "Cannot connect to daemon at '" << config.m_SocketFile << "' (error code " << errno << ")\n";
+		close(fd);
+		return ERROR_STATE;
+	}
+	char buf[16];
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(n <= 0)
+	{
+		LOG(ERROR) << "No answer from daemon at '" << config.m_SocketFile << "'\n";
+		return ERROR_STATE;
+	}
+	buf[n] = 0;
+	int state = atoi(buf);
+	LOG(INFO) << "Daemon reports server " << (state == ACTIVE_STATE ? "active" : state == IDLE_STATE ? "idle" : "in error") << '\n';
+	return state;
+}
+
+
+}	// PidSample
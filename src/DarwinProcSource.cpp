@@ -0,0 +1,246 @@
+#include "StdInc.hpp"
+#include "ProcSource.hpp"
+#include "PidSample.hpp"
+#include "Log.hpp"
+
+#if defined(__APPLE__)
+
+extern "C"
+{
+#include <sys/types.h>
+#include <sys/sysctl.h>
+}
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+ProcSource &ProcSource::GetDefault()
+{
+	static DarwinProcSource s_Source;
+	return s_Source;
+}
+
+
+uint64_t DarwinProcSource::GetClock()
+{
+	return clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW);
+}
+
+
+bool DarwinProcSource::ListPids(std::vector<pid_t> &pids)
+{
+	// Number of pids
+	int nProcs = proc_listpids(PROC_ALL_PIDS, 0, NULL, 0);
+	if(nProcs <= 0)
+	{
+		LOG(ERROR) << "Call to proc_listpids() failed with error code " << errno << '\n';
+		return false;
+	}
+	do
+	{
+		// Also reserve space for new arrivals
+		pids.resize(nProcs + 128);
+		// Load all pids
+		nProcs = proc_listpids(PROC_ALL_PIDS, 0, pids.data(), pids.size() * sizeof(pid_t));
+	} while ((size_t)nProcs > pids.size());		// keep trying if not enough space
+	pids.resize(nProcs);
+	return true;
+}
+
+
+bool DarwinProcSource::GetProcInfo(ProcInfo &info, pid_t pid)
+{
+	struct proc_bsdinfo bsd;
+	if(proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &bsd, sizeof(bsd)) != (int)sizeof(bsd))
+		return false;
+	// Same value as ReadSample(), so both can be compared
+	rusage_info_current rusage;
+	if(proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+		return false;
+	info.m_StartTime = rusage.ri_proc_start_abstime;
+	info.m_ExecId = HashName(bsd.pbi_comm, strnlen(bsd.pbi_comm, sizeof(bsd.pbi_comm)));
+	info.m_PPid = bsd.pbi_ppid;
+	return true;
+}
+
+
+bool DarwinProcSource::ReadSample(Sample &samp)
+{
+	rusage_info_current rusage;
+	if(proc_pid_rusage(samp.m_Pid, RUSAGE_INFO_CURRENT, (void **)&rusage) != 0)
+		return false;
+	// Absolute start time, in ns
+	samp.m_StartTime = rusage.ri_proc_start_abstime;
+	samp.m_CpuTime = rusage.ri_user_time > 0 ? rusage.ri_user_time : 1;
+	samp.m_SysTime = rusage.ri_system_time;
+	samp.m_DiskReadBytes = rusage.ri_diskio_bytesread;
+	samp.m_DiskWriteBytes = rusage.ri_diskio_byteswritten;
+	return true;
+}
+
+
+DarwinProcSource::DarwinProcSource()
+	: m_ArgMax(0)
+{
+	int mib[2] = { CTL_KERN, KERN_ARGMAX };
+	// Get estimate buffer size; constant for the system
+	size_t bufsize = sizeof(m_ArgMax);
+	if(sysctl(mib, 2, &m_ArgMax, &bufsize, NULL, 0) == -1)
+	{
+		LOG(WARN) << "System call CTL_KERN/KERN_ARGMAX failed with error code " << errno << '\n';
+		m_ArgMax = 256 * 1024;
+	}
+}
+
+
+bool DarwinProcSource::GetArgvView(ArgvView &res, pid_t pid, size_t max_args)
+{
+	res.Clear();
+	/* Space for the arguments; reused by the next calls on this view. */
+	std::vector<char> &argsBuf = res.m_Buffer;
+	if(argsBuf.size() < m_ArgMax)
+		argsBuf.resize(m_ArgMax);
+
+	int mib[3];
+	mib[0] = CTL_KERN;
+	mib[1] = KERN_PROCARGS2;
+	mib[2] = pid;
+
+	size_t bufsize = argsBuf.size();
+	int rv = sysctl(mib, 3, argsBuf.data(), &bufsize, NULL, 0);
+	if (rv == -1
+		&& errno != EINVAL)
+	{
+		if(errno != ESRCH)
+			LOG(WARN) << "System call CTL_KERN/KERN_PROCARGS2 failed with error code " << errno << " (pid=" << pid << ")\n";
+		return false;
+	}
+	// Failure (privilege)
+	if (rv == -1)
+	{
+		// User has no privilege, only argv[0] can be retrieved
+		char *pathBuffer = argsBuf.data();
+		bzero(pathBuffer, PROC_PIDPATHINFO_MAXSIZE);
+		if(proc_pidpath(pid, pathBuffer, PROC_PIDPATHINFO_MAXSIZE) == 0)
+		{
+			if(errno != ESRCH)
+				LOG(WARN) << "Call to proc_pidpath() failed with error code " << errno << " (pid=" << pid << ")\n";
+			return false;
+		}
+		res.m_Args.emplace_back(pathBuffer);
+		return true;
+	}
+
+	/*
+	** Make a sysctl() call to get the raw argument space of the process.
+	** The layout is documented in start.s, which is part of the Csu
+	** project.  In summary, it looks like:
+	**
+	** /---------------\ 0x00000000
+	** :               :
+	** :               :
+	** |---------------|
+	** | argc          |
+	** |---------------|
+	** | arg[0]        |
+	** |---------------|
+	** :               :
+	** :               :
+	** |---------------|
+	** | arg[argc - 1] |
+	** |---------------|
+	** | 0             |
+	** |---------------|
+	** | env[0]        |
+	** |---------------|
+	** :               :
+	** :               :
+	** |---------------|
+	** | env[n]        |
+	** |---------------|
+	** | 0             |
+	** |---------------| <-- Beginning of data returned by sysctl() is here.
+	** | argc          |
+	** |---------------|
+	** | exec_path     |
+	** |:::::::::::::::|
+	** |               |
+	** | String area.  |
+	** |               |
+	** |---------------| <-- Top of stack.
+	** :               :
+	** :               :
+	** \---------------/ 0xffffffff
+	*/
+
+	const char * const procargs = argsBuf.data();
+	if (bufsize <= sizeof(uint32_t))
+	{
+		LOG(ERROR) << "Failed to parse the process path\n";
+		return false;
+	}
+	size_t nargs = *(uint32_t*)procargs;
+	const char *cp = procargs + sizeof(uint32_t);
+	const char *maxp = procargs + bufsize;
+
+	/* Skip the saved exec_path. */
+	const char *eos = (const char *)memchr(cp, 0, maxp - cp);
+	if (eos == NULL)
+	{
+		LOG(ERROR) << "Failed to parse the process path\n";
+		return false;
+	}
+	std::string_view exe(cp, eos - cp);
+	cp = eos;
+
+	/* Skip trailing '\0' characters. */
+	while ((cp < maxp) && (*cp == 0))
+		++cp;
+	if (cp >= maxp)
+	{
+		LOG(ERROR) << "Failed to locate the first argument\n";
+		return false;
+	}
+	/*
+	** Iterate through the '\0'-terminated strings up to 'nargs'; what
+	** follows are the environment strings.
+	*/
+	for (size_t i = 0; i < nargs; ++i)
+	{
+		if (res.m_Args.size() >= max_args)
+		{
+			res.m_Truncated = true;
+			break;
+		}
+		if (cp >= maxp)
+		{
+			LOG(ERROR) << "Buffer overflow while parsing arguments\n";
+			return false;
+		}
+		eos = (const char *)memchr(cp, 0, maxp - cp);
+		if (eos == NULL)
+			eos = maxp;
+		std::string_view s(cp, eos - cp);
+		if (i == 0)
+		{
+			res.m_Args.push_back(exe);
+			// Scripts such as Python may fix the argv0 to remove shebang
+			if (exe != s && res.m_Args.size() < max_args)
+				res.m_Args.push_back(s);
+		}
+		else
+			res.m_Args.push_back(s);
+		cp = eos + 1;
+	}
+	return true;
+}
+
+
+}	// PidSample
+
+#endif	// __APPLE__
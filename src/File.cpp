@@ -1,5 +1,7 @@
 #include "StdInc.hpp"
 #include "File.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 namespace grumat
@@ -20,4 +22,37 @@ bool FFile::ReadString(std::string &s)
 }
 
 
+bool MMapFile::Open(const char *fname)
+{
+	Close();
+	int fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return false;
+	m_pData = (const uint8_t *)p;
+	m_Size = st.st_size;
+	return true;
+}
+
+
+void MMapFile::Close()
+{
+	if(m_pData)
+	{
+		munmap((void *)m_pData, m_Size);
+		m_pData = NULL;
+		m_Size = 0;
+	}
+}
+
+
 } 	// namespace grumat
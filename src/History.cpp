@@ -0,0 +1,193 @@
+#include "StdInc.hpp"
+#include "History.hpp"
+#include "Log.hpp"
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+const char HistoryView::kMagic[8] = { 'I', 'S', 'B', 'H', 'I', 'S', 'T', 0 };
+
+
+HistoryView::HistoryView()
+	: m_pHeader(NULL)
+	, m_pPids(NULL)
+	, m_pArgv(NULL)
+	, m_pBlob(NULL)
+{
+}
+
+
+bool HistoryView::IsBinary(const char *fname)
+{
+	char magic[sizeof(kMagic)];
+	std::ifstream strm(fname, std::ios::binary);
+	if(!strm.read(magic, sizeof(magic)))
+		return false;
+	return memcmp(magic, kMagic, sizeof(magic)) == 0;
+}
+
+
+bool HistoryView::Open(const char *fname)
+{
+	m_pHeader = NULL;
+	if(!m_File.Open(fname))
+		return false;
+	const uint8_t *base = m_File.GetData();
+	const uint64_t size = m_File.GetSize();
+	const HistoryHeader *hdr = (const HistoryHeader *)base;
+	if(size < sizeof(HistoryHeader)
+		|| memcmp(hdr->m_Magic, kMagic, sizeof(kMagic)) != 0)
+	{
+		LOG(ERROR) << "File '" << fname << "' is not a binary history!\n";
+		return false;
+	}
+	if(hdr->m_Version != kVersion
+		|| hdr->m_HeaderSize != sizeof(HistoryHeader))
+	{
+		LOG(ERROR) << "Binary history version " << hdr->m_Version << " cannot be handled\n";
+		return false;
+	}
+	// All tables must fit the file
+	const uint64_t pids_ofs = hdr->m_HeaderSize;
+	const uint64_t argv_ofs = pids_ofs + (uint64_t)hdr->m_PidCount * sizeof(HistoryPid);
+	const uint64_t blob_ofs = argv_ofs + (uint64_t)hdr->m_ArgvCount * sizeof(uint32_t);
+	if(blob_ofs + hdr->m_BlobSize > size
+		|| (hdr->m_BlobSize && base[blob_ofs + hdr->m_BlobSize - 1] != 0))
+	{
+		LOG(ERROR) << "Binary history '" << fname << "' is truncated!\n";
+		return false;
+	}
+	const HistoryPid *pids = (const HistoryPid *)(base + pids_ofs);
+	const uint32_t *argv = (const uint32_t *)(base + argv_ofs);
+	for(uint32_t i = 0; i < hdr->m_PidCount; ++i)
+	{
+		const HistoryPid &e = pids[i];
+		if((uint64_t)e.m_ArgvFirst + e.m_ArgvCount > hdr->m_ArgvCount
+			|| e.m_Service > hdr->m_BlobSize
+			|| (i && pids[i-1].m_Pid >= e.m_Pid))
+		{
+			LOG(ERROR) << "Binary history '" << fname << "' has an invalid pid table!\n";
+			return false;
+		}
+	}
+	for(uint32_t i = 0; i < hdr->m_ArgvCount; ++i)
+	{
+		if(argv[i] >= hdr->m_BlobSize)
+		{
+			LOG(ERROR) << "Binary history '" << fname << "' has an invalid argv table!\n";
+			return false;
+		}
+	}
+	m_pHeader = hdr;
+	m_pPids = pids;
+	m_pArgv = argv;
+	m_pBlob = (const char *)(base + blob_ofs);
+	return true;
+}
+
+
+const HistoryPid *HistoryView::Find(pid_t pid) const
+{
+	const HistoryPid *end = m_pPids + m_pHeader->m_PidCount;
+	const HistoryPid *it = std::lower_bound(m_pPids, end, pid
+		, [](const HistoryPid &e, pid_t v) { return e.m_Pid < v; }
+		);
+	if(it != end && it->m_Pid == pid)
+		return it;
+	return NULL;
+}
+
+
+bool HistoryView::GetProfile(ProfileData &prof) const
+{
+	const uint64_t ofs = m_pBlob + m_pHeader->m_BlobSize - (const char *)m_File.GetData();
+	if(m_pHeader->m_ProfileSize != sizeof(ProfileData)
+		|| ofs + sizeof(ProfileData) > m_File.GetSize())
+		return false;
+	// Trailing data is not aligned
+	memcpy(&prof, m_File.GetData() + ofs, sizeof(prof));
+	return true;
+}
+
+
+bool HistoryView::Write(const char *fname, const SampleSet &samps, const ProfileData *prof)
+{
+	HistoryHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.m_Magic, kMagic, sizeof(kMagic));
+	hdr.m_Version = kVersion;
+	hdr.m_HeaderSize = sizeof(hdr);
+	hdr.m_SysClock = samps.m_Clock;
+
+	std::vector<HistoryPid> pids;
+	std::vector<uint32_t> argv;
+	std::string blob;
+	// Interning table; views refer to the samples, which outlive it
+	std::unordered_map<std::string_view, uint32_t> interned;
+	auto intern = [&](std::string_view str) -> uint32_t
+	{
+		std::pair<std::unordered_map<std::string_view, uint32_t>::iterator, bool> ins = interned.emplace(str, blob.size());
+		if(ins.second)
+		{
+			blob.append(str);
+			blob.push_back(0);
+		}
+		return ins.first->second;
+	};
+	pids.reserve(samps.m_Samples.size());
+	// std::map iterates in ascending pid order
+	for(SampleSet::SampleSet_t::const_iterator it = samps.m_Samples.begin(); it != samps.m_Samples.end(); ++it)
+	{
+		const Sample &s = it->second;
+		HistoryPid e;
+		memset(&e, 0, sizeof(e));
+		e.m_Pid = s.m_Pid;
+		e.m_StartTime = s.m_StartTime;
+		e.m_ArgvFirst = argv.size();
+		e.m_ArgvCount = s.m_Argv.size();
+		e.m_CpuTime = s.m_CpuTime;
+		e.m_SysTime = s.m_SysTime;
+		e.m_DiskReadBytes = s.m_DiskReadBytes;
+		e.m_DiskWriteBytes = s.m_DiskWriteBytes;
+		for(size_t i = 0; i < s.m_Argv.size(); ++i)
+			argv.push_back(intern(s.m_Argv[i]));
+		if(!s.m_Service.empty())
+			e.m_Service = intern(s.m_Service) + 1;
+		pids.push_back(e);
+	}
+	hdr.m_PidCount = pids.size();
+	hdr.m_ArgvCount = argv.size();
+	hdr.m_BlobSize = blob.size();
+	hdr.m_ProfileSize = prof ? sizeof(ProfileData) : 0;
+
+	// Readers may have the file mapped; replace it atomically
+	std::string tmp(fname);
+	tmp += ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if(fp == NULL)
+	{
+		LOG(ERROR) << "Cannot create history file '" << tmp << "'!\n";
+		return false;
+	}
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(pids.data(), sizeof(HistoryPid), pids.size(), fp) == pids.size()
+		&& fwrite(argv.data(), sizeof(uint32_t), argv.size(), fp) == argv.size()
+		&& fwrite(blob.data(), 1, blob.size(), fp) == blob.size()
+		&& (prof == NULL || fwrite(prof, sizeof(ProfileData), 1, fp) == 1);
+	ok = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname) != 0)
+	{
+		LOG(ERROR) << "Failed to write history file '" << fname << "'!\n";
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+}	// PidSample
@@ -0,0 +1,574 @@
+#include "StdInc.hpp"
+#include "ProcSource.hpp"
+#include "PidSample.hpp"
+#include "Log.hpp"
+
+#if defined(__linux__)
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include <stddef.h>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+// Fields of /proc/<pid>/stat used by the tool
+struct StatFields
+{
+	// Program name, between parenthesis
+	const char *m_Comm;
+	size_t m_CommLen;
+	pid_t m_PPid;
+	uint64_t m_UTime;
+	uint64_t m_STime;
+	uint64_t m_StartTime;
+};
+
+
+static bool ParseStat(const char *buf, StatFields &f)
+{
+	// Process name may contain spaces and parenthesis
+	const char *p = strrchr(buf, ')');
+	const char *comm = strchr(buf, '(');
+	if(p == NULL || comm == NULL || comm > p || p[1] != ' ' || p[2] == 0)
+		return false;
+	f.m_Comm = comm + 1;
+	f.m_CommLen = p - f.m_Comm;
+	// Skip the 'state' field; numeric fields start at 4
+	p += 3;
+	for(int field = 4; field <= 22; ++field)
+	{
+		char *end;
+		long long val = strtoll(p, &end, 10);
+		if(end == p)
+			return false;
+		p = end;
+		switch(field)
+		{
+		case 4:
+			f.m_PPid = (pid_t)val;
+			break;
+		case 14:
+			f.m_UTime = val;
+			break;
+		case 15:
+			f.m_STime = val;
+			break;
+		case 22:
+			f.m_StartTime = val;
+			break;
+		}
+	}
+	return true;
+}
+
+
+ProcSource &ProcSource::GetDefault()
+{
+	static LinuxProcSource s_Source;
+	return s_Source;
+}
+
+
+LinuxProcSource::LinuxProcSource()
+	: m_Root("/proc")
+	, m_CgroupRoot("/sys/fs/cgroup")
+	, m_Taskstats(-1)
+	, m_TsFamily(0)
+	, m_TsSeq(0)
+{
+	long ticks = sysconf(_SC_CLK_TCK);
+	m_TickNs = ticks > 0 ? 1000000000ULL / ticks : 10000000ULL;
+}
+
+
+bool LinuxProcSource::SetRoot(const char *path)
+{
+	m_Root = path;
+	while(m_Root.size() > 1 && m_Root.back() == '/')
+		m_Root.pop_back();
+	return true;
+}
+
+
+bool LinuxProcSource::SetCgroupRoot(const char *path)
+{
+	m_CgroupRoot = path;
+	while(m_CgroupRoot.size() > 1 && m_CgroupRoot.back() == '/')
+		m_CgroupRoot.pop_back();
+	return true;
+}
+
+
+uint64_t LinuxProcSource::GetClock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+ssize_t LinuxProcSource::ReadPidFile(pid_t pid, const char *name, char *buf, size_t size) const
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%d/%s", m_Root.c_str(), (int)pid, name);
+	return ReadFile(path, buf, size);
+}
+
+
+ssize_t LinuxProcSource::ReadFile(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+	size_t total = 0;
+	while(total < size)
+	{
+		ssize_t n = read(fd, buf + total, size - total);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		if(n == 0)
+			break;
+		total += n;
+	}
+	close(fd);
+	return total;
+}
+
+
+bool LinuxProcSource::ListPids(std::vector<pid_t> &pids)
+{
+	pids.clear();
+	DIR *dir = opendir(m_Root.c_str());
+	if(dir == NULL)
+	{
+		LOG(ERROR) << "Cannot open '" << m_Root << "' directory (error code " << errno << ")\n";
+		return false;
+	}
+	while(struct dirent *ent = readdir(dir))
+	{
+		// Only numeric entries are processes
+		const char *p = ent->d_name;
+		if(*p < '1' || *p > '9')
+			continue;
+		pid_t pid = 0;
+		for(; *p >= '0' && *p <= '9'; ++p)
+			pid = pid * 10 + (*p - '0');
+		if(*p == 0)
+			pids.push_back(pid);
+	}
+	closedir(dir);
+	return true;
+}
+
+
+bool LinuxProcSource::GetArgvView(ArgvView &res, pid_t pid, size_t max_args)
+{
+	res.Clear();
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%d/cmdline", m_Root.c_str(), (int)pid);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return false;
+	// Most command lines fit the initial buffer
+	std::vector<char> &buf = res.m_Buffer;
+	if(buf.size() < 4096)
+		buf.resize(4096);
+	size_t total = 0;
+	size_t nargs = 0;
+	bool eof = false;
+	for(;;)
+	{
+		if(total == buf.size())
+			buf.resize(buf.size() * 2);
+		ssize_t n = read(fd, buf.data() + total, buf.size() - total);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			close(fd);
+			return false;
+		}
+		if(n == 0)
+		{
+			eof = true;
+			break;
+		}
+		// Stop reading once the needed arguments are complete
+		const char *cp = buf.data() + total;
+		const char *maxp = cp + n;
+		total += n;
+		while(nargs < max_args
+			&& (cp = (const char *)memchr(cp, 0, maxp - cp)) != NULL)
+		{
+			++nargs;
+			++cp;
+		}
+		if(nargs >= max_args)
+			break;
+	}
+	close(fd);
+	// Kernel threads and zombies have an empty command line
+	if(total == 0)
+		return false;
+	res.Parse(buf.data(), total, max_args);
+	if(!eof)
+		res.m_Truncated = true;
+	return true;
+}
+
+
+bool LinuxProcSource::GetProcInfo(ProcInfo &info, pid_t pid)
+{
+	char buf[1024];
+	ssize_t n = ReadPidFile(pid, "stat", buf, sizeof(buf) - 1);
+	if(n <= 0)
+		return false;
+	buf[n] = 0;
+	StatFields f;
+	if(!ParseStat(buf, f))
+		return false;
+	info.m_StartTime = f.m_StartTime;
+	info.m_ExecId = HashName(f.m_Comm, f.m_CommLen);
+	info.m_PPid = f.m_PPid;
+	return true;
+}
+
+
+bool LinuxProcSource::ReadSample(Sample &samp)
+{
+	char ok;
+	ReadSamples(&samp, 1, &ok);
+	return ok != 0;
+}
+
+
+void LinuxProcSource::ReadSamples(Sample *samps, size_t count, char *ok)
+{
+	for(size_t i = 0; i < count; ++i)
+		ok[i] = ReadProcFiles(samps[i]);
+	// A failed batch keeps the tick resolution of procfs
+	if(m_Taskstats >= 0)
+		QueryTaskstats(samps, count, ok);
+}
+
+
+bool LinuxProcSource::ReadProcFiles(Sample &samp)
+{
+	char buf[1024];
+	// CPU ticks are stored in /proc/<pid>/stat
+	ssize_t n = ReadPidFile(samp.m_Pid, "stat", buf, sizeof(buf) - 1);
+	if(n <= 0)
+		return false;
+	buf[n] = 0;
+	StatFields f;
+	if(!ParseStat(buf, f))
+		return false;
+	samp.m_StartTime = f.m_StartTime;
+	// Sums of all threads, including exited ones; schedstat would be more
+	// precise but only covers the main thread
+	const uint64_t user = f.m_UTime * m_TickNs;
+	samp.m_CpuTime = user > 0 ? user : 1;
+	samp.m_SysTime = f.m_STime * m_TickNs;
+	// Disk counters; only readable for own processes unless privileged
+	samp.m_DiskReadBytes = 0;
+	samp.m_DiskWriteBytes = 0;
+	n = ReadPidFile(samp.m_Pid, "io", buf, sizeof(buf) - 1);
+	if(n > 0)
+	{
+		buf[n] = 0;
+		const char *val = strstr(buf, "\nread_bytes: ");
+		if(val)
+			samp.m_DiskReadBytes = strtoull(val + 13, NULL, 10);
+		val = strstr(buf, "\nwrite_bytes: ");
+		if(val)
+			samp.m_DiskWriteBytes = strtoull(val + 14, NULL, 10);
+	}
+	return true;
+}
+
+
+// Payload of the first netlink attribute of 'type' in [data, data + len)
+static const char *FindAttr(const char *data, size_t len, uint16_t type, size_t &alen)
+{
+	while(len >= NLA_HDRLEN)
+	{
+		const struct nlattr *na = (const struct nlattr *)data;
+		if(na->nla_len < NLA_HDRLEN || na->nla_len > len)
+			break;
+		if((na->nla_type & NLA_TYPE_MASK) == type)
+		{
+			alen = na->nla_len - NLA_HDRLEN;
+			return data + NLA_HDRLEN;
+		}
+		const size_t step = NLA_ALIGN(na->nla_len);
+		if(step >= len)
+			break;
+		data += step;
+		len -= step;
+	}
+	return NULL;
+}
+
+
+bool LinuxProcSource::SetTaskstats(bool enable)
+{
+	if(m_Taskstats >= 0)
+	{
+		close(m_Taskstats);
+		m_Taskstats = -1;
+	}
+	if(!enable)
+		return true;
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if(fd < 0)
+		return false;
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	// A lost reply must not stall the sampling
+	struct timeval tv = { 1, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	// Family id of taskstats is dynamic
+	struct
+	{
+		struct nlmsghdr m_Hdr;
+		struct genlmsghdr m_Genl;
+		char m_Attrs[64];
+	} req;
+	memset(&req, 0, sizeof(req));
+	struct nlattr *na = (struct nlattr *)req.m_Attrs;
+	na->nla_type = CTRL_ATTR_FAMILY_NAME;
+	na->nla_len = NLA_HDRLEN + sizeof(TASKSTATS_GENL_NAME);
+	memcpy(req.m_Attrs + NLA_HDRLEN, TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME));
+	req.m_Hdr.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(na->nla_len);
+	req.m_Hdr.nlmsg_type = GENL_ID_CTRL;
+	req.m_Hdr.nlmsg_flags = NLM_F_REQUEST;
+	req.m_Genl.cmd = CTRL_CMD_GETFAMILY;
+	req.m_Genl.version = 1;
+	// Aligned for the netlink headers
+	uint64_t buf[1024];
+	ssize_t n;
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| send(fd, &req, req.m_Hdr.nlmsg_len, 0) < 0
+		|| (n = recv(fd, buf, sizeof(buf), 0)) <= 0)
+	{
+		LOG(DEBUG) << "Cannot query the taskstats family (error code " << errno << ")\n";
+		close(fd);
+		return false;
+	}
+	const struct nlmsghdr *hdr = (const struct nlmsghdr *)buf;
+	size_t alen = 0;
+	const char *id = NULL;
+	if(NLMSG_OK(hdr, (size_t)n) && hdr->nlmsg_type != NLMSG_ERROR && hdr->nlmsg_len >= NLMSG_LENGTH(GENL_HDRLEN))
+		id = FindAttr((const char *)NLMSG_DATA(hdr) + GENL_HDRLEN, hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), CTRL_ATTR_FAMILY_ID, alen);
+	if(id == NULL || alen < sizeof(uint16_t))
+	{
+		// Not built in the kernel or not in this network namespace
+		LOG(DEBUG) << "The taskstats family is not available\n";
+		close(fd);
+		return false;
+	}
+	memcpy(&m_TsFamily, id, sizeof(m_TsFamily));
+	m_Taskstats = fd;
+	// Requests need CAP_NET_ADMIN; probe with the own process
+	Sample self;
+	self.m_Pid = getpid();
+	char ok = ReadProcFiles(self);
+	if(!ok || !QueryTaskstats(&self, 1, &ok) || !ok)
+	{
+		LOG(DEBUG) << "taskstats requests are not permitted\n";
+		close(fd);
+		m_Taskstats = -1;
+		return false;
+	}
+	return true;
+}
+
+
+bool LinuxProcSource::QueryTaskstats(Sample *samps, size_t count, char *ok)
+{
+	struct Request
+	{
+		struct nlmsghdr m_Hdr;
+		struct genlmsghdr m_Genl;
+		struct nlattr m_Attr;
+		uint32_t m_Pid;
+	};
+	// Replies of a group must fit the default socket buffer
+	const size_t kGroup = 64;
+	std::lock_guard<std::mutex> lock(m_TsLock);
+	std::vector<Request> reqs;
+	reqs.reserve(std::min(count, kGroup));
+	for(size_t first = 0; first < count; first += kGroup)
+	{
+		const size_t last = std::min(count, first + kGroup);
+		// Sequence numbers map replies to samples; late replies of a
+		// failed exchange are ignored
+		const uint32_t seq = m_TsSeq;
+		m_TsSeq += kGroup;
+		reqs.clear();
+		for(size_t i = first; i < last; ++i)
+		{
+			if(!ok[i])
+				continue;
+			Request r;
+			memset(&r, 0, sizeof(r));
+			r.m_Hdr.nlmsg_len = sizeof(r);
+			r.m_Hdr.nlmsg_type = m_TsFamily;
+			r.m_Hdr.nlmsg_flags = NLM_F_REQUEST;
+			r.m_Hdr.nlmsg_seq = seq + (uint32_t)(i - first);
+			r.m_Genl.cmd = TASKSTATS_CMD_GET;
+			r.m_Genl.version = TASKSTATS_GENL_VERSION;
+			r.m_Attr.nla_len = NLA_HDRLEN + sizeof(uint32_t);
+			r.m_Attr.nla_type = TASKSTATS_CMD_ATTR_TGID;
+			r.m_Pid = samps[i].m_Pid;
+			reqs.push_back(r);
+		}
+		if(reqs.empty())
+			continue;
+		// The kernel processes all messages of a datagram and answers each
+		const size_t size = reqs.size() * sizeof(Request);
+		if(send(m_Taskstats, reqs.data(), size, 0) != (ssize_t)size)
+		{
+			LOG(WARN) << "taskstats request failed (error code " << errno << ")\n";
+			return false;
+		}
+		uint64_t buf[1024];
+		for(size_t pending = reqs.size(); pending; )
+		{
+			ssize_t n = recv(m_Taskstats, buf, sizeof(buf), 0);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+			{
+				LOG(WARN) << "taskstats reply failed (error code " << errno << ")\n";
+				return false;
+			}
+			for(const struct nlmsghdr *hdr = (const struct nlmsghdr *)buf; NLMSG_OK(hdr, (size_t)n); hdr = NLMSG_NEXT(hdr, n))
+			{
+				const uint32_t idx = hdr->nlmsg_seq - seq;
+				if(idx >= last - first)
+					continue;
+				--pending;
+				Sample &samp = samps[first + idx];
+				if(hdr->nlmsg_type == NLMSG_ERROR)
+				{
+					const struct nlmsgerr *err = (const struct nlmsgerr *)NLMSG_DATA(hdr);
+					// Exited since procfs was read
+					if(err->error == -ESRCH)
+					{
+						ok[first + idx] = 0;
+						continue;
+					}
+					LOG(WARN) << "taskstats request failed (error code " << -err->error << ")\n";
+					return false;
+				}
+				if(hdr->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+					return false;
+				size_t alen = 0;
+				const char *aggr = FindAttr((const char *)NLMSG_DATA(hdr) + GENL_HDRLEN, hdr->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), TASKSTATS_TYPE_AGGR_TGID, alen);
+				const char *data = aggr ? FindAttr(aggr, alen, TASKSTATS_TYPE_STATS, alen) : NULL;
+				// Older kernels send a shorter structure
+				if(data == NULL || alen < offsetof(struct taskstats, cpu_run_virtual_total) + sizeof(uint64_t))
+					return false;
+				struct taskstats ts;
+				memset(&ts, 0, sizeof(ts));
+				memcpy(&ts, data, std::min(alen, sizeof(ts)));
+				// Scheduler run time of all threads, including exited ones; only
+				// filled when delay accounting is on (off by default since 5.14)
+				const uint64_t total = ts.cpu_run_virtual_total;
+				// User and system time of all threads, in microseconds
+				uint64_t utime = ts.ac_utime * 1000;
+				uint64_t stime = ts.ac_stime * 1000;
+				// Not filled for thread groups by older kernels; keep procfs
+				if(utime + stime == 0)
+				{
+					utime = samp.m_CpuTime;
+					stime = samp.m_SysTime;
+				}
+				uint64_t user = utime;
+				uint64_t sys = stime;
+				if(total && utime + stime)
+				{
+					sys = (uint64_t)((double)total * stime / (utime + stime));
+					user = total > sys ? total - sys : 0;
+				}
+				samp.m_CpuTime = user > 0 ? user : 1;
+				samp.m_SysTime = sys;
+			}
+		}
+	}
+	return true;
+}
+
+
+// Value of a 'key value' line of a flat keyed file, such as cpu.stat
+static bool GetKeyValue(const char *buf, const char *key, uint64_t &res)
+{
+	const size_t len = strlen(key);
+	for(const char *p = buf; p; p = strchr(p, '\n'))
+	{
+		if(*p == '\n')
+			++p;
+		if(strncmp(p, key, len) == 0 && p[len] == ' ')
+		{
+			res = strtoull(p + len + 1, NULL, 10);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+bool LinuxProcSource::ReadCgroup(Sample &samp, const char *path)
+{
+	const std::string dir = m_CgroupRoot + '/' + path;
+	// A recreated cgroup has another inode, as a new process has another start time
+	struct stat st;
+	if(stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+		return false;
+	char buf[8192];
+	ssize_t n = ReadFile((dir + "/cpu.stat").c_str(), buf, sizeof(buf) - 1);
+	if(n <= 0)
+		return false;
+	buf[n] = 0;
+	uint64_t user, sys;
+	if(!GetKeyValue(buf, "user_usec", user) || !GetKeyValue(buf, "system_usec", sys))
+		return false;
+	samp.m_StartTime = st.st_ino;
+	// Zero would mark an invalid sample
+	samp.m_CpuTime = user > 0 ? user * 1000 : 1;
+	samp.m_SysTime = sys * 1000;
+	// One line per device; missing if the io controller is not enabled
+	samp.m_DiskReadBytes = 0;
+	samp.m_DiskWriteBytes = 0;
+	n = ReadFile((dir + "/io.stat").c_str(), buf, sizeof(buf) - 1);
+	if(n > 0)
+	{
+		buf[n] = 0;
+		for(const char *p = strstr(buf, " rbytes="); p; p = strstr(p + 1, " rbytes="))
+			samp.m_DiskReadBytes += strtoull(p + 8, NULL, 10);
+		for(const char *p = strstr(buf, " wbytes="); p; p = strstr(p + 1, " wbytes="))
+			samp.m_DiskWriteBytes += strtoull(p + 8, NULL, 10);
+	}
+	return true;
+}
+
+
+}	// PidSample
+
+#endif	// __linux__
@@ -1,5 +1,9 @@
 #include "StdInc.hpp"
 #include "Log.hpp"
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 
 
 namespace grumat
@@ -14,132 +18,140 @@ std::string format_n(const char *fmt, ...)
 	res.resize(strlen(fmt) + 256);
 	for(;;)
 	{
-		// Format string
-		int n = vsnprintf(res.data(),res.size(), fmt, args);
-		// Succeeded?
-		if(n >= 0)
+		// Each attempt consumes its own copy of the arguments
+		va_list copy;
+		va_copy(copy, args);
+		int n = vsnprintf(res.data(), res.size(), fmt, copy);
+		va_end(copy);
+		if(n < 0)
 		{
-			// fix real string size
-			res.resize(n);
+			res.clear();
 			break;
 		}
-		// function should suggest buffer size
-		n = -n;
-		// ensure we grow buffer
+		// Fits, including the terminator
 		if((size_t)n < res.size())
-			res.resize(res.size() + 256);
-		else
-			res.resize(n + 128);
+		{
+			res.resize(n);
+			break;
+		}
+		// Returns the length needed; format again with room for it
+		res.resize(n + 1);
 	}
+	va_end(args);
 	return res;
 }
 
 
+// Complete line of a logger, queued to the writer
+class LogRecord
+{
+public:
+	std::atomic<LogRecord *> m_Next;
+	LogType_e m_Level;
+	// Outputs selected when the line was completed
+	unsigned m_Sinks;
+	time_t m_Time;
+	std::string m_Text;
+};
+
+
+// Formats and writes log records on a background thread. Producers push
+// complete lines to an intrusive MPSC queue and only take the mutex when
+// the writer sleeps.
 class OutputSingleton
 {
 public:
+	enum Sink_e
+	{
+		skFile = 1,
+		skStdErr = 2,
+		skStdOut = 4,
+	};
+
 	OutputSingleton()
-		: m_pFile(NULL)
+		: m_Fd(-1)
 		, m_MaskFile(-1)
 		, m_MaskStdErr((1 << ERROR) | ( 1 << WARN))
 		, m_MaskStdOut(0)	// quiet
-		, m_SendHeader(true)
-		, m_LastLevel(INFO)
-		, m_Col(0)
+		, m_Head(&m_Stub)
+		, m_Tail(&m_Stub)
+		, m_Pushed(0)
+		, m_Written(0)
+		, m_Idle(false)
+		, m_Stop(false)
+		, m_TimeSec(-1)
 	{
+		m_Stub.m_Next = NULL;
 		SetLogLevel(INFO);
 	}
 	~OutputSingleton()
 	{
+		if(m_Thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Lock);
+				m_Stop = true;
+			}
+			m_Wake.notify_one();
+			m_Thread.join();
+		}
 		CloseFile();
 	}
 	void CloseFile()
 	{
-		if(m_pFile)
+		if(m_Fd >= 0)
 		{
-			fclose(m_pFile);
-			m_pFile = NULL;
+			close(m_Fd);
+			m_Fd = -1;
 		}
 	}
 
-	void OpenLogFile(const char *fname)
-	{
-		CloseFile();
-		m_pFile = fopen(fname, "a");
-	}
-
-	void Put(LogType_e lvl, int ch)
+	// Queues a line; 'text' is taken
+	void Push(LogType_e lvl, std::string &text)
 	{
-		static const char *lvl_names[] =
-		{
-			"DEBUG: ",
-			"INFO:  ",
-			"WARN:  ",
-			"ERROR: ",
-		};
-
-		if ((size_t)lvl >= sizeof(lvl_names)/sizeof(lvl_names[0]))
+		if ((size_t)lvl > ERROR)
 			lvl = ERROR;
-		const char *pHdr = NULL;
-		if(m_SendHeader || m_LastLevel != lvl)
-		{
-			m_SendHeader = false;
-			m_LastLevel = lvl;
-			pHdr = lvl_names[lvl];
-			m_Col = 0;
-		}
-		size_t bitval = (1 << lvl);
-		size_t repeat = 1;
-		if(ch == '\t')
-		{
-			ch = ' ';
-			repeat = m_Col % 4;
-			if (repeat == 0)
-				repeat = 4;
-		}
-		while(repeat--)
+		const size_t bitval = (1 << lvl);
+		unsigned sinks = 0;
+		if(m_Fd >= 0 && (m_MaskFile & bitval) != 0)
+			sinks |= skFile;
+		if(bitval & m_MaskStdErr)
+			sinks |= skStdErr;
+		else if(bitval & m_MaskStdOut)
+			sinks |= skStdOut;
+		if(sinks == 0)
+			return;
+		std::call_once(m_Started, [this]() { m_Thread = std::thread(&OutputSingleton::Run, this); });
+		LogRecord *rec = new LogRecord;
+		rec->m_Next.store(NULL, std::memory_order_relaxed);
+		rec->m_Level = lvl;
+		rec->m_Sinks = sinks;
+		rec->m_Time = std::time(nullptr);
+		rec->m_Text.swap(text);
+		LogRecord *prev = m_Head.exchange(rec, std::memory_order_acq_rel);
+		prev->m_Next.store(rec, std::memory_order_release);
+		m_Pushed.fetch_add(1);
+		if(m_Idle.load())
 		{
-			if(m_pFile && (m_MaskFile & bitval) != 0)
-			{
-				if(pHdr)
-				{
-					char buf[256];
-					std::time_t t = std::time(nullptr);
-					std::strftime(buf, sizeof(buf), "%x %X ", std::localtime(&t));
-					fputs(buf, m_pFile);
-					fputs(pHdr, m_pFile);
-				}
-				fputc(ch, m_pFile);
-				// flush
-				if(ch == '\n')
-					fflush(m_pFile);
-			}
-			if(bitval & m_MaskStdErr)
-			{
-				if(pHdr)
-					fputs(pHdr, stderr);
-				fputc(ch, stderr);
-			}
-			else if(bitval & m_MaskStdOut)
-			{
-				if(pHdr)
-					fputs(pHdr, stdout);
-				fputc(ch, stdout);
-			}
-			// Start with a new line header
-			if(ch == '\n')
-				m_SendHeader = true;
-			++m_Col;
-			pHdr = NULL;
+			std::lock_guard<std::mutex> lock(m_Lock);
+			m_Wake.notify_one();
 		}
 	}
 
+	// Waits until all queued lines are written
+	void Flush()
+	{
+		const uint64_t target = m_Pushed.load();
+		std::unique_lock<std::mutex> lock(m_Lock);
+		m_Done.wait(lock, [&]() { return m_Written.load() >= target; });
+	}
+
 	bool IsLevelActive(LogType_e lvl) const
 	{
 		size_t bitval = (1 << lvl);
 		if((bitval & m_MaskStdErr) || (bitval & m_MaskStdOut))
 			return true;
-		return ((m_pFile != NULL) && (bitval & m_MaskFile));
+		return ((m_Fd >= 0) && (bitval & m_MaskFile));
 	}
 
 	void SetVerbosityLevel(size_t level)
@@ -165,52 +177,237 @@ public:
 
 	bool SetLogFile(const char *name)
 	{
-		m_pFile = fopen(name, "a");
-		return m_pFile != NULL;
+		// Lines queued for the previous file are written first
+		Flush();
+		CloseFile();
+		m_Fd = open(name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+		return m_Fd >= 0;
 	}
 
 protected:
-	FILE *m_pFile;
-	size_t m_MaskFile;
-	size_t m_MaskStdErr;
-	size_t m_MaskStdOut;
-	bool m_SendHeader;
-	LogType_e m_LastLevel;
-	int m_Col;
+	// Oldest record or NULL; also NULL while a producer is half way
+	LogRecord *Pop()
+	{
+		LogRecord *tail = m_Tail;
+		LogRecord *next = tail->m_Next.load(std::memory_order_acquire);
+		if(tail == &m_Stub)
+		{
+			if(next == NULL)
+				return NULL;
+			m_Tail = tail = next;
+			next = next->m_Next.load(std::memory_order_acquire);
+		}
+		if(next)
+		{
+			m_Tail = next;
+			return tail;
+		}
+		if(tail != m_Head.load(std::memory_order_acquire))
+			return NULL;
+		// Last record; the stub takes its place
+		m_Stub.m_Next.store(NULL, std::memory_order_relaxed);
+		LogRecord *prev = m_Head.exchange(&m_Stub, std::memory_order_acq_rel);
+		prev->m_Next.store(&m_Stub, std::memory_order_release);
+		next = tail->m_Next.load(std::memory_order_acquire);
+		if(next)
+		{
+			m_Tail = next;
+			return tail;
+		}
+		return NULL;
+	}
+
+	// Header of the log file, formatted once per second
+	const std::string &GetTimeStamp(time_t t)
+	{
+		if(t != m_TimeSec)
+		{
+			char buf[256];
+			std::strftime(buf, sizeof(buf), "%x %X ", std::localtime(&t));
+			m_TimeStr = buf;
+			m_TimeSec = t;
+		}
+		return m_TimeStr;
+	}
+
+	static void WriteAll(int fd, const std::string &buf)
+	{
+		for(size_t ofs = 0; ofs < buf.size(); )
+		{
+			ssize_t n = write(fd, buf.data() + ofs, buf.size() - ofs);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				break;
+			ofs += n;
+		}
+	}
+
+	void Run()
+	{
+		static const char *lvl_names[] =
+		{
+			"DEBUG: ",
+			"INFO:  ",
+			"WARN:  ",
+			"ERROR: ",
+		};
+		std::string file, console;
+		int console_fd = -1;
+		for(;;)
+		{
+			// Batch everything available into one write per output
+			uint64_t count = 0;
+			while(LogRecord *rec = Pop())
+			{
+				const char *hdr = lvl_names[rec->m_Level];
+				if(rec->m_Sinks & skFile)
+					file.append(GetTimeStamp(rec->m_Time)).append(hdr).append(rec->m_Text);
+				if(rec->m_Sinks & (skStdErr | skStdOut))
+				{
+					// stderr and stdout often share a terminal; keep their lines in order
+					const int fd = (rec->m_Sinks & skStdErr) ? STDERR_FILENO : STDOUT_FILENO;
+					if(fd != console_fd && !console.empty())
+					{
+						WriteAll(console_fd, console);
+						console.clear();
+					}
+					console_fd = fd;
+					console.append(hdr).append(rec->m_Text);
+				}
+				delete rec;
+				++count;
+			}
+			if(count)
+			{
+				if(!file.empty() && m_Fd >= 0)
+					WriteAll(m_Fd, file);
+				if(!console.empty())
+					WriteAll(console_fd, console);
+				file.clear();
+				console.clear();
+				std::lock_guard<std::mutex> lock(m_Lock);
+				m_Written.fetch_add(count);
+				m_Done.notify_all();
+				continue;
+			}
+			// A producer is linking its record
+			if(m_Pushed.load() != m_Written.load())
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_Lock);
+			m_Idle.store(true);
+			m_Wake.wait(lock, [this]() { return m_Stop || m_Pushed.load() != m_Written.load(); });
+			m_Idle.store(false);
+			if(m_Stop && m_Pushed.load() == m_Written.load())
+				break;
+		}
+	}
+
+protected:
+	std::atomic<int> m_Fd;
+	std::atomic<size_t> m_MaskFile;
+	std::atomic<size_t> m_MaskStdErr;
+	std::atomic<size_t> m_MaskStdOut;
+	// Producers append at the head, the writer takes from the tail
+	std::atomic<LogRecord *> m_Head;
+	LogRecord *m_Tail;
+	LogRecord m_Stub;
+	std::atomic<uint64_t> m_Pushed;
+	std::atomic<uint64_t> m_Written;
+	std::atomic<bool> m_Idle;
+	bool m_Stop;
+	std::mutex m_Lock;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Done;
+	std::once_flag m_Started;
+	std::thread m_Thread;
+	// Writer thread only
+	time_t m_TimeSec;
+	std::string m_TimeStr;
 };
 
 
 static OutputSingleton s_Singleton;
 
 
+// Collects the characters of a thread until a line is complete. There is
+// no put area: ostream::put() would not report the line feed otherwise.
 class LoggerBuffer : public std::streambuf
 {
 public:
-	LoggerBuffer(LogType_e lvl) : m_Level(lvl) { }
+	LoggerBuffer(LogType_e lvl)
+		: m_Level(lvl)
+		, m_Col(0)
+	{
+	}
+	~LoggerBuffer()
+	{
+		// Unterminated text of an exiting thread
+		if(!m_Line.empty())
+			s_Singleton.Push(m_Level, m_Line);
+	}
 
 protected:
-	virtual int_type overflow (int_type c = traits_type::eof()) override;
-	LogType_e m_Level;
-};
+	virtual int_type overflow(int_type c = traits_type::eof()) override
+	{
+		if(c != traits_type::eof())
+		{
+			const char ch = (char)c;
+			Append(&ch, 1);
+		}
+		return traits_type::not_eof(c);
+	}
+	virtual std::streamsize xsputn(const char *s, std::streamsize n) override
+	{
+		Append(s, n);
+		return n;
+	}
 
+	void Append(const char *s, std::streamsize n)
+	{
+		for(const char *end = s + n; s < end; ++s)
+		{
+			if(*s == '\t')
+			{
+				// Same expansion as the former character output
+				size_t repeat = m_Col % 4;
+				if(repeat == 0)
+					repeat = 4;
+				m_Line.append(repeat, ' ');
+				m_Col += repeat;
+				continue;
+			}
+			m_Line += *s;
+			++m_Col;
+			if(*s == '\n')
+			{
+				s_Singleton.Push(m_Level, m_Line);
+				m_Line.clear();
+				m_Col = 0;
+			}
+		}
+	}
 
-std::streambuf::int_type LoggerBuffer::overflow (std::streambuf::int_type c)
-{
-	s_Singleton.Put(m_Level, c);
-	return c;
+protected:
+	LogType_e m_Level;
+	size_t m_Col;
+	std::string m_Line;
 };
 
 
 std::ostream &Log(LogType_e lvl)
 {
-	static LoggerBuffer debug_buf(DEBUG);
-	static std::ostream debug(&debug_buf);
-	static LoggerBuffer info_buf(INFO);
-	static std::ostream info(&info_buf);
-	static LoggerBuffer warn_buf(WARN);
-	static std::ostream warn(&warn_buf);
-	static LoggerBuffer err_buf(ERROR);
-	static std::ostream err(&err_buf);
+	static thread_local LoggerBuffer debug_buf(DEBUG);
+	static thread_local std::ostream debug(&debug_buf);
+	static thread_local LoggerBuffer info_buf(INFO);
+	static thread_local std::ostream info(&info_buf);
+	static thread_local LoggerBuffer warn_buf(WARN);
+	static thread_local std::ostream warn(&warn_buf);
+	static thread_local LoggerBuffer err_buf(ERROR);
+	static thread_local std::ostream err(&err_buf);
 
 	switch(lvl)
 	{
@@ -226,6 +423,22 @@ std::ostream &Log(LogType_e lvl)
 }
 
 
+Fmt::Fmt(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(m_Buf, sizeof(m_Buf), fmt, args);
+	va_end(args);
+	m_Len = n < 0 ? 0 : std::min((size_t)n, sizeof(m_Buf) - 1);
+}
+
+
+std::ostream &operator<<(std::ostream &strm, const Fmt &fmt)
+{
+	return strm.write(fmt.c_str(), fmt.size());
+}
+
+
 bool IsLogLevelActive(LogType_e lvl)
 {
 	return s_Singleton.IsLevelActive(lvl);
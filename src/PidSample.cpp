@@ -1,11 +1,9 @@
 #include "StdInc.hpp"
 #include "PidSample.hpp"
+#include "History.hpp"
+#include "WorkPool.hpp"
+#include "Profiler.hpp"
 #include "Log.hpp"
-extern "C"
-{
-#include <sys/types.h>
-#include <sys/sysctl.h>
-}
 
 
 using namespace grumat;
@@ -29,6 +27,7 @@ void Diff::Print(std::ostream &strm, uint64_t tm_ticks) const
 
 Sample::Sample()
 	: m_Pid(0)
+	, m_StartTime(0)
 	, m_CpuTime(0)
 	, m_SysTime(0)
 	, m_DiskReadBytes(0)
@@ -37,22 +36,16 @@ Sample::Sample()
 }
 
 
-Sample::Sample(pid_t pid, const grumat::StringArray &cmd_line)
+Sample::Sample(pid_t pid, const grumat::StringArray &cmd_line, ProcSource &src)
 	: m_Pid(pid)
+	, m_StartTime(0)
 	, m_Argv(cmd_line)
 	, m_CpuTime(0)
 	, m_SysTime(0)
 	, m_DiskReadBytes(0)
 	, m_DiskWriteBytes(0)
 {
-	rusage_info_current rusage;
-	if(proc_pid_rusage(pid, RUSAGE_INFO_CURRENT, (void **)&rusage) == 0)
-	{
-		m_CpuTime = rusage.ri_user_time > 0 ? rusage.ri_user_time : 1;
-		m_SysTime = rusage.ri_system_time;
-		m_DiskReadBytes = rusage.ri_diskio_bytesread;
-		m_DiskWriteBytes = rusage.ri_diskio_byteswritten;
-	}
+	src.ReadSample(*this);
 }
 
 
@@ -61,7 +54,9 @@ Sample::Sample(const Sample &o)
 	if(this != &o)
 	{
 		m_Pid = o.m_Pid;
+		m_StartTime = o.m_StartTime;
 		m_Argv = o.m_Argv;
+		m_Service = o.m_Service;
 		m_CpuTime = o.m_CpuTime;
 		m_SysTime = o.m_SysTime;
 		m_DiskReadBytes = o.m_DiskReadBytes;
@@ -72,8 +67,13 @@ Sample::Sample(const Sample &o)
 
 void Sample::Print(std::ostream &strm, uint64_t tm_ticks) const
 {
-	strm << "Pid = " << m_Pid << '\n'
-		<< '\t' << "Path        = " << m_Argv[0] << std::endl
+	strm << "Pid = " << m_Pid << '\n';
+	// Descendants are sampled without command line
+	if(m_Argv.empty())
+		strm << '\t' << "Service     = " << m_Service << std::endl;
+	else
+		strm << '\t' << "Path        = " << m_Argv[0] << std::endl;
+	strm
 		<< '\t' << "CPU Time    = " << m_CpuTime << " ticks\n"
 		<< '\t' << "Kernel Time = " << m_SysTime << " ticks\n"
 		<< '\t' << "Total Time  = " << std::fixed << std::setprecision(1) << std::setw(3) << GetRelativeTime(tm_ticks) << " %\n"
@@ -115,6 +115,9 @@ void Sample::ToJson(Json::Value &obj) const
 	obj["SysTime"] = Json::Value(m_SysTime);
 	obj["DiskReadBytes"] = Json::Value(m_DiskReadBytes);
 	obj["DiskWriteBytes"] = Json::Value(m_DiskWriteBytes);
+	obj["StartTime"] = Json::Value(m_StartTime);
+	if(!m_Service.empty())
+		obj["Service"] = m_Service;
 }
 
 
@@ -123,14 +126,15 @@ bool Sample::FromJson(const Json::Value &obj)
 	// PID
 	if(!obj.isMember("pid"))
 	{
-		Log(ERROR) << "Object has no 'pid' member!\n";
+		LOG(ERROR) << "Object has no 'pid' member!\n";
 		return false;
 	}
-	m_Pid = obj["pid"].asUInt();
+	// Negative for cgroup samples
+	m_Pid = obj["pid"].asInt();
 	// Path member
 	if(!obj.isMember("CmdLine"))
 	{
-		Log(ERROR) << "Object PID:" << m_Pid << " has no 'CmdLine' member!\n";
+		LOG(ERROR) << "Object PID:" << m_Pid << " has no 'CmdLine' member!\n";
 		return false;
 	}
 	const Json::Value &arr = obj["CmdLine"];
@@ -140,233 +144,538 @@ bool Sample::FromJson(const Json::Value &obj)
 	// CpuTime member
 	if(!obj.isMember("CpuTime"))
 	{
-		Log(ERROR) << "Object PID:" << m_Pid << " has no 'CpuTime' member!\n";
+		LOG(ERROR) << "Object PID:" << m_Pid << " has no 'CpuTime' member!\n";
 		return false;
 	}
 	m_CpuTime = obj["CpuTime"].asUInt64();
 	// SysTime member
 	if(!obj.isMember("SysTime"))
 	{
-		Log(ERROR) << "Object PID:" << m_Pid << " has no 'SysTime' member!\n";
+		LOG(ERROR) << "Object PID:" << m_Pid << " has no 'SysTime' member!\n";
 		return false;
 	}
 	m_SysTime = obj["SysTime"].asUInt64();
 	// DiskReadBytes member
 	if(!obj.isMember("DiskReadBytes"))
 	{
-		Log(ERROR) << "Object PID:" << m_Pid << " has no 'DiskReadBytes' member!\n";
+		LOG(ERROR) << "Object PID:" << m_Pid << " has no 'DiskReadBytes' member!\n";
 		return false;
 	}
 	m_DiskReadBytes = obj["DiskReadBytes"].asUInt64();
 	// DiskWriteBytes member
 	if(!obj.isMember("DiskWriteBytes"))
 	{
-		Log(ERROR) << "Object PID:" << m_Pid << " has no 'DiskWriteBytes' member!\n";
+		LOG(ERROR) << "Object PID:" << m_Pid << " has no 'DiskWriteBytes' member!\n";
 		return false;
 	}
 	m_DiskWriteBytes = obj["DiskWriteBytes"].asUInt64();
+	// Optional; records of older versions lack it
+	m_StartTime = obj.isMember("StartTime") ? obj["StartTime"].asUInt64() : 0;
+	m_Service = obj.isMember("Service") ? obj["Service"].asString() : std::string();
 	return true;
 }
 
 
+// Match whose counters are read later, with the others; a known 'start'
+// lets the read detect a recycled pid
+static Sample MakeUnread(pid_t pid, uint64_t start, const StringArray &argv)
+{
+	Sample samp;
+	samp.m_Pid = pid;
+	samp.m_StartTime = start;
+	samp.m_Argv = argv;
+	return samp;
+}
+
+
 SampleSet::SampleSet()
 	: m_Clock(0)
 {
 }
 
 
-SampleSet::SampleSet(const AppConfig &config)
-	: m_Clock(clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW))
+SampleSet::SampleSet(const AppConfig &config, ProcSource &src, ArgvCache *cache)
+	: m_Clock(src.GetClock())
+{
+	// Cost is O(services) when all sections use cgroups
+	if(config.NeedsScan())
+		Scan(config, src, cache, NULL);
+	if(config.HasCgroups())
+		AddCgroups(config, src, NULL);
+}
+
+
+void SampleSet::Rescan(const SampleSet &prev, const AppConfig &config, ProcSource &src, ArgvCache *cache)
+{
+	m_Clock = src.GetClock();
+	m_Samples.clear();
+	m_Pid2Cfg.clear();
+	if(config.NeedsScan())
+		Scan(config, src, cache, &prev);
+	if(config.HasCgroups())
+		AddCgroups(config, src, &prev);
+	CarryReadClocks(prev);
+}
+
+
+void SampleSet::CarryReadClocks(const SampleSet &prev)
+{
+	m_ReadClocks.clear();
+	if(m_Due.empty())
+		return;
+	m_ReadClocks.resize(m_Due.size());
+	for(size_t i = 0; i < m_Due.size(); ++i)
+		m_ReadClocks[i] = m_Due[i] ? m_Clock : prev.GetReadClock(i);
+}
+
+
+const Sample *SampleSet::GetCarried(const SampleSet *prev, size_t icfg, pid_t pid, uint64_t start) const
+{
+	if(prev == NULL || IsDue(icfg))
+		return NULL;
+	Pid2Cfg_t::const_iterator cfg = prev->m_Pid2Cfg.find(pid);
+	if(cfg == prev->m_Pid2Cfg.end() || cfg->second != icfg)
+		return NULL;
+	const Sample &samp = prev->m_Samples.at(pid);
+	// A recycled pid is a new process
+	if(start && samp.m_StartTime && samp.m_StartTime != start)
+		return NULL;
+	return &samp;
+}
+
+
+void SampleSet::Scan(const AppConfig &config, ProcSource &src, ArgvCache *cache, const SampleSet *prev)
 {
+	typedef std::vector<std::pair<pid_t, ArgvCache::Entry> > CacheList_t;
+
 	m_Samples.clear();
 	m_Pid2Cfg.clear();
 	std::vector<pid_t> pids;
-	// Number of pids
-	int nProcs = proc_listpids(PROC_ALL_PIDS, 0, NULL, 0);
-	do
 	{
-		// Also reserve space for new arrivals
-		pids.resize(nProcs + 128);
-		// Load all pids
-		nProcs = proc_listpids(PROC_ALL_PIDS, 0, pids.data(), nProcs * sizeof(pids));
-	} while ((size_t)nProcs > pids.size());		// keep trying if not enough space
-	pids.resize(nProcs);
-	// Search for full paths
-	for(size_t i = 0; i < pids.size(); ++i)
+		ProfileScope prof(phEnumerate);
+		if(!src.ListPids(pids))
+			return;
+	}
+	// Each worker collects its matches on a private buffer
+	std::vector<Matches_t> found(WorkPool::GetThreadCount(config.m_Threads, pids.size()));
+	std::vector<CacheList_t> seen(cache ? found.size() : 0);
+	// Argument buffers are reused by each worker
+	std::vector<ArgvView> views(found.size());
+	const size_t max_args = config.GetArgCount();
+	// Parent of every process, collected on the same pass
+	const bool tree = config.HasChildren();
+	std::vector<Parents_t> parents(tree ? found.size() : 0);
+	WorkPool::GetDefault().Run(pids.size(), found.size(), [&](size_t worker, size_t i)
 	{
 		if (pids[i] == 0)
-			continue;
+			return;
 		pid_t pid = pids[i];
+		ProfileScope prof(phEnumerate);
+		ArgvCache::Entry e;
+		e.m_StartTime = 0;
+		e.m_ExecId = 0;
+		ProcInfo info;
+		if(cache || tree)
+		{
+			if(!src.GetProcInfo(info, pid))
+				return;
+			if(tree)
+				parents[worker].emplace_back(pid, info.m_PPid);
+		}
+		if(cache)
+		{
+			// Known process: reuse the previous matching result
+			const ArgvCache::Entry *hit = cache->Find(pid, info.m_StartTime, info.m_ExecId);
+			if(hit)
+			{
+				if(hit->m_Cfg != (size_t)-1)
+				{
+					prof.Switch(phSample);
+					const Sample *old = GetCarried(prev, hit->m_Cfg, pid, info.m_StartTime);
+					found[worker].emplace_back(hit->m_Cfg, old ? *old : MakeUnread(pid, info.m_StartTime, hit->m_Argv));
+				}
+				seen[worker].emplace_back(pid, *hit);
+				return;
+			}
+			e.m_StartTime = info.m_StartTime;
+			e.m_ExecId = info.m_ExecId;
+		}
 		// Match configuration
+		ArgvView &view = views[worker];
 		StringArray argv;
-		if(GetArgv(argv, pid))
+		size_t icfg = (size_t)-1;
+		prof.Switch(phArgv);
+		if(src.GetArgvView(view, pid, max_args))
 		{
-			size_t icfg = config.MatchName(argv);
+			prof.Switch(phMatch);
+			icfg = config.MatchName(view.GetData(), view.GetCount());
 			if(icfg != (size_t)-1)
 			{
-				m_Samples[pid] = Sample(pid, argv);
-				m_Pid2Cfg[pid] = icfg;
+				// History keeps the whole command line of matched processes
+				prof.Switch(phArgv);
+				if(!view.m_Truncated || !src.GetArgv(argv, pid))
+					argv = view.ToArray();
+				prof.Switch(phSample);
+				const uint64_t start = (cache || tree) ? info.m_StartTime : 0;
+				const Sample *old = GetCarried(prev, icfg, pid, start);
+				found[worker].emplace_back(icfg, old ? *old : MakeUnread(pid, start, argv));
 			}
 		}
+		if(cache)
+		{
+			// Negative results are also cached; argv is kept for the history
+			e.m_Cfg = icfg;
+			if(icfg != (size_t)-1)
+				e.m_Argv.swap(argv);
+			seen[worker].emplace_back(pid, e);
+		}
+	});
+	// Merge; maps are keyed by pid so the result does not depend on scheduling
+	MergeMatches(found, config, src);
+	if(tree)
+		AddDescendants(config, src, parents, prev);
+	// Cache is replaced by the live processes only
+	if(cache)
+	{
+		cache->m_Entries.clear();
+		for(size_t w = 0; w < seen.size(); ++w)
+		{
+			for(CacheList_t::iterator it = seen[w].begin(); it != seen[w].end(); ++it)
+				cache->m_Entries.emplace(it->first, std::move(it->second));
+		}
 	}
 }
 
 
-bool SampleSet::GetArgv(StringArray &res, pid_t pid)
+void SampleSet::AddCgroups(const AppConfig &config, ProcSource &src, const SampleSet *prev)
 {
-	typedef std::vector<uint8_t> Buffer_t;
-	try
+	ProfileScope prof(phSample);
+	for(size_t i = 0; i < config.m_Procs.size(); ++i)
 	{
-		res.clear();
-
-		int mib[3];
-
-		size_t args_size_estimate = 0;
-		mib[0] = CTL_KERN;
-		mib[1] = KERN_ARGMAX;
-		mib[2] = 0;		//unused
-		// Get estimate buffer size
-		size_t bufsize = sizeof(args_size_estimate);
-		int rv = sysctl(mib, 2, &args_size_estimate, &bufsize, NULL, 0);
-		if (rv == -1)
+		const ProcessConfig &proc = config.m_Procs[i];
+		if(proc.m_Cgroup.empty())
+			continue;
+		const Sample *old = GetCarried(prev, i, GetCgroupPid(i), 0);
+		if(old)
 		{
-			Log(WARN) << "System call CTL_KERN/KERN_ARGMAX failed with error code " << errno << " (pid=" << pid << ")\n";
-			return false;
+			m_Samples[old->m_Pid] = *old;
+			m_Pid2Cfg[old->m_Pid] = i;
+			continue;
 		}
+		Sample samp;
+		samp.m_Pid = GetCgroupPid(i);
+		samp.m_Service = proc.m_Name;
+		// No cgroup: the service is not running
+		if(!src.ReadCgroup(samp, proc.m_Cgroup.c_str()))
+			continue;
+		m_Samples[samp.m_Pid] = samp;
+		m_Pid2Cfg[samp.m_Pid] = i;
+	}
+}
 
-		/* Allocate space for the arguments. */
-		Buffer_t argsBuf(args_size_estimate);
-
-		mib[0] = CTL_KERN;
-		mib[1] = KERN_PROCARGS2;
-		mib[2] = pid;
 
-		bufsize = argsBuf.size();
-		rv = sysctl(mib, 3, argsBuf.data(), &bufsize, NULL, 0);
-		if (rv == -1
-			&& errno != EINVAL)
-		{
-			if(errno != ESRCH)
-				Log(WARN) << "System call CTL_KERN/KERN_PROCARGS2 failed with error code " << errno << " (pid=" << pid << ")\n";
-			return false;
-		}
-		// Failure (privilege)
-		if (rv == -1)
+void SampleSet::AddDescendants(const AppConfig &config, ProcSource &src, std::vector<Parents_t> &parents, const SampleSet *prev)
+{
+	ProfileScope prof(phMatch);
+	std::unordered_map<pid_t, pid_t> ppids;
+	for(size_t w = 0; w < parents.size(); ++w)
+		ppids.insert(parents[w].begin(), parents[w].end());
+	// Service inherited by each pid; the nearest matched ancestor decides
+	std::unordered_map<pid_t, size_t> owner;
+	owner.reserve(ppids.size());
+	for(Pid2Cfg_t::const_iterator it = m_Pid2Cfg.begin(); it != m_Pid2Cfg.end(); ++it)
+		owner[it->first] = config.m_Procs[it->second].m_Children ? it->second : (size_t)-1;
+	// Each pid is resolved once, so the cost is linear
+	std::vector<pid_t> chain;
+	std::vector<std::pair<pid_t, size_t> > todo;
+	for(std::unordered_map<pid_t, pid_t>::const_iterator it = ppids.begin(); it != ppids.end(); ++it)
+	{
+		if(owner.count(it->first))
+			continue;
+		chain.clear();
+		size_t icfg = (size_t)-1;
+		for(pid_t pid = it->first; ; )
 		{
-			// User has no privilege, only argv[0] can be retrieved
-			char pathBuffer[PROC_PIDPATHINFO_MAXSIZE];
-			bzero(pathBuffer, PROC_PIDPATHINFO_MAXSIZE);
-			if(proc_pidpath(pid, pathBuffer, sizeof(pathBuffer)) == 0)
+			std::unordered_map<pid_t, size_t>::const_iterator o = owner.find(pid);
+			if(o != owner.end())
 			{
-				if(errno != ESRCH)
-					Log(WARN) << "Call to proc_pidpath() failed with error code " << errno << " (pid=" << pid << ")\n";
-				return false;
+				icfg = o->second;
+				break;
 			}
-			res.push_back(pathBuffer);
-			return true;
+			chain.push_back(pid);
+			std::unordered_map<pid_t, pid_t>::const_iterator pp = ppids.find(pid);
+			// Reached the root; a racy snapshot may also loop
+			if(pp == ppids.end() || pp->second <= 0 || chain.size() > ppids.size())
+				break;
+			pid = pp->second;
 		}
-
-		/*
-		** Make a sysctl() call to get the raw argument space of the process.
-		** The layout is documented in start.s, which is part of the Csu
-		** project.  In summary, it looks like:
-		**
-		** /---------------\ 0x00000000
-		** :               :
-		** :               :
-		** |---------------|
-		** | argc          |
-		** |---------------|
-		** | arg[0]        |
-		** |---------------|
-		** :               :
-		** :               :
-		** |---------------|
-		** | arg[argc - 1] |
-		** |---------------|
-		** | 0             |
-		** |---------------|
-		** | env[0]        |
-		** |---------------|
-		** :               :
-		** :               :
-		** |---------------|
-		** | env[n]        |
-		** |---------------|
-		** | 0             |
-		** |---------------| <-- Beginning of data returned by sysctl() is here.
-		** | argc          |
-		** |---------------|
-		** | exec_path     |
-		** |:::::::::::::::|
-		** |               |
-		** | String area.  |
-		** |               |
-		** |---------------| <-- Top of stack.
-		** :               :
-		** :               :
-		** \---------------/ 0xffffffff
-		*/
-
-		const uint8_t * const procargs = argsBuf.data();
-		size_t nargs = *(uint32_t*)procargs;
-		const uint8_t *cp = procargs + sizeof(uint32_t);
-		const uint8_t *maxp = &argsBuf.back();
-
-		/* Skip the saved exec_path. */
-		String exe;
-		while ((*cp != 0) && (cp < maxp))
-			exe += *cp++;
-		if (cp == maxp)
+		for(size_t i = 0; i < chain.size(); ++i)
+			owner[chain[i]] = icfg;
+		if(icfg != (size_t)-1)
+			todo.emplace_back(it->first, icfg);
+	}
+	// Workers time their own samples
+	prof.Stop();
+	if(todo.empty())
+		return;
+	std::vector<Sample> samps;
+	std::vector<size_t> cfgs;
+	for(size_t i = 0; i < todo.size(); ++i)
+	{
+		const Sample *old = GetCarried(prev, todo[i].second, todo[i].first, 0);
+		if(old)
 		{
-			Log(ERROR) << "Failed to parse the process path\n";
-			return false;
+			m_Samples[todo[i].first] = *old;
+			m_Pid2Cfg[todo[i].first] = todo[i].second;
+			continue;
 		}
+		samps.push_back(MakeUnread(todo[i].first, 0, StringArray()));
+		samps.back().m_Service = config.m_Procs[todo[i].second].m_Name;
+		cfgs.push_back(todo[i].second);
+	}
+	AddSamples(samps, cfgs, config, src);
+}
 
-		/* Skip trailing '\0' characters. */
-		do
+
+void SampleSet::MergeMatches(std::vector<Matches_t> &found, const AppConfig &config, ProcSource &src)
+{
+	std::vector<Sample> samps;
+	std::vector<size_t> cfgs;
+	for(size_t w = 0; w < found.size(); ++w)
+	{
+		for(Matches_t::iterator it = found[w].begin(); it != found[w].end(); ++it)
 		{
-			++cp;
-		} while ((*cp == 0) && (cp < maxp));
-		
-		if (cp >= maxp)
+			// Carried samples are complete
+			if(it->second.IsValid())
+			{
+				m_Pid2Cfg[it->second.m_Pid] = it->first;
+				m_Samples[it->second.m_Pid] = std::move(it->second);
+				continue;
+			}
+			samps.push_back(std::move(it->second));
+			cfgs.push_back(it->first);
+		}
+	}
+	AddSamples(samps, cfgs, config, src);
+}
+
+
+void SampleSet::AddSamples(std::vector<Sample> &samps, const std::vector<size_t> &cfgs, const AppConfig &config, ProcSource &src)
+{
+	if(samps.empty())
+		return;
+	std::vector<uint64_t> starts(samps.size());
+	std::vector<char> ok(samps.size(), 0);
+	// Read in batches, so backends can pipeline requests
+	const size_t kBatch = 64;
+	const size_t batches = (samps.size() + kBatch - 1) / kBatch;
+	WorkPool::GetDefault().Run(batches, WorkPool::GetThreadCount(config.m_Threads, batches), [&](size_t, size_t b)
+	{
+		ProfileScope prof(phSample);
+		const size_t from = b * kBatch;
+		const size_t cnt = std::min(kBatch, samps.size() - from);
+		for(size_t i = from; i < from + cnt; ++i)
+			starts[i] = samps[i].m_StartTime;
+		src.ReadSamples(&samps[from], cnt, &ok[from]);
+	});
+	for(size_t i = 0; i < samps.size(); ++i)
+	{
+		// Exited meanwhile or pid recycled by another process
+		if(!ok[i] || (starts[i] && samps[i].m_StartTime != starts[i]))
+			continue;
+		const pid_t pid = samps[i].m_Pid;
+		m_Pid2Cfg[pid] = cfgs[i];
+		m_Samples[pid] = std::move(samps[i]);
+	}
+}
+
+
+void SampleSet::Resample(const SampleSet &prev, const AppConfig &config, ProcSource &src)
+{
+	m_Clock = src.GetClock();
+	m_Samples.clear();
+	m_Pid2Cfg.clear();
+	// No matching nor argv retrieval; only the counters are read
+	std::vector<Sample> samps;
+	std::vector<size_t> cfgs;
+	samps.reserve(prev.m_Samples.size());
+	cfgs.reserve(prev.m_Samples.size());
+	for(SampleSet_t::const_iterator it = prev.m_Samples.begin(); it != prev.m_Samples.end(); ++it)
+	{
+		const size_t icfg = prev.m_Pid2Cfg.at(it->first);
+		if(!IsDue(icfg))
 		{
-			Log(ERROR) << "Failed to locate the first argument\n";
-			return false;
+			m_Samples.emplace(*it);
+			m_Pid2Cfg.emplace(it->first, icfg);
 		}
-		/*
-		** Iterate through the '\0'-terminated strings and convert '\0' to ' '
-		** until a string is found that has a '=' character in it (or there are
-		** no more strings in procargs).  There is no way to deterministically
-		** know where the command arguments end and the environment strings
-		** start, which is why the '=' character is searched for as a heuristic.
-		*/
-		while (res.size() < nargs)
+		else if(it->first < 0)
 		{
-			if(cp >= maxp)
+			ProfileScope prof(phSample);
+			Sample samp(it->second);
+			// A recreated cgroup has another inode
+			if(src.ReadCgroup(samp, config.m_Procs[icfg].m_Cgroup.c_str())
+				&& (it->second.m_StartTime == 0 || samp.m_StartTime == it->second.m_StartTime))
 			{
-				Log(ERROR) << "Buffer overflow while parsing arguments\n";
-				return false;
-			}
-			String s;
-			for (; *cp && cp < maxp; ++cp)
-				s += *cp;
-			if(res.empty())
-			{
-				res.push_back(exe);
-				// Scripts such as Python may fix the argv0 to remove shebang
-				if(exe != s)
-					res.push_back(s);
+				m_Samples.emplace(it->first, samp);
+				m_Pid2Cfg.emplace(it->first, icfg);
 			}
-			else
-				res.push_back(s);
-			++cp;
 		}
+		else
+		{
+			samps.push_back(it->second);
+			cfgs.push_back(icfg);
+		}
+	}
+	AddSamples(samps, cfgs, config, src);
+	CarryReadClocks(prev);
+}
+
+
+void SampleSet::Update(const SampleSet &prev, const AppConfig &config, const ProcEvents &events, ProcSource &src)
+{
+	// Known processes keep their configuration unless gone or exec'd
+	SampleSet keep;
+	keep.m_Clock = prev.m_Clock;
+	keep.m_ReadClocks = prev.m_ReadClocks;
+	for(SampleSet_t::const_iterator it = prev.m_Samples.begin(); it != prev.m_Samples.end(); ++it)
+	{
+		const pid_t pid = it->first;
+		if(pid < 0 || events.m_Exited.count(pid) || events.m_Started.count(pid))
+			continue;
+		keep.m_Samples.emplace_hint(keep.m_Samples.end(), *it);
+		keep.m_Pid2Cfg.emplace_hint(keep.m_Pid2Cfg.end(), pid, prev.m_Pid2Cfg.at(pid));
+	}
+	Resample(keep, config, src);
+	if(config.NeedsScan() && !events.m_Started.empty())
+		AddStarted(config, events, src);
+	if(config.HasCgroups())
+		AddCgroups(config, src, &prev);
+}
+
+
+void SampleSet::AddStarted(const AppConfig &config, const ProcEvents &events, ProcSource &src)
+{
+	const std::vector<pid_t> pids(events.m_Started.begin(), events.m_Started.end());
+	std::vector<Matches_t> found(WorkPool::GetThreadCount(config.m_Threads, pids.size()));
+	std::vector<ArgvView> views(found.size());
+	const size_t max_args = config.GetArgCount();
+	const bool tree = config.HasChildren();
+	std::vector<Parents_t> parents(tree ? found.size() : 0);
+	WorkPool::GetDefault().Run(pids.size(), found.size(), [&](size_t worker, size_t i)
+	{
+		const pid_t pid = pids[i];
+		ProfileScope prof(phEnumerate);
+		ProcInfo info;
+		info.m_StartTime = 0;
+		if(tree)
+		{
+			// Short-lived process already gone
+			if(!src.GetProcInfo(info, pid))
+				return;
+			parents[worker].emplace_back(pid, info.m_PPid);
+		}
+		ArgvView &view = views[worker];
+		prof.Switch(phArgv);
+		if(!src.GetArgvView(view, pid, max_args))
+			return;
+		prof.Switch(phMatch);
+		const size_t icfg = config.MatchName(view.GetData(), view.GetCount());
+		if(icfg == (size_t)-1)
+			return;
+		StringArray argv;
+		prof.Switch(phArgv);
+		if(!view.m_Truncated || !src.GetArgv(argv, pid))
+			argv = view.ToArray();
+		found[worker].emplace_back(icfg, MakeUnread(pid, info.m_StartTime, argv));
+	});
+	MergeMatches(found, config, src);
+	// Only new processes are resolved and read; known descendants were kept
+	// and other known processes own nothing, so chains stop at them
+	if(tree)
+		AddDescendants(config, src, parents, NULL);
+}
+
+
+size_t SampleSet::MapSample(const AppConfig &config, const Sample &samp)
+{
+	// Cgroup samples are keyed by their section
+	if(samp.m_Pid < 0)
+	{
+		const size_t icfg = config.FindService(samp.m_Service.c_str());
+		if(icfg == (size_t)-1 || config.m_Procs[icfg].m_Cgroup.empty() || GetCgroupPid(icfg) != samp.m_Pid)
+			return (size_t)-1;
+		return icfg;
 	}
-	catch(const std::exception& e)
+	size_t icfg = config.MatchName(samp.m_Argv);
+	// Descendants are mapped by the recorded service
+	if(icfg == (size_t)-1 && !samp.m_Service.empty())
 	{
-		Log(ERROR) << e.what() << '\n';
+		icfg = config.FindService(samp.m_Service.c_str());
+		if(icfg != (size_t)-1 && !config.m_Procs[icfg].m_Children)
+			icfg = (size_t)-1;
+	}
+	return icfg;
+}
+
+
+void SampleSet::MakeRecord(const AppConfig &config)
+{
+	if(config.m_HistoryFormat == AppConfig::hfJson)
+		MakeJsonRecord(config);
+	else
+		MakeBinaryRecord(config);
+}
+
+
+bool SampleSet::ReadRecord(const AppConfig &config)
+{
+	// JSON files are imported, regardless of the configured format
+	if(HistoryView::IsBinary(config.m_RecordFile.c_str()))
+		return ReadBinaryRecord(config);
+	return ReadJsonRecord(config);
+}
+
+
+void SampleSet::MakeBinaryRecord(const AppConfig &config)
+{
+	ProfileData prof;
+	if(Profiler::IsEnabled())
+		Profiler::GetData(prof);
+	HistoryView::Write(config.m_RecordFile.c_str(), *this, Profiler::IsEnabled() ? &prof : NULL);
+}
+
+
+bool SampleSet::ReadBinaryRecord(const AppConfig &config)
+{
+	m_Samples.clear();
+	m_Pid2Cfg.clear();
+	HistoryView view;
+	if(!view.Open(config.m_RecordFile.c_str()))
 		return false;
+	m_Clock = view.GetClock();
+	const size_t cnt = view.GetPidCount();
+	for(size_t i = 0; i < cnt; ++i)
+	{
+		const HistoryPid &e = view.GetPid(i);
+		Sample samp;
+		samp.m_Pid = e.m_Pid;
+		samp.m_StartTime = e.m_StartTime;
+		samp.m_Argv.reserve(e.m_ArgvCount);
+		for(size_t a = 0; a < e.m_ArgvCount; ++a)
+			samp.m_Argv.push_back(view.GetArg(e, a));
+		if(const char *svc = view.GetService(e))
+			samp.m_Service = svc;
+		samp.m_CpuTime = e.m_CpuTime;
+		samp.m_SysTime = e.m_SysTime;
+		samp.m_DiskReadBytes = e.m_DiskReadBytes;
+		samp.m_DiskWriteBytes = e.m_DiskWriteBytes;
+		// Map object
+		size_t icfg = MapSample(config, samp);
+		if(icfg != (size_t)-1)
+		{
+			m_Pid2Cfg[samp.m_Pid] = icfg;
+			m_Samples.emplace_hint(m_Samples.end(), samp.m_Pid, samp);
+		}
 	}
 	return true;
 }
@@ -387,6 +696,15 @@ void SampleSet::MakeJsonRecord(const AppConfig &config)
 		root[std::to_string(it->first)] = obj;
 	}
 	root["__pid_list__"] = array;
+	// Phases done so far; writing and evaluation are not included
+	if(Profiler::IsEnabled())
+	{
+		ProfileData prof;
+		Profiler::GetData(prof);
+		Json::Value obj(Json::objectValue);
+		prof.ToJson(obj);
+		root["__profile__"] = obj;
+	}
 	// Write the JSON object
 	std::ofstream strm(config.m_RecordFile);
 	if(strm.is_open())
@@ -409,70 +727,70 @@ bool SampleSet::ReadJsonRecord(const AppConfig &config)
 		std::string errs;
 		if(!Json::parseFromStream(rbuilder, strm, &root, &errs))
 		{
-			Log(ERROR) << errs << std::endl;
+			LOG(ERROR) << errs << std::endl;
 			return false;
 		}
 		if(!root.isObject())
 		{
-			Log(ERROR) << "Root element of JSON file should be an object!\n";
+			LOG(ERROR) << "Root element of JSON file should be an object!\n";
 			return false;
 		}
 		if(!root.isMember("__schema_version__"))
 		{
-			Log(ERROR) << "JSON file has no schema version!\n";
+			LOG(ERROR) << "JSON file has no schema version!\n";
 			return false;
 		}
 		uint32_t ver = root["__schema_version__"].asUInt();
 		if(ver != 2)
 		{
-			Log(ERROR) << "JSON file schema version " << ver << " cannot be handled\n";
+			LOG(ERROR) << "JSON file schema version " << ver << " cannot be handled\n";
 			return false;
 		}
 		if(!root.isMember("__SysClock__"))
 		{
-			Log(ERROR) << "JSON '__SysClock__' member not found!\n";
+			LOG(ERROR) << "JSON '__SysClock__' member not found!\n";
 			return false;
 		}
 		m_Clock = root["__SysClock__"].asUInt64();
 		if(!root.isMember("__pid_list__"))
 		{
-			Log(ERROR) << "JSON '__pid_list__' member not found!\n";
+			LOG(ERROR) << "JSON '__pid_list__' member not found!\n";
 			return false;
 		}
 		const Json::Value &array = root["__pid_list__"];
 		if(!array.isArray())
 		{
-			Log(ERROR) << "Element '__pid_list__' is not an array!\n";
+			LOG(ERROR) << "Element '__pid_list__' is not an array!\n";
 			return false;
 		}
 		const Json::ArrayIndex cnt = array.size();
 		for(Json::ArrayIndex i = 0; i < cnt; ++i)
 		{
 			// Array element is the process name
-			std::string pid = std::to_string(array[i].asUInt());
+			std::string pid = std::to_string(array[i].asInt());
 
 			// Locate member with this name
 			if(!root.isMember(pid))
 			{
-				Log(ERROR) << "JSON '" << pid << "' object not found!\n";
+				LOG(ERROR) << "JSON '" << pid << "' object not found!\n";
 				return false;
 			}
 			// Member must be an object
 			const Json::Value &obj = root[pid];
 			if(!obj.isObject())
 			{
-				Log(ERROR) << "JSON '" << pid << "' member is not an object!\n";
+				LOG(ERROR) << "JSON '" << pid << "' member is not an object!\n";
 				return false;
 			}
 			// Decode object
 			Sample samp;
 			if(!samp.FromJson(obj))
 			{
-				Log(WARN) << "    while processing object '" << pid << "'!\n";
+				LOG(WARN) << "    while processing object '" << pid << "'!\n";
 				return false;
 			}
 			// Map object
-			size_t icfg = config.MatchName(samp.m_Argv);
+			size_t icfg = MapSample(config, samp);
 			if(icfg != (size_t)-1)
 			{
 				m_Samples[samp.m_Pid] = samp;
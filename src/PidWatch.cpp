@@ -0,0 +1,213 @@
+#include "StdInc.hpp"
+#include "PidWatch.hpp"
+#include "Log.hpp"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+PidWatch::PidWatch()
+	: m_Poll(-1)
+	, m_Full(false)
+{
+}
+
+
+PidWatch::~PidWatch()
+{
+	Close();
+}
+
+
+void PidWatch::Close()
+{
+	for(Fds_t::const_iterator it = m_Fds.begin(); it != m_Fds.end(); ++it)
+		close(it->second);
+	m_Fds.clear();
+	m_Exited.clear();
+	if(m_Poll >= 0)
+	{
+		close(m_Poll);
+		m_Poll = -1;
+	}
+}
+
+
+size_t PidWatch::Drop(SampleSet &samps)
+{
+	size_t cnt = 0;
+	for(Pids_t::const_iterator it = m_Exited.begin(); it != m_Exited.end(); ++it)
+	{
+		if(samps.m_Samples.erase(*it))
+		{
+			samps.m_Pid2Cfg.erase(*it);
+			++cnt;
+		}
+	}
+	m_Exited.clear();
+	return cnt;
+}
+
+
+#if defined(__linux__) && defined(SYS_pidfd_open)
+
+
+static int OpenPidFd(pid_t pid)
+{
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+
+bool PidWatch::Open()
+{
+	Close();
+	m_Full = false;
+	// Probe the kernel with our own process
+	int fd = OpenPidFd(getpid());
+	if(fd < 0)
+	{
+		LOG(DEBUG) << "pidfd not supported (error code " << errno << ")\n";
+		return false;
+	}
+	close(fd);
+	m_Poll = epoll_create1(EPOLL_CLOEXEC);
+	if(m_Poll < 0)
+	{
+		LOG(DEBUG) << "Cannot create epoll instance (error code " << errno << ")\n";
+		return false;
+	}
+	return true;
+}
+
+
+void PidWatch::Unwatch(int fd)
+{
+	// Also removes it from the epoll set
+	close(fd);
+	m_Full = false;
+}
+
+
+void PidWatch::Sync(const SampleSet &samps, ProcSource &src)
+{
+	if(m_Poll < 0)
+		return;
+	for(Fds_t::iterator it = m_Fds.begin(); it != m_Fds.end(); )
+	{
+		if(samps.m_Samples.count(it->first))
+			++it;
+		else
+		{
+			Unwatch(it->second);
+			it = m_Fds.erase(it);
+		}
+	}
+	for(SampleSet::SampleSet_t::const_iterator it = samps.m_Samples.begin(); it != samps.m_Samples.end(); ++it)
+	{
+		const pid_t pid = it->first;
+		// Negative keys are cgroups
+		if(pid <= 0 || m_Full || m_Fds.count(pid))
+			continue;
+		int fd = OpenPidFd(pid);
+		if(fd < 0)
+		{
+			if(errno == ESRCH)
+				m_Exited.insert(pid);
+			else if(errno == EMFILE || errno == ENFILE)
+			{
+				LOG(WARN) << "Out of file descriptors; not all processes have a pidfd\n";
+				m_Full = true;
+			}
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		// The pid may have been recycled between the sample and the pidfd
+		ProcInfo info;
+		if(!src.GetProcInfo(info, pid)
+			|| (it->second.m_StartTime && info.m_StartTime != it->second.m_StartTime))
+		{
+			close(fd);
+			m_Exited.insert(pid);
+			continue;
+		}
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = pid;
+		if(epoll_ctl(m_Poll, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		m_Fds.emplace(pid, fd);
+	}
+}
+
+
+void PidWatch::Read()
+{
+	if(m_Poll < 0)
+		return;
+	struct epoll_event evs[64];
+	for(;;)
+	{
+		int n = epoll_wait(m_Poll, evs, 64, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			break;
+		for(int i = 0; i < n; ++i)
+		{
+			const pid_t pid = evs[i].data.fd;
+			Fds_t::iterator it = m_Fds.find(pid);
+			if(it == m_Fds.end())
+				continue;
+			Unwatch(it->second);
+			m_Fds.erase(it);
+			m_Exited.insert(pid);
+		}
+	}
+}
+
+
+#else
+
+
+bool PidWatch::Open()
+{
+	return false;
+}
+
+
+void PidWatch::Unwatch(int fd)
+{
+	close(fd);
+}
+
+
+void PidWatch::Sync(const SampleSet &samps, ProcSource &src)
+{
+	(void)samps;
+	(void)src;
+}
+
+
+void PidWatch::Read()
+{
+}
+
+
+#endif
+
+
+}	// PidSample
+
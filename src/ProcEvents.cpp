@@ -0,0 +1,185 @@
+#include "StdInc.hpp"
+#include "ProcEvents.hpp"
+#include "Log.hpp"
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+ProcEvents::ProcEvents()
+	: m_Socket(-1)
+	, m_Lost(false)
+{
+}
+
+
+ProcEvents::~ProcEvents()
+{
+	Close();
+}
+
+
+void ProcEvents::Close()
+{
+	if(m_Socket >= 0)
+	{
+		close(m_Socket);
+		m_Socket = -1;
+	}
+}
+
+
+void ProcEvents::Clear()
+{
+	m_Started.clear();
+	m_Exited.clear();
+	m_Lost = false;
+}
+
+
+void ProcEvents::OnStart(pid_t pid)
+{
+	m_Exited.erase(pid);
+	m_Started.insert(pid);
+}
+
+
+void ProcEvents::OnExit(pid_t pid)
+{
+	m_Started.erase(pid);
+	m_Exited.insert(pid);
+}
+
+
+#if defined(__linux__)
+
+
+bool ProcEvents::Open()
+{
+	Close();
+	Clear();
+	m_Socket = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if(m_Socket < 0)
+	{
+		LOG(DEBUG) << "Cannot create proc connector socket (error code " << errno << ")\n";
+		return false;
+	}
+	// Room for bursts of forks between two polls
+	int size = 4 * 1024 * 1024;
+	setsockopt(m_Socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	// Subscription message: netlink header, connector header and the operation
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))];
+	memset(buf, 0, sizeof(buf));
+	struct nlmsghdr *hdr = (struct nlmsghdr *)buf;
+	hdr->nlmsg_len = sizeof(buf);
+	hdr->nlmsg_type = NLMSG_DONE;
+	hdr->nlmsg_pid = getpid();
+	struct cn_msg *msg = (struct cn_msg *)NLMSG_DATA(hdr);
+	msg->id.idx = CN_IDX_PROC;
+	msg->id.val = CN_VAL_PROC;
+	msg->len = sizeof(enum proc_cn_mcast_op);
+	*(enum proc_cn_mcast_op *)msg->data = PROC_CN_MCAST_LISTEN;
+	if(bind(m_Socket, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| send(m_Socket, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf))
+	{
+		LOG(DEBUG) << "Cannot subscribe to the proc connector (error code " << errno << ")\n";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+void ProcEvents::Read()
+{
+	// Aligned for the netlink headers
+	uint64_t buf[8192];
+	for(;;)
+	{
+		struct sockaddr_nl from;
+		socklen_t len = sizeof(from);
+		ssize_t n = recvfrom(m_Socket, buf, sizeof(buf), 0, (struct sockaddr *)&from, &len);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			// Socket buffer overflowed: events are missing
+			if(errno == ENOBUFS)
+			{
+				m_Lost = true;
+				continue;
+			}
+			break;
+		}
+		// Only the kernel sends to the group
+		if(from.nl_pid != 0)
+			continue;
+		for(struct nlmsghdr *hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, (size_t)n); hdr = NLMSG_NEXT(hdr, n))
+		{
+			if(hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_OVERRUN)
+			{
+				m_Lost = true;
+				continue;
+			}
+			if(hdr->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event)))
+				continue;
+			const struct cn_msg *msg = (const struct cn_msg *)NLMSG_DATA(hdr);
+			if(msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+				continue;
+			const struct proc_event *ev = (const struct proc_event *)msg->data;
+			// Threads share the process counters and command line
+			switch(ev->what)
+			{
+			case proc_event::PROC_EVENT_FORK:
+				if(ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+					OnStart(ev->event_data.fork.child_tgid);
+				break;
+			case proc_event::PROC_EVENT_EXEC:
+				OnStart(ev->event_data.exec.process_tgid);
+				break;
+			case proc_event::PROC_EVENT_EXIT:
+				if(ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+					OnExit(ev->event_data.exit.process_tgid);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+
+#else
+
+
+bool ProcEvents::Open()
+{
+	return false;
+}
+
+
+void ProcEvents::Read()
+{
+}
+
+
+#endif
+
+
+}	// PidSample
+
@@ -0,0 +1,74 @@
+#include "StdInc.hpp"
+#include "ProcSource.hpp"
+#include "PidSample.hpp"
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+void ArgvView::Parse(const char *buf, size_t len, size_t max_args)
+{
+	Clear();
+	const char *cp = buf;
+	const char *maxp = buf + len;
+	while(cp < maxp)
+	{
+		if(m_Args.size() >= max_args)
+		{
+			m_Truncated = true;
+			break;
+		}
+		const char *eos = (const char *)memchr(cp, 0, maxp - cp);
+		if(eos == NULL)
+			eos = maxp;
+		m_Args.emplace_back(cp, eos - cp);
+		cp = eos + 1;
+	}
+}
+
+
+StringArray ArgvView::ToArray() const
+{
+	StringArray res;
+	res.reserve(m_Args.size());
+	for(size_t i = 0; i < m_Args.size(); ++i)
+		res.push_back(String(m_Args[i].data(), m_Args[i].size()));
+	return res;
+}
+
+
+uint64_t ProcSource::HashName(const char *name, size_t len)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < len; ++i)
+		hash = (hash ^ (uint8_t)name[i]) * 1099511628211ULL;
+	return hash;
+}
+
+
+void ProcSource::ReadSamples(Sample *samps, size_t count, char *ok)
+{
+	for(size_t i = 0; i < count; ++i)
+		ok[i] = ReadSample(samps[i]);
+}
+
+
+bool ProcSource::GetArgv(StringArray &res, pid_t pid)
+{
+	ArgvView view;
+	if(!GetArgvView(view, pid, (size_t)-1))
+	{
+		res.clear();
+		return false;
+	}
+	res = view.ToArray();
+	return true;
+}
+
+
+}	// PidSample
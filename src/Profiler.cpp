@@ -0,0 +1,182 @@
+#include "StdInc.hpp"
+#include "Profiler.hpp"
+#include "AllocStats.hpp"
+#include "Log.hpp"
+#include <atomic>
+#include <sys/resource.h>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+bool Profiler::s_Enabled = false;
+
+// Scopes run concurrently on the workers
+static std::atomic<uint64_t> s_Calls[phCount];
+static std::atomic<uint64_t> s_WallNs[phCount];
+static std::atomic<uint64_t> s_CpuNs[phCount];
+// Process state at the last reset
+static uint64_t s_StartWall = 0;
+static uint64_t s_StartCpu = 0;
+static uint64_t s_StartAllocs = 0;
+static uint64_t s_StartAllocBytes = 0;
+
+
+static uint64_t ReadClock(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static uint64_t GetProcessCpu(struct rusage &ru)
+{
+	getrusage(RUSAGE_SELF, &ru);
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL
+		+ (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+
+void Profiler::Enable(bool on)
+{
+	Reset();
+	s_Enabled = on;
+}
+
+
+void Profiler::Reset()
+{
+	for(size_t i = 0; i < phCount; ++i)
+	{
+		s_Calls[i].store(0, std::memory_order_relaxed);
+		s_WallNs[i].store(0, std::memory_order_relaxed);
+		s_CpuNs[i].store(0, std::memory_order_relaxed);
+	}
+	struct rusage ru;
+	s_StartWall = ReadClock(CLOCK_MONOTONIC);
+	s_StartCpu = GetProcessCpu(ru);
+	s_StartAllocs = AllocStats::GetCount();
+	s_StartAllocBytes = AllocStats::GetBytes();
+}
+
+
+void Profiler::Add(Phase_e ph, uint64_t wall_ns, uint64_t cpu_ns)
+{
+	s_Calls[ph].fetch_add(1, std::memory_order_relaxed);
+	s_WallNs[ph].fetch_add(wall_ns, std::memory_order_relaxed);
+	s_CpuNs[ph].fetch_add(cpu_ns, std::memory_order_relaxed);
+}
+
+
+void Profiler::GetData(ProfileData &data)
+{
+	memset(&data, 0, sizeof(data));
+	for(size_t i = 0; i < phCount; ++i)
+	{
+		data.m_Phases[i].m_Calls = s_Calls[i].load(std::memory_order_relaxed);
+		data.m_Phases[i].m_WallNs = s_WallNs[i].load(std::memory_order_relaxed);
+		data.m_Phases[i].m_CpuNs = s_CpuNs[i].load(std::memory_order_relaxed);
+	}
+	struct rusage ru;
+	data.m_WallNs = ReadClock(CLOCK_MONOTONIC) - s_StartWall;
+	data.m_CpuNs = GetProcessCpu(ru) - s_StartCpu;
+	data.m_Allocs = AllocStats::GetCount() - s_StartAllocs;
+	data.m_AllocBytes = AllocStats::GetBytes() - s_StartAllocBytes;
+#if defined(__APPLE__)
+	data.m_PeakRss = ru.ru_maxrss;
+#else
+	// Linux reports kilobytes
+	data.m_PeakRss = (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+
+const char *Profiler::GetName(Phase_e ph)
+{
+	static const char *names[phCount] =
+	{
+		"config",
+		"history_load",
+		"enumerate",
+		"argv",
+		"match",
+		"sample",
+		"history_write",
+		"evaluate",
+	};
+	return names[ph];
+}
+
+
+void ProfileData::Print(std::ostream &strm) const
+{
+	strm << "Phase            Calls      Wall ms       CPU ms\n";
+	for(size_t i = 0; i < phCount; ++i)
+	{
+		const PhaseStat &ph = m_Phases[i];
+		strm << format_n("%-14s %7llu %12.3f %12.3f\n", Profiler::GetName((Phase_e)i)
+			, (unsigned long long)ph.m_Calls, ph.m_WallNs / 1e6, ph.m_CpuNs / 1e6);
+	}
+	strm << format_n("%-14s %7s %12.3f %12.3f\n", "total", "", m_WallNs / 1e6, m_CpuNs / 1e6)
+		<< "Peak RSS    = " << m_PeakRss / 1024 << " KiB\n"
+		<< "Allocations = " << m_Allocs << " (" << m_AllocBytes << " bytes)\n"
+		;
+}
+
+
+void ProfileData::ToJson(Json::Value &obj) const
+{
+	Json::Value phases(Json::objectValue);
+	for(size_t i = 0; i < phCount; ++i)
+	{
+		Json::Value ph(Json::objectValue);
+		ph["Calls"] = Json::Value((Json::UInt64)m_Phases[i].m_Calls);
+		ph["WallNs"] = Json::Value((Json::UInt64)m_Phases[i].m_WallNs);
+		ph["CpuNs"] = Json::Value((Json::UInt64)m_Phases[i].m_CpuNs);
+		phases[Profiler::GetName((Phase_e)i)] = ph;
+	}
+	obj["Phases"] = phases;
+	obj["WallNs"] = Json::Value((Json::UInt64)m_WallNs);
+	obj["CpuNs"] = Json::Value((Json::UInt64)m_CpuNs);
+	obj["Allocs"] = Json::Value((Json::UInt64)m_Allocs);
+	obj["AllocBytes"] = Json::Value((Json::UInt64)m_AllocBytes);
+	obj["PeakRss"] = Json::Value((Json::UInt64)m_PeakRss);
+}
+
+
+ProfileScope::ProfileScope(Phase_e ph)
+	: m_Active(false)
+	, m_Phase(ph)
+	, m_Wall(0)
+	, m_Cpu(0)
+{
+	if(Profiler::IsEnabled())
+		Start(ph);
+}
+
+
+void ProfileScope::Start(Phase_e ph)
+{
+	m_Active = true;
+	m_Phase = ph;
+	m_Wall = ReadClock(CLOCK_MONOTONIC);
+	m_Cpu = ReadClock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+void ProfileScope::Stop()
+{
+	if(!m_Active)
+		return;
+	m_Active = false;
+	Profiler::Add(m_Phase, ReadClock(CLOCK_MONOTONIC) - m_Wall, ReadClock(CLOCK_THREAD_CPUTIME_ID) - m_Cpu);
+}
+
+
+}	// PidSample
+
@@ -0,0 +1,246 @@
+#include "StdInc.hpp"
+#include "PromExporter.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+// Label values escape backslash, quote and line feed
+static std::string EscapeLabel(const char *val)
+{
+	std::string res;
+	for(; *val; ++val)
+	{
+		if(*val == '\\' || *val == '"')
+			res += '\\';
+		if(*val == '\n')
+			res += "\\n";
+		else
+			res += *val;
+	}
+	return res;
+}
+
+
+static void AddHeader(std::string &text, const char *name, const char *help)
+{
+	text += format_n("# HELP is_server_busy_%s %s\n# TYPE is_server_busy_%s gauge\n", name, help, name);
+}
+
+
+PromExporter::PromExporter(const AppConfig &config)
+	: m_Config(config)
+	, m_Listen(-1)
+{
+}
+
+
+PromExporter::~PromExporter()
+{
+	if(m_Listen >= 0)
+		close(m_Listen);
+}
+
+
+void PromExporter::Update(const Activity &act, const SampleSet &samps, int verdict)
+{
+	const std::vector<ProcessConfig> &procs = m_Config.m_Procs;
+	std::vector<size_t> counts(procs.size(), 0);
+	for(SampleSet::Pid2Cfg_t::const_iterator it = samps.m_Pid2Cfg.begin(); it != samps.m_Pid2Cfg.end(); ++it)
+		++counts[it->second];
+	std::vector<std::string> labels(procs.size());
+	for(size_t i = 0; i < procs.size(); ++i)
+		labels[i] = "{service=\"" + EscapeLabel(procs[i].m_Name) + "\"}";
+
+	std::string text;
+	AddHeader(text, "verdict", "Exit code of the last check: 0 active, 1 idle, 100 error.");
+	text += format_n("is_server_busy_verdict %d\n", verdict);
+	AddHeader(text, "last_check_timestamp_seconds", "Time of the last check.");
+	text += format_n("is_server_busy_last_check_timestamp_seconds %llu\n", (unsigned long long)time(NULL));
+	AddHeader(text, "interval_seconds", "Interval between the compared samples.");
+	if(!act.m_Rates.empty())
+		text += format_n("is_server_busy_interval_seconds %.3f\n", act.m_TimeDiff / 1e9);
+	AddHeader(text, "service_processes", "Processes accounted to the service.");
+	for(size_t i = 0; i < procs.size(); ++i)
+		text += format_n("is_server_busy_service_processes%s %zu\n", labels[i].c_str(), counts[i]);
+	// Rates exist only for services running on both samples
+	AddHeader(text, "service_cpu_percent", "CPU usage of the service.");
+	for(size_t i = 0; i < act.m_Rates.size(); ++i)
+		text += format_n("is_server_busy_service_cpu_percent%s %.3f\n", labels[act.m_Rates[i].m_Cfg].c_str(), act.m_Rates[i].m_Cpu);
+	AddHeader(text, "service_disk_bytes_per_second", "Disk transfers of the service.");
+	for(size_t i = 0; i < act.m_Rates.size(); ++i)
+		text += format_n("is_server_busy_service_disk_bytes_per_second%s %lld\n", labels[act.m_Rates[i].m_Cfg].c_str(), (long long)act.m_Rates[i].m_DiskBytes);
+	AddHeader(text, "service_read_bytes_per_second", "Disk reads of the service.");
+	for(size_t i = 0; i < act.m_Rates.size(); ++i)
+		text += format_n("is_server_busy_service_read_bytes_per_second%s %lld\n", labels[act.m_Rates[i].m_Cfg].c_str(), (long long)act.m_Rates[i].m_ReadBytes);
+	AddHeader(text, "service_write_bytes_per_second", "Disk writes of the service.");
+	for(size_t i = 0; i < act.m_Rates.size(); ++i)
+		text += format_n("is_server_busy_service_write_bytes_per_second%s %lld\n", labels[act.m_Rates[i].m_Cfg].c_str(), (long long)act.m_Rates[i].m_WriteBytes);
+	// Thresholds of the configuration; disk limits of 0 are not checked
+	AddHeader(text, "service_cpu_threshold_percent", "CPU usage above which the service is active.");
+	for(size_t i = 0; i < procs.size(); ++i)
+		text += format_n("is_server_busy_service_cpu_threshold_percent%s %.3f\n", labels[i].c_str(), procs[i].m_CPU);
+	AddHeader(text, "service_disk_threshold_bytes_per_second", "Disk transfers above which the service is active.");
+	for(size_t i = 0; i < procs.size(); ++i)
+	{
+		if(procs[i].m_DiskTotal)
+			text += format_n("is_server_busy_service_disk_threshold_bytes_per_second%s %llu\n", labels[i].c_str(), (unsigned long long)procs[i].m_DiskTotal);
+	}
+	AddHeader(text, "service_read_threshold_bytes_per_second", "Disk reads above which the service is active.");
+	for(size_t i = 0; i < procs.size(); ++i)
+	{
+		if(procs[i].m_DiskRead)
+			text += format_n("is_server_busy_service_read_threshold_bytes_per_second%s %llu\n", labels[i].c_str(), (unsigned long long)procs[i].m_DiskRead);
+	}
+	AddHeader(text, "service_write_threshold_bytes_per_second", "Disk writes above which the service is active.");
+	for(size_t i = 0; i < procs.size(); ++i)
+	{
+		if(procs[i].m_DiskWrite)
+			text += format_n("is_server_busy_service_write_threshold_bytes_per_second%s %llu\n", labels[i].c_str(), (unsigned long long)procs[i].m_DiskWrite);
+	}
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Text.swap(text);
+}
+
+
+std::string PromExporter::GetText() const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	return m_Text;
+}
+
+
+bool PromExporter::WriteFile() const
+{
+	// The collector may read at any time; replace the file atomically
+	const char *fname = m_Config.m_PromFile.c_str();
+	std::string tmp(fname);
+	tmp += ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if(fp == NULL)
+	{
+		LOG(ERROR) << "Cannot create metrics file '" << tmp << "'!\n";
+		return false;
+	}
+	const std::string text = GetText();
+	bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+	ok = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname) != 0)
+	{
+		LOG(ERROR) << "Failed to write metrics file '" << fname << "'!\n";
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+bool PromExporter::Listen()
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)m_Config.m_PromListen);
+	// Metrics are not published beyond this host
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	m_Listen = socket(AF_INET, SOCK_STREAM, 0);
+	if(m_Listen < 0)
+	{
+		LOG(ERROR) << "Cannot create socket (error code " << errno << ")\n";
+		return false;
+	}
+	int on = 1;
+	setsockopt(m_Listen, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	fcntl(m_Listen, F_SETFD, FD_CLOEXEC);
+	fcntl(m_Listen, F_SETFL, fcntl(m_Listen, F_GETFL) | O_NONBLOCK);
+	if(bind(m_Listen, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| listen(m_Listen, 16) != 0)
+	{
+		LOG(ERROR) << "Cannot listen on port " << m_Config.m_PromListen << " (error code " << errno << ")\n";
+		close(m_Listen);
+		m_Listen = -1;
+		return false;
+	}
+	return true;
+}
+
+
+void PromExporter::Serve()
+{
+	for(;;)
+	{
+		int fd = accept(m_Listen, NULL, NULL);
+		if(fd < 0)
+			break;
+		Reply(fd);
+		close(fd);
+	}
+}
+
+
+void PromExporter::Reply(int fd)
+{
+	// Some systems inherit O_NONBLOCK; a stalled client may not hold the other ones
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	// Only the request line is of interest; headers are read until the blank line
+	std::string req;
+	char buf[1024];
+	while(req.size() < 8192 && req.find("\r\n\r\n") == std::string::npos)
+	{
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if(n <= 0)
+			return;
+		req.append(buf, n);
+	}
+	const char *status = "200 OK";
+	const std::string text = GetText();
+	const std::string *body = &text;
+	const std::string none;
+	const bool head = req.compare(0, 5, "HEAD ") == 0;
+	if(!head && req.compare(0, 4, "GET ") != 0)
+	{
+		status = "405 Method Not Allowed";
+		body = &none;
+	}
+	else
+	{
+		const size_t path = req.find(' ') + 1;
+		const size_t end = req.find_first_of(" ?\r", path);
+		const std::string url = req.substr(path, end - path);
+		if(url != "/metrics" && url != "/")
+		{
+			status = "404 Not Found";
+			body = &none;
+		}
+	}
+	std::string resp = format_n("HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n"
+		, status, body->size());
+	if(!head)
+		resp += *body;
+	for(size_t ofs = 0; ofs < resp.size(); )
+	{
+		ssize_t n = write(fd, resp.data() + ofs, resp.size() - ofs);
+		if(n <= 0)
+		{
+			LOG(WARN) << "Failed to answer a metrics scrape (error code " << errno << ")\n";
+			return;
+		}
+		ofs += n;
+	}
+}
+
+
+}	// PidSample
+
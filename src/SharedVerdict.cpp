@@ -0,0 +1,243 @@
+#include "StdInc.hpp"
+#include "SharedVerdict.hpp"
+#include "Trend.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+const char SharedVerdict::kMagic[8] = { 'I', 'S', 'B', 'V', 'R', 'D', 'C', 0 };
+
+
+SharedVerdict::SharedVerdict(const AppConfig &config)
+	: m_Config(config)
+	, m_Header(NULL)
+	, m_Size(0)
+	, m_Owner(false)
+{
+}
+
+
+SharedVerdict::~SharedVerdict()
+{
+	Close();
+}
+
+
+void SharedVerdict::Close()
+{
+	if(m_Header)
+	{
+		munmap(m_Header, m_Size);
+		m_Header = NULL;
+	}
+	// Readers still mapping it keep their copy
+	if(m_Owner)
+	{
+		shm_unlink(m_Config.m_ShmName.c_str());
+		m_Owner = false;
+	}
+}
+
+
+bool SharedVerdict::Create()
+{
+	Close();
+	const char *name = m_Config.m_ShmName.c_str();
+	m_Size = sizeof(ShmHeader) + m_Config.m_Procs.size() * sizeof(ShmService);
+	int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+	{
+		LOG(ERROR) << "Cannot create shared memory '" << name << "' (error code " << errno << ")\n";
+		return false;
+	}
+	// Any local user may read the verdict, whatever the umask
+	fchmod(fd, 0644);
+	void *p = MAP_FAILED;
+	if(ftruncate(fd, m_Size) == 0)
+		p = mmap(NULL, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+	{
+		LOG(ERROR) << "Cannot map shared memory '" << name << "' (error code " << errno << ")\n";
+		shm_unlink(name);
+		return false;
+	}
+	m_Header = (ShmHeader *)p;
+	m_Owner = true;
+	// A segment left by a previous instance may have another layout
+	ShmHeader *hdr = m_Header;
+	hdr->m_Seq.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(hdr->m_Magic, kMagic, sizeof(kMagic));
+	hdr->m_Version = kVersion;
+	hdr->m_HeaderSize = sizeof(ShmHeader);
+	hdr->m_EntrySize = sizeof(ShmService);
+	hdr->m_Count = (uint32_t)m_Config.m_Procs.size();
+	hdr->m_Verdict = ERROR_STATE;
+	hdr->m_Clock = 0;
+	hdr->m_Time = 0;
+	hdr->m_Interval = 0;
+	ShmService *svc = (ShmService *)(hdr + 1);
+	memset(svc, 0, hdr->m_Count * sizeof(ShmService));
+	for(size_t i = 0; i < m_Config.m_Procs.size(); ++i)
+		strncpy(svc[i].m_Name, m_Config.m_Procs[i].m_Name.c_str(), sizeof(svc[i].m_Name) - 1);
+	// Nothing published yet
+	hdr->m_Seq.store(0, std::memory_order_release);
+	return true;
+}
+
+
+bool SharedVerdict::Attach()
+{
+	Close();
+	const char *name = m_Config.m_ShmName.c_str();
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd < 0)
+	{
+		LOG(DEBUG) << "Cannot open shared memory '" << name << "' (error code " << errno << ")\n";
+		return false;
+	}
+	struct stat st;
+	void *p = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader))
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+	{
+		LOG(WARN) << "Invalid shared memory '" << name << "'\n";
+		return false;
+	}
+	m_Header = (ShmHeader *)p;
+	m_Size = st.st_size;
+	const ShmHeader *hdr = m_Header;
+	if(memcmp(hdr->m_Magic, kMagic, sizeof(kMagic)) != 0
+		|| hdr->m_Version != kVersion
+		|| hdr->m_HeaderSize != sizeof(ShmHeader)
+		|| hdr->m_EntrySize != sizeof(ShmService)
+		|| m_Size < sizeof(ShmHeader) + (size_t)hdr->m_Count * sizeof(ShmService))
+	{
+		LOG(WARN) << "Invalid shared memory '" << name << "'\n";
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+void SharedVerdict::Publish(const Activity &act, const SampleSet &samps, int verdict)
+{
+	if(m_Header == NULL)
+		return;
+	ShmHeader *hdr = m_Header;
+	ShmService *svc = (ShmService *)(hdr + 1);
+	// Prepared aside, so the odd period is a plain copy
+	std::vector<ShmService> data(svc, svc + hdr->m_Count);
+	for(size_t i = 0; i < data.size(); ++i)
+	{
+		data[i].m_Procs = 0;
+		data[i].m_HasRate = 0;
+		data[i].m_Cpu = 0.0;
+		data[i].m_ReadBytes = 0;
+		data[i].m_WriteBytes = 0;
+	}
+	for(SampleSet::Pid2Cfg_t::const_iterator it = samps.m_Pid2Cfg.begin(); it != samps.m_Pid2Cfg.end(); ++it)
+	{
+		if(it->second < data.size())
+			++data[it->second].m_Procs;
+	}
+	for(size_t i = 0; i < act.m_Rates.size(); ++i)
+	{
+		const ServiceRate &rate = act.m_Rates[i];
+		if(rate.m_Cfg >= data.size())
+			continue;
+		ShmService &e = data[rate.m_Cfg];
+		e.m_HasRate = 1;
+		e.m_Cpu = rate.m_Cpu;
+		e.m_ReadBytes = rate.m_ReadBytes;
+		e.m_WriteBytes = rate.m_WriteBytes;
+	}
+	const uint32_t seq = hdr->m_Seq.load(std::memory_order_relaxed);
+	hdr->m_Seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	hdr->m_Verdict = verdict;
+	hdr->m_Clock = samps.m_Clock;
+	hdr->m_Time = TrendStore::GetWallClock();
+	hdr->m_Interval = act.m_Rates.empty() ? 0 : act.m_TimeDiff;
+	memcpy(svc, data.data(), data.size() * sizeof(ShmService));
+	// Zero is reserved for 'not published'
+	hdr->m_Seq.store(seq + 2 ? seq + 2 : 2, std::memory_order_release);
+}
+
+
+bool SharedVerdict::Read(VerdictSnapshot &snap) const
+{
+	if(m_Header == NULL)
+		return false;
+	const ShmHeader *hdr = m_Header;
+	const ShmService *svc = (const ShmService *)(hdr + 1);
+	snap.m_Services.resize(hdr->m_Count);
+	// Publication takes microseconds every few seconds; spin
+	for(int retry = 0; retry < 100000; ++retry)
+	{
+		const uint32_t seq = hdr->m_Seq.load(std::memory_order_acquire);
+		if(seq == 0)
+			return false;
+		if(seq & 1)
+			continue;
+		snap.m_Verdict = hdr->m_Verdict;
+		snap.m_Clock = hdr->m_Clock;
+		snap.m_Time = hdr->m_Time;
+		snap.m_Interval = hdr->m_Interval;
+		memcpy(snap.m_Services.data(), svc, snap.m_Services.size() * sizeof(ShmService));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(hdr->m_Seq.load(std::memory_order_relaxed) == seq)
+			return true;
+	}
+	return false;
+}
+
+
+int SharedVerdict::Query(const AppConfig &config)
+{
+	SharedVerdict shm(config);
+	VerdictSnapshot snap;
+	if(!shm.Attach() || !shm.Read(snap))
+	{
+		LOG(DEBUG) << "No verdict published in '" << config.m_ShmName << "'\n";
+		return -1;
+	}
+	uint64_t age = (ProcSource::GetDefault().GetClock() - snap.m_Clock) / 1000000000ULL;
+	// The monotonic clock stops during suspend; a verdict published before
+	// it would look fresh after the resume
+	const int64_t wall = (TrendStore::GetWallClock() - snap.m_Time) / 1000;
+	if(wall > 0 && (uint64_t)wall > age)
+		age = wall;
+	if(snap.m_Clock == 0 || age > config.m_IntervalThr)
+	{
+		LOG(DEBUG) << "Published verdict is " << age << " s old\n";
+		return -1;
+	}
+	for(size_t i = 0; i < snap.m_Services.size(); ++i)
+	{
+		const ShmService &e = snap.m_Services[i];
+		const std::string name(e.m_Name, strnlen(e.m_Name, sizeof(e.m_Name)));
+		if(e.m_HasRate)
+			LOG(DEBUG) << "Service '" << name << "': " << e.m_Procs << " process(es)"
+				<< Fmt(", %.1f%% CPU, %lld B/s read, %lld B/s written\n", e.m_Cpu, (long long)e.m_ReadBytes, (long long)e.m_WriteBytes);
+		else
+			LOG(DEBUG) << "Service '" << name << "': " << e.m_Procs << " process(es)\n";
+	}
+	LOG(INFO) << "Published verdict (" << age << " s old): server " << (snap.m_Verdict == ACTIVE_STATE ? "active" : snap.m_Verdict == IDLE_STATE ? "idle" : "in error") << '\n';
+	return snap.m_Verdict;
+}
+
+
+}	// PidSample
+
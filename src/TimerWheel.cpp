@@ -0,0 +1,103 @@
+#include "StdInc.hpp"
+#include "TimerWheel.hpp"
+
+
+namespace grumat
+{
+
+
+TimerWheel::TimerWheel()
+	: m_Now(0)
+	, m_Count(0)
+{
+}
+
+
+void TimerWheel::Clear()
+{
+	for(size_t level = 0; level < kLevels; ++level)
+	{
+		for(size_t i = 0; i < kSlots; ++i)
+			m_Wheel[level][i].clear();
+	}
+	m_Now = 0;
+	m_Count = 0;
+}
+
+
+void TimerWheel::Insert(const Timer &t)
+{
+	// Cascaded timers may be due on the current tick, which fires next
+	const uint64_t delta = t.m_Tick - m_Now;
+	size_t level = 0;
+	while(level < kLevels - 1 && delta >> (kBits * (level + 1)))
+		++level;
+	uint64_t pos = t.m_Tick;
+	// Beyond the range: parked on the last top slot, then cascaded again
+	if(delta >> (kBits * kLevels))
+		pos = m_Now + (1ULL << (kBits * kLevels)) - 1;
+	m_Wheel[level][(pos >> (kBits * level)) & (kSlots - 1)].push_back(t);
+	++m_Count;
+}
+
+
+void TimerWheel::Schedule(size_t id, uint64_t tick)
+{
+	Timer t;
+	t.m_Id = id;
+	t.m_Tick = std::max(tick, m_Now + 1);
+	Insert(t);
+}
+
+
+void TimerWheel::Cascade(size_t level)
+{
+	Slot_t slot;
+	slot.swap(m_Wheel[level][(m_Now >> (kBits * level)) & (kSlots - 1)]);
+	m_Count -= slot.size();
+	for(Slot_t::const_iterator it = slot.begin(); it != slot.end(); ++it)
+		Insert(*it);
+}
+
+
+void TimerWheel::Advance(uint64_t tick, std::vector<size_t> &fired)
+{
+	while(m_Now < tick)
+	{
+		// Nothing to fire or cascade; e.g. after a suspend
+		if(m_Count == 0)
+		{
+			m_Now = tick;
+			break;
+		}
+		++m_Now;
+		// Higher levels first, so a timer may go down several levels at once
+		for(size_t level = kLevels - 1; level > 0; --level)
+		{
+			if((m_Now & ((1ULL << (kBits * level)) - 1)) == 0)
+				Cascade(level);
+		}
+		Slot_t &slot = m_Wheel[0][m_Now & (kSlots - 1)];
+		for(Slot_t::const_iterator it = slot.begin(); it != slot.end(); ++it)
+			fired.push_back(it->m_Id);
+		m_Count -= slot.size();
+		slot.clear();
+	}
+}
+
+
+uint64_t TimerWheel::GetNextTick() const
+{
+	if(m_Count == 0)
+		return UINT64_MAX;
+	// Level 0 is exact; a wrap may bring timers from the levels above
+	for(uint64_t t = m_Now + 1; ; ++t)
+	{
+		if((t & (kSlots - 1)) == 0 || !m_Wheel[0][t & (kSlots - 1)].empty())
+			return t;
+	}
+}
+
+
+}	// namespace grumat
+
@@ -0,0 +1,826 @@
+#include "StdInc.hpp"
+#include "Trend.hpp"
+#include "Activity.hpp"
+#include <sys/file.h>
+#include <sys/stat.h>
+
+
+using namespace grumat;
+
+
+namespace PidSample
+{
+
+
+const char TrendStore::kMagic[8] = { 'I', 'S', 'B', 'T', 'R', 'N', 'D', 0 };
+
+// Compaction passes before a segment is dropped
+static const uint32_t kMaxLevel = 3;
+// Sanity limits of a segment
+static const size_t kMaxNamesSize = 64 * 1024;
+static const size_t kMaxBuckets = 10000;
+
+
+static void PutVarint(std::string &buf, uint64_t v)
+{
+	while(v >= 0x80)
+	{
+		buf += (char)(v | 0x80);
+		v >>= 7;
+	}
+	buf += (char)v;
+}
+
+
+static bool GetVarint(const uint8_t *&p, const uint8_t *end, uint64_t &v)
+{
+	v = 0;
+	for(unsigned shift = 0; p < end && shift < 64; shift += 7)
+	{
+		const uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if((b & 0x80) == 0)
+			return true;
+	}
+	return false;
+}
+
+
+static uint64_t ZigZag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+
+static int64_t UnZigZag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+
+// Increment of a counter; a lower value is a restart
+static uint64_t Increment(uint64_t cur, uint64_t prev)
+{
+	return cur >= prev ? cur - prev : 0;
+}
+
+
+// Record of 'cur' relative to 'prev'; counters must not decrease
+static void EncodePoint(std::string &rec, const TrendPoint &prev, int64_t prev_delta, const TrendPoint &cur)
+{
+	std::string body;
+	const int64_t delta = cur.m_Time - prev.m_Time;
+	PutVarint(body, ZigZag(delta - prev_delta));
+	PutVarint(body, cur.m_Checks - prev.m_Checks);
+	PutVarint(body, cur.m_Active - prev.m_Active);
+	PutVarint(body, cur.m_SampledNs - prev.m_SampledNs);
+	for(size_t i = 0; i < cur.m_Services.size(); ++i)
+	{
+		const TrendValues &c = cur.m_Services[i];
+		const TrendValues &p = prev.m_Services[i];
+		// Repeating values XOR to zero; growing counters are smaller as increments
+		PutVarint(body, c.m_Procs ^ p.m_Procs);
+		PutVarint(body, c.m_CpuNs - p.m_CpuNs);
+		PutVarint(body, c.m_ReadBytes - p.m_ReadBytes);
+		PutVarint(body, c.m_WriteBytes - p.m_WriteBytes);
+		PutVarint(body, c.m_SampledNs - p.m_SampledNs);
+	}
+	rec.clear();
+	PutVarint(rec, body.size());
+	rec += body;
+}
+
+
+// Header and name table of a new segment
+static std::string MakeSegmentHead(const std::vector<std::string> &names, int64_t first, uint32_t level)
+{
+	std::string blob;
+	for(size_t i = 0; i < names.size(); ++i)
+		blob.append(names[i].c_str(), names[i].size() + 1);
+	TrendHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.m_Magic, TrendStore::kMagic, sizeof(hdr.m_Magic));
+	hdr.m_Version = TrendStore::kVersion;
+	hdr.m_HeaderSize = sizeof(hdr);
+	hdr.m_FirstTime = first;
+	hdr.m_LastTime = first;
+	hdr.m_Level = level;
+	hdr.m_NameCount = (uint32_t)names.size();
+	hdr.m_NamesSize = (uint32_t)blob.size();
+	return std::string((const char *)&hdr, sizeof(hdr)) + blob;
+}
+
+
+// Replaces a segment atomically
+static bool WriteSegment(const std::string &fname, const std::string &data)
+{
+	std::string tmp(fname);
+	tmp += ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if(fp == NULL)
+	{
+		LOG(ERROR) << "Cannot create long-term history segment '" << tmp << "'!\n";
+		return false;
+	}
+	bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	ok = (fclose(fp) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname.c_str()) != 0)
+	{
+		LOG(ERROR) << "Failed to write long-term history segment '" << fname << "'!\n";
+		unlink(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+// Wall clock of the first point, from the segment name
+static int64_t GetSegmentTime(const std::string &fname)
+{
+	const size_t pos = fname.rfind('/') + 1;
+	return (int64_t)strtoull(fname.c_str() + pos, NULL, 16);
+}
+
+
+static std::string FormatTime(int64_t ms)
+{
+	time_t t = (time_t)(ms / 1000);
+	char buf[64];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	return buf;
+}
+
+
+// Streams the points of a segment, one record at a time
+class TrendReader
+{
+public:
+	TrendReader() : m_Offset(0), m_PrevDelta(0), m_File(NULL) {}
+	~TrendReader()
+	{
+		if(m_File)
+			fclose(m_File);
+	}
+
+	// Validates the header and reads the names
+	bool Open(const char *fname);
+	// False at the end or at a damaged or partial record
+	bool Next(TrendPoint &pt);
+
+public:
+	TrendHeader m_Header;
+	std::vector<std::string> m_Names;
+	// End of the last valid record
+	size_t m_Offset;
+	// Last point read and its time step
+	TrendPoint m_Prev;
+	int64_t m_PrevDelta;
+
+protected:
+	FILE *m_File;
+	std::string m_Buf;
+};
+
+
+bool TrendReader::Open(const char *fname)
+{
+	m_File = fopen(fname, "rb");
+	if(m_File == NULL)
+		return false;
+	if(fread(&m_Header, sizeof(m_Header), 1, m_File) != 1
+		|| memcmp(m_Header.m_Magic, TrendStore::kMagic, sizeof(m_Header.m_Magic)) != 0
+		|| m_Header.m_Version != TrendStore::kVersion
+		|| m_Header.m_HeaderSize != sizeof(m_Header)
+		|| m_Header.m_NamesSize > kMaxNamesSize)
+		return false;
+	std::string blob(m_Header.m_NamesSize, '\0');
+	if(fread(&blob[0], 1, blob.size(), m_File) != blob.size()
+		|| (!blob.empty() && blob.back() != '\0'))
+		return false;
+	for(size_t pos = 0; pos < blob.size(); )
+	{
+		m_Names.push_back(blob.c_str() + pos);
+		pos += m_Names.back().size() + 1;
+	}
+	if(m_Names.size() != m_Header.m_NameCount)
+		return false;
+	m_Offset = sizeof(m_Header) + blob.size();
+	m_Prev.m_Time = m_Header.m_FirstTime;
+	m_Prev.m_Services.resize(m_Names.size());
+	return true;
+}
+
+
+bool TrendReader::Next(TrendPoint &pt)
+{
+	uint64_t len = 0;
+	size_t head = 0;
+	for(unsigned shift = 0; ; shift += 7)
+	{
+		const int c = getc(m_File);
+		if(c == EOF || shift > 28)
+			return false;
+		++head;
+		len |= (uint64_t)(c & 0x7f) << shift;
+		if((c & 0x80) == 0)
+			break;
+	}
+	// Largest encoding of the values
+	if(len > 40 + 50 * m_Names.size())
+		return false;
+	m_Buf.resize(len);
+	if(fread(&m_Buf[0], 1, len, m_File) != len)
+		return false;
+	const uint8_t *p = (const uint8_t *)m_Buf.data();
+	const uint8_t *end = p + len;
+	uint64_t dod, checks, active, sampled;
+	if(!GetVarint(p, end, dod) || !GetVarint(p, end, checks)
+		|| !GetVarint(p, end, active) || !GetVarint(p, end, sampled))
+		return false;
+	pt.m_Time = m_Prev.m_Time + m_PrevDelta + UnZigZag(dod);
+	pt.m_Checks = m_Prev.m_Checks + checks;
+	pt.m_Active = m_Prev.m_Active + active;
+	pt.m_SampledNs = m_Prev.m_SampledNs + sampled;
+	pt.m_Services.resize(m_Names.size());
+	for(size_t i = 0; i < m_Names.size(); ++i)
+	{
+		const TrendValues &prev = m_Prev.m_Services[i];
+		TrendValues &v = pt.m_Services[i];
+		uint64_t procs, cpu, rd, wr, sampled;
+		if(!GetVarint(p, end, procs) || !GetVarint(p, end, cpu)
+			|| !GetVarint(p, end, rd) || !GetVarint(p, end, wr)
+			|| !GetVarint(p, end, sampled))
+			return false;
+		v.m_Procs = prev.m_Procs ^ procs;
+		v.m_CpuNs = prev.m_CpuNs + cpu;
+		v.m_ReadBytes = prev.m_ReadBytes + rd;
+		v.m_WriteBytes = prev.m_WriteBytes + wr;
+		v.m_SampledNs = prev.m_SampledNs + sampled;
+	}
+	if(p != end)
+		return false;
+	m_PrevDelta = pt.m_Time - m_Prev.m_Time;
+	m_Prev = pt;
+	m_Offset += head + len;
+	return true;
+}
+
+
+// Exclusive access to the directory, shared by the daemon and one-shot checks
+class TrendLock
+{
+public:
+	TrendLock(const std::string &dir)
+	{
+		const std::string fname = dir + "/lock";
+		m_Fd = open(fname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if(m_Fd >= 0 && flock(m_Fd, LOCK_EX) != 0)
+		{
+			close(m_Fd);
+			m_Fd = -1;
+		}
+	}
+	~TrendLock()
+	{
+		if(m_Fd >= 0)
+			close(m_Fd);
+	}
+	bool IsValid() const { return m_Fd >= 0; }
+
+protected:
+	int m_Fd;
+};
+
+
+TrendStore::TrendStore(const AppConfig &config)
+	: m_Config(config)
+	, m_End(0)
+	, m_Count(0)
+	, m_PrevDelta(0)
+{
+}
+
+
+int64_t TrendStore::GetWallClock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+std::string TrendStore::MakeSegmentName(int64_t time) const
+{
+	return m_Config.m_TrendDir + format_n("/%016llx.seg", (unsigned long long)time);
+}
+
+
+size_t TrendStore::GetSegmentLimit() const
+{
+	// Leaves room for compaction whatever the configured size
+	return std::min<size_t>(std::max<size_t>(m_Config.m_TrendSize / 16, 4096), 65536);
+}
+
+
+void TrendStore::ListSegments(std::vector<std::string> &segs) const
+{
+	segs.clear();
+	DIR *dir = opendir(m_Config.m_TrendDir.c_str());
+	if(dir == NULL)
+		return;
+	while(struct dirent *ent = readdir(dir))
+	{
+		// Only names made by MakeSegmentName()
+		if(strlen(ent->d_name) == 20 && strcmp(ent->d_name + 16, ".seg") == 0
+			&& strspn(ent->d_name, "0123456789abcdef") == 16)
+			segs.push_back(m_Config.m_TrendDir + '/' + ent->d_name);
+	}
+	closedir(dir);
+	std::sort(segs.begin(), segs.end());
+}
+
+
+bool TrendStore::LoadTail()
+{
+	std::vector<std::string> segs;
+	ListSegments(segs);
+	struct stat st;
+	// Unchanged unless another instance appended meanwhile
+	if(!m_File.empty() && !segs.empty() && segs.back() == m_File
+		&& stat(m_File.c_str(), &st) == 0 && (size_t)st.st_size == m_End)
+		return true;
+	m_File.clear();
+	m_Names.clear();
+	m_End = 0;
+	m_Count = 0;
+	if(segs.empty())
+		return true;
+	TrendReader rd;
+	if(!rd.Open(segs.back().c_str()))
+	{
+		// A new segment is started; queries skip this one
+		LOG(WARN) << "Ignoring invalid long-term history segment '" << segs.back() << "'\n";
+		return true;
+	}
+	TrendPoint pt;
+	while(rd.Next(pt))
+		++m_Count;
+	if(m_Count != rd.m_Header.m_Count)
+		LOG(DEBUG) << "Long-term history segment '" << segs.back() << "' has a partial record\n";
+	m_File = segs.back();
+	m_Names = rd.m_Names;
+	m_End = rd.m_Offset;
+	m_Prev = rd.m_Prev;
+	m_PrevDelta = rd.m_PrevDelta;
+	m_Last = rd.m_Prev;
+	m_LastNames = rd.m_Names;
+	return true;
+}
+
+
+bool TrendStore::StartSegment(const std::vector<std::string> &names, int64_t time)
+{
+	// Two segments within the same ms
+	std::string fname = MakeSegmentName(time);
+	while(access(fname.c_str(), F_OK) == 0)
+		fname = MakeSegmentName(++time);
+	const std::string head = MakeSegmentHead(names, time, 0);
+	if(!WriteSegment(fname, head))
+		return false;
+	m_File = fname;
+	m_Names = names;
+	m_End = head.size();
+	m_Count = 0;
+	m_Prev = TrendPoint();
+	m_Prev.m_Time = time;
+	m_Prev.m_Services.resize(names.size());
+	m_PrevDelta = 0;
+	return true;
+}
+
+
+bool TrendStore::Append(const SampleSet *old_samps, const SampleSet &samps, int verdict)
+{
+	const char *dir = m_Config.m_TrendDir.c_str();
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST)
+	{
+		LOG(ERROR) << "Cannot create long-term history directory '" << dir << "' (error code " << errno << ")\n";
+		return false;
+	}
+	TrendLock lock(m_Config.m_TrendDir);
+	if(!lock.IsValid())
+	{
+		LOG(ERROR) << "Cannot lock long-term history directory '" << dir << "' (error code " << errno << ")\n";
+		return false;
+	}
+	if(!LoadTail())
+		return false;
+
+	std::vector<std::string> names(m_Config.m_Procs.size());
+	for(size_t i = 0; i < names.size(); ++i)
+		names[i] = m_Config.m_Procs[i].m_Name;
+	TrendPoint cur;
+	// Wall clock may step back; keep the segments ordered
+	cur.m_Time = std::max(GetWallClock(), m_Last.m_Time);
+	cur.m_Checks = m_Last.m_Checks + 1;
+	cur.m_Active = m_Last.m_Active + (verdict == ACTIVE_STATE ? 1 : 0);
+	cur.m_SampledNs = m_Last.m_SampledNs;
+	cur.m_Services.resize(names.size());
+	// Counters continue by name; sections may have been edited
+	for(size_t i = 0; i < names.size(); ++i)
+	{
+		for(size_t j = 0; j < m_LastNames.size(); ++j)
+		{
+			if(m_LastNames[j] == names[i])
+			{
+				cur.m_Services[i] = m_Last.m_Services[j];
+				break;
+			}
+		}
+		cur.m_Services[i].m_Procs = 0;
+	}
+	for(SampleSet::Pid2Cfg_t::const_iterator it = samps.m_Pid2Cfg.begin(); it != samps.m_Pid2Cfg.end(); ++it)
+		++cur.m_Services[it->second].m_Procs;
+	// Same interval limits as the verdict; a suspend leaves a gap
+	if(old_samps && samps.m_Clock > old_samps->m_Clock
+		&& (samps.m_Clock - old_samps->m_Clock) / 1000000000ULL <= m_Config.m_IntervalThr)
+	{
+		cur.m_SampledNs += samps.m_Clock - old_samps->m_Clock;
+		// Sections not due carry older samples; they count on their next
+		// read, for the whole time since the previous one
+		std::vector<char> read(names.size(), 0);
+		for(size_t i = 0; i < names.size(); ++i)
+		{
+			const uint64_t from = old_samps->GetReadClock(i);
+			if(!samps.IsDue(i) || samps.m_Clock <= from
+				|| (samps.m_Clock - from) / 1000000000ULL > m_Config.m_IntervalThr)
+				continue;
+			read[i] = 1;
+			cur.m_Services[i].m_SampledNs += samps.m_Clock - from;
+		}
+		for(SampleSet::SampleSet_t::const_iterator it = samps.m_Samples.begin(); it != samps.m_Samples.end(); ++it)
+		{
+			// New arrivals have no baseline
+			SampleSet::SampleSet_t::const_iterator old = old_samps->m_Samples.find(it->first);
+			SampleSet::Pid2Cfg_t::const_iterator cfg = samps.m_Pid2Cfg.find(it->first);
+			if(old == old_samps->m_Samples.end() || !it->second.IsSameProcess(old->second)
+				|| cfg == samps.m_Pid2Cfg.end() || !read[cfg->second])
+				continue;
+			const Diff dif = it->second - old->second;
+			TrendValues &v = cur.m_Services[cfg->second];
+			if(dif.m_CpuTime + dif.m_SysTime > 0)
+				v.m_CpuNs += dif.m_CpuTime + dif.m_SysTime;
+			if(dif.m_DiskReadBytes > 0)
+				v.m_ReadBytes += dif.m_DiskReadBytes;
+			if(dif.m_DiskWriteBytes > 0)
+				v.m_WriteBytes += dif.m_DiskWriteBytes;
+		}
+	}
+
+	std::string rec;
+	const bool same = !m_File.empty() && names == m_Names;
+	if(same)
+		EncodePoint(rec, m_Prev, m_PrevDelta, cur);
+	if(!same || m_End + rec.size() > GetSegmentLimit())
+	{
+		if(!StartSegment(names, cur.m_Time))
+			return false;
+		EncodePoint(rec, m_Prev, m_PrevDelta, cur);
+		Compact();
+	}
+	int fd = open(m_File.c_str(), O_WRONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		LOG(ERROR) << "Cannot open long-term history segment '" << m_File << "' (error code " << errno << ")\n";
+		return false;
+	}
+	const uint32_t count = m_Count + 1;
+	// Drops a partial record left by an interrupted check
+	bool ok = pwrite(fd, rec.data(), rec.size(), m_End) == (ssize_t)rec.size()
+		&& ftruncate(fd, m_End + rec.size()) == 0
+		&& pwrite(fd, &cur.m_Time, sizeof(cur.m_Time), offsetof(TrendHeader, m_LastTime)) == sizeof(cur.m_Time)
+		&& pwrite(fd, &count, sizeof(count), offsetof(TrendHeader, m_Count)) == sizeof(count);
+	close(fd);
+	if(!ok)
+	{
+		LOG(ERROR) << "Failed to write long-term history segment '" << m_File << "' (error code " << errno << ")\n";
+		// State is recovered from the file on the next call
+		m_File.clear();
+		return false;
+	}
+	m_End += rec.size();
+	m_Count = count;
+	m_PrevDelta = cur.m_Time - m_Prev.m_Time;
+	m_Prev = cur;
+	m_Last = cur;
+	m_LastNames = names;
+	return true;
+}
+
+
+bool TrendStore::CompactSegment(const std::string &fname, size_t &new_size)
+{
+	TrendReader rd;
+	if(!rd.Open(fname.c_str()) || rd.m_Header.m_Level >= kMaxLevel)
+		return false;
+	// Bounded by the segment size limit
+	std::vector<TrendPoint> pts;
+	TrendPoint pt;
+	while(rd.Next(pt))
+		pts.push_back(pt);
+	if(pts.size() <= 2)
+		return false;
+	std::string data = MakeSegmentHead(rd.m_Names, rd.m_Header.m_FirstTime, rd.m_Header.m_Level + 1);
+	TrendPoint prev;
+	prev.m_Time = rd.m_Header.m_FirstTime;
+	prev.m_Services.resize(rd.m_Names.size());
+	int64_t delta = 0;
+	uint32_t count = 0;
+	std::string rec;
+	for(size_t i = 0; i < pts.size(); ++i)
+	{
+		// Counters are cumulative: the kept points hold all the totals
+		if(i % 2 != 0 && i + 1 != pts.size())
+			continue;
+		EncodePoint(rec, prev, delta, pts[i]);
+		data += rec;
+		delta = pts[i].m_Time - prev.m_Time;
+		prev = pts[i];
+		++count;
+	}
+	TrendHeader *hdr = (TrendHeader *)&data[0];
+	hdr->m_LastTime = prev.m_Time;
+	hdr->m_Count = count;
+	if(!WriteSegment(fname, data))
+		return false;
+	LOG(DEBUG) << "Compacted long-term history segment '" << fname << "' to " << count << " points\n";
+	new_size = data.size();
+	return true;
+}
+
+
+void TrendStore::Compact()
+{
+	std::vector<std::string> segs;
+	ListSegments(segs);
+	std::vector<size_t> sizes(segs.size(), 0);
+	size_t total = 0;
+	for(size_t i = 0; i < segs.size(); ++i)
+	{
+		struct stat st;
+		if(stat(segs[i].c_str(), &st) == 0)
+			sizes[i] = st.st_size;
+		total += sizes[i];
+	}
+	// The newest segment is the active one; older ones get coarser, then go
+	for(size_t i = 0; total > m_Config.m_TrendSize && i + 1 < segs.size(); )
+	{
+		size_t new_size = 0;
+		if(CompactSegment(segs[i], new_size) && new_size < sizes[i])
+		{
+			total = total - sizes[i] + new_size;
+			sizes[i] = new_size;
+			continue;
+		}
+		LOG(DEBUG) << "Dropping long-term history segment '" << segs[i] << "'\n";
+		unlink(segs[i].c_str());
+		total -= sizes[i];
+		++i;
+	}
+}
+
+
+// Activity of a service inside a query bucket
+class QueryService
+{
+public:
+	QueryService() : m_ProcSum(0), m_Points(0), m_CpuNs(0), m_ReadBytes(0), m_WriteBytes(0), m_SampledNs(0) {}
+
+	uint64_t m_ProcSum;
+	uint64_t m_Points;
+	uint64_t m_CpuNs;
+	uint64_t m_ReadBytes;
+	uint64_t m_WriteBytes;
+	uint64_t m_SampledNs;
+};
+
+
+class QueryBucket
+{
+public:
+	QueryBucket() : m_Checks(0), m_Active(0), m_SampledNs(0) {}
+
+	uint64_t m_Checks;
+	uint64_t m_Active;
+	uint64_t m_SampledNs;
+	std::vector<QueryService> m_Services;
+};
+
+
+bool TrendStore::Query(std::ostream &strm, int64_t from, int64_t to, int64_t step) const
+{
+	std::vector<std::string> segs;
+	ListSegments(segs);
+	if(segs.empty())
+	{
+		LOG(ERROR) << "No long-term history found in '" << m_Config.m_TrendDir << "'!\n";
+		return false;
+	}
+	if(step <= 0 || step > to - from)
+		step = to - from + 1;
+	const size_t nbuckets = (size_t)((to - from) / step) + 1;
+	if(nbuckets > kMaxBuckets)
+	{
+		LOG(ERROR) << "Query has too many steps (" << nbuckets << ")!\n";
+		return false;
+	}
+	std::vector<QueryBucket> buckets(nbuckets);
+	// Services in order of appearance
+	std::vector<std::string> services;
+	// Previous point, for the increments of the next one
+	TrendPoint prev;
+	bool has_prev = false;
+	std::map<std::string, TrendValues> prev_vals;
+	bool done = false;
+	for(size_t s = 0; s < segs.size() && !done; ++s)
+	{
+		// Points of a segment all precede the next one
+		if(s + 1 < segs.size() && GetSegmentTime(segs[s + 1]) <= from)
+			continue;
+		if(GetSegmentTime(segs[s]) > to)
+			break;
+		TrendReader rd;
+		if(!rd.Open(segs[s].c_str()))
+		{
+			LOG(WARN) << "Skipping invalid long-term history segment '" << segs[s] << "'\n";
+			has_prev = false;
+			prev_vals.clear();
+			continue;
+		}
+		// Counters only continue for the names of the previous segment
+		for(std::map<std::string, TrendValues>::iterator it = prev_vals.begin(); it != prev_vals.end(); )
+		{
+			if(std::find(rd.m_Names.begin(), rd.m_Names.end(), it->first) == rd.m_Names.end())
+				it = prev_vals.erase(it);
+			else
+				++it;
+		}
+		std::vector<size_t> idx(rd.m_Names.size());
+		for(size_t i = 0; i < rd.m_Names.size(); ++i)
+		{
+			idx[i] = std::find(services.begin(), services.end(), rd.m_Names[i]) - services.begin();
+			if(idx[i] == services.size())
+				services.push_back(rd.m_Names[i]);
+		}
+		TrendPoint pt;
+		while(rd.Next(pt))
+		{
+			if(pt.m_Time > to)
+			{
+				done = true;
+				break;
+			}
+			if(pt.m_Time >= from)
+			{
+				QueryBucket &b = buckets[(size_t)((pt.m_Time - from) / step)];
+				b.m_Services.resize(services.size());
+				if(has_prev)
+				{
+					b.m_Checks += Increment(pt.m_Checks, prev.m_Checks);
+					b.m_Active += Increment(pt.m_Active, prev.m_Active);
+					b.m_SampledNs += Increment(pt.m_SampledNs, prev.m_SampledNs);
+				}
+				for(size_t i = 0; i < rd.m_Names.size(); ++i)
+				{
+					QueryService &qs = b.m_Services[idx[i]];
+					const TrendValues &v = pt.m_Services[i];
+					qs.m_ProcSum += v.m_Procs;
+					++qs.m_Points;
+					std::map<std::string, TrendValues>::const_iterator pv = prev_vals.find(rd.m_Names[i]);
+					if(pv == prev_vals.end())
+						continue;
+					qs.m_CpuNs += Increment(v.m_CpuNs, pv->second.m_CpuNs);
+					qs.m_ReadBytes += Increment(v.m_ReadBytes, pv->second.m_ReadBytes);
+					qs.m_WriteBytes += Increment(v.m_WriteBytes, pv->second.m_WriteBytes);
+					qs.m_SampledNs += Increment(v.m_SampledNs, pv->second.m_SampledNs);
+				}
+			}
+			prev = pt;
+			has_prev = true;
+			for(size_t i = 0; i < rd.m_Names.size(); ++i)
+				prev_vals[rd.m_Names[i]] = pt.m_Services[i];
+		}
+	}
+
+	for(size_t i = 0; i < buckets.size(); ++i)
+	{
+		const QueryBucket &b = buckets[i];
+		const int64_t start = from + (int64_t)i * step;
+		strm << FormatTime(start) << " .. " << FormatTime(std::min(start + step, to))
+			<< ": " << b.m_Checks << " checks, " << b.m_Active << " active, "
+			<< format_n("%.0f", b.m_SampledNs / 1e9) << " s sampled\n";
+		if(b.m_Services.empty())
+			continue;
+		strm << format_n("    %-24s %8s %8s %12s %12s\n", "Service", "Procs", "CPU %", "Read B/s", "Write B/s");
+		for(size_t j = 0; j < b.m_Services.size(); ++j)
+		{
+			const QueryService &qs = b.m_Services[j];
+			if(qs.m_Points == 0)
+				continue;
+			strm << format_n("    %-24s %8.1f ", services[j].c_str(), (double)qs.m_ProcSum / qs.m_Points);
+			if(qs.m_SampledNs == 0)
+			{
+				strm << format_n("%8s %12s %12s\n", "-", "-", "-");
+				continue;
+			}
+			const double secs = qs.m_SampledNs / 1e9;
+			strm << format_n("%8.2f %12.0f %12.0f\n", qs.m_CpuNs * 100.0 / qs.m_SampledNs
+				, qs.m_ReadBytes / secs, qs.m_WriteBytes / secs);
+		}
+	}
+	return true;
+}
+
+
+bool TrendStore::ParseDuration(const char *str, int64_t &res)
+{
+	char *end;
+	const unsigned long long val = strtoull(str, &end, 10);
+	if(end == str)
+		return false;
+	int64_t unit = 1000;
+	switch(*end)
+	{
+	case 0:
+	case 's':
+		break;
+	case 'm':
+		unit = 60 * 1000;
+		break;
+	case 'h':
+		unit = 3600 * 1000;
+		break;
+	case 'd':
+		unit = 24 * 3600 * 1000;
+		break;
+	default:
+		return false;
+	}
+	if(*end && end[1] != 0)
+		return false;
+	res = (int64_t)val * unit;
+	return res > 0;
+}
+
+
+bool TrendStore::ParseTime(const char *str, int64_t now, int64_t &res)
+{
+	if(strcmp(str, "now") == 0)
+	{
+		res = now;
+		return true;
+	}
+	if(*str == '-')
+	{
+		int64_t ago;
+		if(!ParseDuration(str + 1, ago))
+			return false;
+		res = now - ago;
+		return true;
+	}
+	char *end;
+	const unsigned long long secs = strtoull(str, &end, 10);
+	if(end != str && *end == 0)
+	{
+		res = (int64_t)secs * 1000;
+		return true;
+	}
+	// Local time
+	static const char *formats[] =
+	{
+		"%Y-%m-%d %H:%M:%S",
+		"%Y-%m-%dT%H:%M:%S",
+		"%Y-%m-%d %H:%M",
+		"%Y-%m-%dT%H:%M",
+		"%Y-%m-%d",
+	};
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+	{
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		const char *p = strptime(str, formats[i], &tm);
+		if(p == NULL || *p != 0)
+			continue;
+		tm.tm_isdst = -1;
+		const time_t t = mktime(&tm);
+		if(t == (time_t)-1)
+			return false;
+		res = (int64_t)t * 1000;
+		return true;
+	}
+	return false;
+}
+
+
+}	// PidSample
+
@@ -0,0 +1,144 @@
+#include "StdInc.hpp"
+#include "WorkPool.hpp"
+#include <atomic>
+
+
+namespace grumat
+{
+
+
+// Jobs taken at once by a worker
+static const size_t kChunk = 64;
+
+
+// Share of the job range owned by a worker
+struct WorkPool::WorkShare
+{
+	std::atomic<size_t> m_Next;
+	size_t m_End;
+	// Avoid false sharing between workers
+	char m_Pad[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+
+WorkPool::WorkPool()
+	: m_Gen(0)
+	, m_Stop(false)
+	, m_Job(NULL)
+	, m_Threads(0)
+	, m_Busy(0)
+{
+}
+
+
+WorkPool::~WorkPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_Stop = true;
+	}
+	m_Start.notify_all();
+	for(size_t w = 0; w < m_Workers.size(); ++w)
+		m_Workers[w].join();
+}
+
+
+WorkPool &WorkPool::GetDefault()
+{
+	static WorkPool s_Pool;
+	return s_Pool;
+}
+
+
+size_t WorkPool::GetThreadCount(size_t threads, size_t count)
+{
+	if(threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+		if(threads == 0)
+			threads = 1;
+	}
+	// No point on threads without a full chunk of work
+	size_t max_threads = (count + kChunk - 1) / kChunk;
+	if(threads > max_threads)
+		threads = max_threads;
+	return threads ? threads : 1;
+}
+
+
+void WorkPool::Work(size_t self)
+{
+	// Own share first, then steal from the next workers in turn
+	for(size_t n = 0; n < m_Threads; ++n)
+	{
+		WorkShare &share = m_Shares[(self + n) % m_Threads];
+		for(;;)
+		{
+			size_t first = share.m_Next.fetch_add(kChunk);
+			if(first >= share.m_End)
+				break;
+			size_t last = std::min(first + kChunk, share.m_End);
+			for(size_t i = first; i < last; ++i)
+				(*m_Job)(self, i);
+		}
+	}
+}
+
+
+void WorkPool::WorkerLoop(size_t self, uint64_t gen)
+{
+	std::unique_lock<std::mutex> lock(m_Lock);
+	for(;;)
+	{
+		m_Start.wait(lock, [&] { return m_Stop || m_Gen != gen; });
+		if(m_Stop)
+			return;
+		gen = m_Gen;
+		// Not needed for this run
+		if(self >= m_Threads)
+			continue;
+		lock.unlock();
+		Work(self);
+		lock.lock();
+		if(--m_Busy == 0)
+			m_Done.notify_one();
+	}
+}
+
+
+void WorkPool::Run(size_t count, size_t threads, const Job_t &job)
+{
+	threads = GetThreadCount(threads, count);
+	if(threads == 1)
+	{
+		for(size_t i = 0; i < count; ++i)
+			job(0, i);
+		return;
+	}
+	std::lock_guard<std::mutex> run(m_RunLock);
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		// Workers not yet started are numbered from 1; the caller is 0
+		while(m_Workers.size() < threads - 1)
+			m_Workers.emplace_back(&WorkPool::WorkerLoop, this, m_Workers.size() + 1, m_Gen);
+		if(m_Shares.size() < threads)
+			std::vector<WorkShare>(threads).swap(m_Shares);
+		for(size_t w = 0; w < threads; ++w)
+		{
+			m_Shares[w].m_Next = count * w / threads;
+			m_Shares[w].m_End = count * (w + 1) / threads;
+		}
+		m_Job = &job;
+		m_Threads = threads;
+		m_Busy = threads - 1;
+		++m_Gen;
+	}
+	m_Start.notify_all();
+	Work(0);
+	std::unique_lock<std::mutex> lock(m_Lock);
+	m_Done.wait(lock, [&] { return m_Busy == 0; });
+	m_Job = NULL;
+}
+
+
+}	// namespace grumat
@@ -2,15 +2,17 @@
 #include "Path.hpp"
 #include "PidSample.hpp"
 #include "AppConfig.hpp"
+#include "Activity.hpp"
+#include "Daemon.hpp"
+#include "Profiler.hpp"
+#include "PromExporter.hpp"
+#include "Trend.hpp"
+#include "SharedVerdict.hpp"
 #include "Log.hpp"
 
 using namespace PidSample;
 using namespace grumat;
 
-#define ACTIVE_STATE	0
-#define IDLE_STATE		1
-#define ERROR_STATE		100
-
 
 static int Usage(const char *argv0)
 {
@@ -19,13 +21,21 @@ static int Usage(const char *argv0)
 	std::cerr << path << std::endl
 			  << std::string(path.length(), '=') << std::endl
 			  << "Tool to track service activity, to be used with autosuspend.\n"
-			  << "USAGE: " << path << " [-h] [-v] [-c <config>] [-l <log-file>] [-L <level>]\n"
+			  << "USAGE: " << path << " [-h] [-v] [-c <config>] [-l <log-file>] [-L <level>] [--window=<ms>] [--profile] [--daemon|--status|--from-shm|--query=<from>[,<to>] [--step=<time>]]\n"
 			  << "    -c <config>           : specify a configuration file. Default to '/opt/local/etc/is_server_busy.conf'.\n"
+			  << "    --daemon              : stay resident, sampling services and answering on the configured socket\n"
+			  << "    --from-shm            : use the verdict published by the daemon in shared memory, if recent\n"
 			  << "    -h, --help            : show help\n"
 			  << "    -l <log-file>         : Same as option --log-file\n"
 			  << "    --log-file=<log-file> : Specifies a log file\n"
 			  << "    -L <level>            : Specifies the log level. Allowed values are ERROR,WARN,INFO or DEBUG.\n"
-			  << "    -v                    : Increase verbosity\n";
+			  << "    --profile             : log time and resources used by each phase of the check (INFO level)\n"
+			  << "    --query=<from>[,<to>] : print service rates of the long-term history; times are 'now', '-<time>',\n"
+			  << "                            epoch seconds or 'YYYY-MM-DD[ HH:MM[:SS]]'\n"
+			  << "    --status              : ask the verdict of a running daemon\n"
+			  << "    --step=<time>         : split the query in steps of <time> seconds (or with a 'm', 'h' or 'd' suffix)\n"
+			  << "    -v                    : Increase verbosity\n"
+			  << "    --window=<ms>         : sample twice, <ms> apart, instead of using the history\n";
 	return ERROR_STATE;
 }
 
@@ -81,6 +91,13 @@ int main(int argc, char *argv[])
 	std::string log_file;
 	String log_level;
 	int verbose = 0;
+	bool daemon = false;
+	bool status = false;
+	bool from_shm = false;
+	bool profile = false;
+	std::string window;
+	std::string query;
+	std::string step;
 
 	int iArg = 0;
 	for (int i = 1; i < argc; ++i)
@@ -99,6 +116,32 @@ int main(int argc, char *argv[])
 				++pArg;
 				if (strcmp(pArg, "help") == 0)
 					return Usage(argv[0]);
+				else if (strcmp(pArg, "daemon") == 0)
+					daemon = true;
+				else if (strcmp(pArg, "status") == 0)
+					status = true;
+				else if (strcmp(pArg, "from-shm") == 0)
+					from_shm = true;
+				else if (strcmp(pArg, "profile") == 0)
+					profile = true;
+				else if ((rv = MatchCmd(pArg, "window", tmp)) != cmdMatch)
+				{
+					if (rv != cmdOk)
+						return ERROR_STATE;
+					window = tmp;
+				}
+				else if ((rv = MatchCmd(pArg, "query", tmp)) != cmdMatch)
+				{
+					if (rv != cmdOk)
+						return ERROR_STATE;
+					query = tmp;
+				}
+				else if ((rv = MatchCmd(pArg, "step", tmp)) != cmdMatch)
+				{
+					if (rv != cmdOk)
+						return ERROR_STATE;
+					step = tmp;
+				}
 				else if ((rv = MatchCmd(pArg, "log-file", tmp)) != cmdMatch)
 				{
 					if (rv != cmdOk)
@@ -189,6 +232,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// Profile is reported at INFO level
+	if (profile && verbose == 0)
+		verbose = 1;
 	SetVerbosityLevel(verbose);
 	if (!log_file.empty() && !SetLogFile(log_file.c_str()))
 	{
@@ -214,135 +260,188 @@ int main(int argc, char *argv[])
 		}
 		SetLogLevel(level);
 	}
-	bool log_debug_ = IsLogLevelActive(DEBUG);
-#define LogDebug()  \
-	if (log_debug_) \
-	Log(DEBUG)
+	if (profile)
+		Profiler::Enable(true);
+	const bool log_debug = LOG_ACTIVE(DEBUG);
 
-	Log(INFO) << "Started '" << argv[0] << "'\n";
+	LOG(INFO) << "Started '" << argv[0] << "'\n";
 	AppConfig config;
-	if (!config.Parse(cfg.c_str()))
-		return IDLE_STATE;
-
-	SampleSet old_samps;
-	LogDebug() << "Loading previous record\n";
-	bool ok = old_samps.ReadJsonRecord(config);
-	LogDebug() << "ReadJsonRecord returned " << ok << std::endl;
-	if (ok && log_debug_)
 	{
-		Log(DEBUG) << "**Previous workload record**\n";
-		old_samps.Print(Log(DEBUG));
+		ProfileScope prof(phConfig);
+		if (!config.Load(cfg.c_str()))
+			return IDLE_STATE;
 	}
-
-	// Sample initial process stats
-	LogDebug() << "Sampling current service activity\n";
-	SampleSet samps(config);
-	if (log_debug_)
-	{
-		Log(DEBUG) << "**Current workload record**\n";
-		samps.Print(Log(DEBUG));
-	}
-	// Write updated JSON
-	LogDebug() << "Writing output record to JSON file\n";
-	samps.MakeJsonRecord(config);
-	LogDebug() << "Found " << samps.m_Samples.size() << " process running\n";
-	if (samps.m_Samples.size() == 0)
+	if (!config.m_ProcRoot.empty() && !ProcSource::GetDefault().SetRoot(config.m_ProcRoot.c_str()))
 	{
-		// No process match, Server can shutdown
-		Log(INFO) << "No listed service was found. Server is allowed to shutdown...\n";
-		return IDLE_STATE;
+		LOG(ERROR) << "Key 'proc_root' is not supported on this platform!\n";
+		return ERROR_STATE;
 	}
-	// Can't read history JSON file
-	if (!ok)
+	// Counters of a fixture tree are only in procfs
+	if (config.m_Taskstats && config.m_ProcRoot.empty() && !ProcSource::GetDefault().SetTaskstats(true))
+		LOG(WARN) << "taskstats is not available; reading CPU time from procfs\n";
+	if (config.HasCgroups() && !ProcSource::GetDefault().SetCgroupRoot(config.m_CgroupRoot.c_str()))
 	{
-		Log(WARN) << "Can't determine idle state. No history was found...\n";
-		return ACTIVE_STATE;
+		LOG(ERROR) << "Key 'cgroup' is not supported on this platform!\n";
+		return ERROR_STATE;
 	}
-	// History timestamp is ascending?
-	LogDebug() << "Validating clock values: before: " << old_samps.m_Clock << "; after: " << samps.m_Clock << std::endl;
-	if (samps.m_Clock <= old_samps.m_Clock)
+	if (daemon && status)
 	{
-		Log(WARN) << "Can't determine idle state. History timestamp is not ascending...\n";
-		return ACTIVE_STATE;
+		std::cerr << "ERROR: Options '--daemon' and '--status' cannot be combined!\n";
+		return ERROR_STATE;
 	}
-	// X s = X * 10ˆ9 ns
-	const uint64_t time_diff = (samps.m_Clock - old_samps.m_Clock);
-	LogDebug() << "Time difference: " << time_diff / 1000000 << " ms\n";
-	const uint64_t secs = time_diff / 1000000000ULL;
-	if(secs == 0)
+	if (!window.empty())
 	{
-		Log(WARN) << "Can't determine idle state. History is too recent (< 1s)\n";
-		return ACTIVE_STATE;
+		char *end;
+		config.m_Window = strtoul(window.c_str(), &end, 10);
+		if (*end != 0 || config.m_Window == 0)
+		{
+			std::cerr << "ERROR: Invalid value for '--window': '" << window << "'!\n";
+			return ERROR_STATE;
+		}
 	}
-	if (secs > config.m_IntervalThr)
+	if (!step.empty() && query.empty())
 	{
-		Log(WARN) << "Can't determine idle state. History is more than " << config.m_IntervalThr << " s...\n";
-		return ACTIVE_STATE;
+		std::cerr << "ERROR: Option '--step' needs '--query'!\n";
+		return ERROR_STATE;
 	}
-	LogDebug() << "Computing processes workload\n";
-	typedef std::map<size_t, Diff> DiffMap_t;
-	DiffMap_t m;
-	for (SampleSet::SampleSet_t::const_iterator it = samps.m_Samples.begin(); it != samps.m_Samples.end(); ++it)
+	if (!query.empty())
 	{
-		// Check for new arrivals
-		if (old_samps.m_Samples.count(it->first) == 0)
+		if (config.m_TrendDir.empty())
 		{
-			Log(INFO) << "New service arrived! Wait until next turn to check activity...\n";
-			return ACTIVE_STATE;
+			std::cerr << "ERROR: Option '--query' needs the 'trend' key in the configuration!\n";
+			return ERROR_STATE;
 		}
-		const Sample &old = old_samps.m_Samples[it->first];
-		Diff dif = it->second - old;
-		size_t icfg = samps.m_Pid2Cfg[it->first];
-		if (m.count(icfg) == 0)
-			m[icfg] = dif;
-		else
-			m[icfg] += dif;
-	}
-	//
-	#define RET_ACTIVE(cond, ...)						\
-	{													\
-		if(cond)										\
-		{												\
-			Log(INFO) << __VA_ARGS__					\
-				<< " Server activity confirmed...\n";	\
-			if (log_debug_) 							\
-				retcode = ACTIVE_STATE;					\
-			else										\
-				return ACTIVE_STATE;					\
-		}												\
-		else if (log_debug_)							\
-			Log(DEBUG) << __VA_ARGS__ << '\n';			\
+		const int64_t now = TrendStore::GetWallClock();
+		const size_t comma = query.find(',');
+		int64_t from;
+		int64_t to = now;
+		int64_t step_ms = 0;
+		if (!TrendStore::ParseTime(query.substr(0, comma).c_str(), now, from)
+			|| (comma != std::string::npos && !TrendStore::ParseTime(query.c_str() + comma + 1, now, to))
+			|| from > to)
+		{
+			std::cerr << "ERROR: Invalid value for '--query': '" << query << "'!\n";
+			return ERROR_STATE;
+		}
+		if (!step.empty() && !TrendStore::ParseDuration(step.c_str(), step_ms))
+		{
+			std::cerr << "ERROR: Invalid value for '--step': '" << step << "'!\n";
+			return ERROR_STATE;
+		}
+		TrendStore store(config);
+		return store.Query(std::cout, from, to, step_ms) ? EXIT_SUCCESS : ERROR_STATE;
 	}
-	//
-	int retcode = IDLE_STATE;
-	// Verify if computed process load overflows thresholds
-	LogDebug() << "Comparing workload thresholds\n";
-	for (DiffMap_t::const_iterator it = m.begin(); it != m.end(); ++it)
+	if (status)
+		return Daemon::Query(config);
+	if (from_shm)
 	{
-		const ProcessConfig &pcfg = config.m_Procs[it->first];
-		double cpu = it->second.GetRelativeTime(time_diff);
-		RET_ACTIVE((cpu > pcfg.m_CPU), "Service '" << pcfg.m_Name << "' is using " << format_n("%3.1f%%", cpu));
-		//
-		if(pcfg.m_DiskTotal)
+		if (config.m_ShmName.empty())
 		{
-			int64_t bytes = it->second.GetTotalDiskBytes() / secs;
-			RET_ACTIVE((bytes > (int64_t)pcfg.m_DiskTotal), "Service '" << pcfg.m_Name << "' transferred " << bytes << " disk bytes/s!");
+			std::cerr << "ERROR: Option '--from-shm' needs the 'shm' key in the configuration!\n";
+			return ERROR_STATE;
 		}
-		//
-		if(pcfg.m_DiskRead)
+		if (daemon)
 		{
-			int64_t bytes = it->second.m_DiskReadBytes / secs;
-			RET_ACTIVE((bytes > (int64_t)pcfg.m_DiskRead), "Service '" << pcfg.m_Name << "' read " << bytes << " disk bytes/s!");
+			std::cerr << "ERROR: Options '--daemon' and '--from-shm' cannot be combined!\n";
+			return ERROR_STATE;
 		}
-		//
-		if(pcfg.m_DiskWrite)
+		const int state = SharedVerdict::Query(config);
+		if (state >= 0)
+			return state;
+		// Daemon not running or stalled
+		LOG(INFO) << "No recent verdict in shared memory; running a full check\n";
+	}
+	if (daemon)
+	{
+		Daemon srv(config);
+		return srv.Run();
+	}
+
+	ProfileScope prof(phHistoryLoad);
+	ArgvCache cache;
+	const std::string cache_file = config.m_RecordFile + ".argv";
+	if (config.m_ArgvCache)
+		cache.Load(cache_file.c_str(), config.GetMatchHash(), config.m_Procs.size());
+	SampleSet old_samps;
+	bool ok;
+	if (config.m_Window)
+	{
+		// Baseline is taken now; history is not needed
+		LOG(DEBUG) << "Sampling service activity baseline\n";
+		prof.Stop();
+		old_samps = SampleSet(config, ProcSource::GetDefault(), config.m_ArgvCache ? &cache : NULL);
+		ok = true;
+	}
+	else
+	{
+		LOG(DEBUG) << "Loading previous record\n";
+		ok = old_samps.ReadRecord(config);
+		LOG(DEBUG) << "ReadRecord returned " << ok << std::endl;
+		prof.Stop();
+	}
+	if (ok && log_debug)
+	{
+		LOG(DEBUG) << "**Previous workload record**\n";
+		old_samps.Print(Log(DEBUG));
+	}
+
+	// Sample initial process stats
+	LOG(DEBUG) << "Sampling current service activity\n";
+	SampleSet samps;
+	if (config.m_Window)
+	{
+		// Nothing to wait for if no service is running
+		if (!old_samps.m_Samples.empty())
 		{
-			int64_t bytes = it->second.m_DiskWriteBytes / secs;
-			RET_ACTIVE((bytes > (int64_t)pcfg.m_DiskWrite), "Service '" << pcfg.m_Name << "' wrote " << bytes << " disk bytes/s!");
+			struct timespec ts;
+			ts.tv_sec = config.m_Window / 1000;
+			ts.tv_nsec = (config.m_Window % 1000) * 1000000L;
+			while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+				;
 		}
+		// Only the pids found by the baseline are read again
+		samps.Resample(old_samps, config);
+	}
+	else
+		samps = SampleSet(config, ProcSource::GetDefault(), config.m_ArgvCache ? &cache : NULL);
+	prof.Switch(phHistoryWrite);
+	if (config.m_ArgvCache)
+		cache.Save(cache_file.c_str(), config.GetMatchHash());
+	if (log_debug)
+	{
+		LOG(DEBUG) << "**Current workload record**\n";
+		samps.Print(Log(DEBUG));
+	}
+	// Write updated JSON
+	LOG(DEBUG) << "Writing output record\n";
+	samps.MakeRecord(config);
+	prof.Switch(phEvaluate);
+	Activity act(config);
+	// In-run samples are any interval apart
+	if (config.m_Window)
+		act.m_MinTimeDiff = 0;
+	// Exported rates cover all services
+	act.m_AllRates = !config.m_PromFile.empty();
+	int rc = act.Evaluate(ok ? &old_samps : NULL, samps);
+	prof.Stop();
+	if (!config.m_PromFile.empty())
+	{
+		PromExporter exporter(config);
+		exporter.Update(act, samps, rc);
+		exporter.WriteFile();
+	}
+	if (!config.m_TrendDir.empty())
+	{
+		ProfileScope trend_prof(phHistoryWrite);
+		TrendStore store(config);
+		store.Append(ok ? &old_samps : NULL, samps, rc);
+	}
+	if (profile)
+	{
+		ProfileData data;
+		Profiler::GetData(data);
+		LOG(INFO) << "**Profile**\n";
+		data.Print(Log(INFO));
 	}
-	if(retcode == IDLE_STATE)
-		Log(INFO) << "No listed service has significant workload. Server is allowed to shutdown...\n";
-	#undef RET_ACTIVE
-	return retcode;
+	return rc;
 }
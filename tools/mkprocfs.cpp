@@ -0,0 +1,359 @@
+#include "StdInc.hpp"
+#include <sys/stat.h>
+
+
+/*
+** Builds a fake procfs tree for scale tests. Each pid directory holds the
+** 'cmdline', 'stat' and 'io' files read by LinuxProcSource.
+** Counters are a function of the pid and of a step number; '--advance'
+** increments the step, so consecutive runs of is_server_busy (with
+** 'proc_root' pointing to the tree) see the configured workload.
+*/
+
+
+// Generation parameters; stored in the tree so '--advance' reproduces them
+class Options
+{
+public:
+	Options()
+		: m_Pids(10000)
+		, m_Seed(1)
+		, m_Interp(20)
+		, m_Long(10)
+		, m_KThread(10)
+		, m_Service(10)
+		, m_Children(0)
+		, m_Active(100)
+		, m_Services(500)
+		, m_LongArgs(40)
+		, m_Cpu(100)
+		, m_Io(1048576)
+		, m_Step(0)
+	{
+	}
+
+	bool Load(const char *fname)
+	{
+		FILE *fp = fopen(fname, "r");
+		if(fp == NULL)
+			return false;
+		unsigned long long v[13];
+		int n = fscanf(fp, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu"
+			, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12]);
+		fclose(fp);
+		if(n != 13)
+			return false;
+		m_Pids = v[0];
+		m_Seed = v[1];
+		m_Interp = v[2];
+		m_Long = v[3];
+		m_KThread = v[4];
+		m_Service = v[5];
+		m_Children = v[6];
+		m_Active = v[7];
+		m_Services = v[8];
+		m_LongArgs = v[9];
+		m_Cpu = v[10];
+		m_Io = v[11];
+		m_Step = v[12];
+		return true;
+	}
+	bool Save(const char *fname) const
+	{
+		FILE *fp = fopen(fname, "w");
+		if(fp == NULL)
+			return false;
+		fprintf(fp, "%zu %llu %u %u %u %u %u %u %zu %zu %llu %llu %llu\n"
+			, m_Pids, (unsigned long long)m_Seed, m_Interp, m_Long, m_KThread, m_Service, m_Children, m_Active
+			, m_Services, m_LongArgs, (unsigned long long)m_Cpu, (unsigned long long)m_Io, (unsigned long long)m_Step);
+		return fclose(fp) == 0;
+	}
+
+public:
+	size_t m_Pids;
+	uint64_t m_Seed;
+	// Percentages of each command line shape; the rest are plain tools
+	unsigned m_Interp;
+	unsigned m_Long;
+	unsigned m_KThread;
+	unsigned m_Service;
+	// Percentage of plain tools forked by a service
+	unsigned m_Children;
+	// Percentage of processes whose counters grow
+	unsigned m_Active;
+	size_t m_Services;
+	size_t m_LongArgs;
+	// Growth per step of active processes: CPU ticks and disk bytes
+	uint64_t m_Cpu;
+	uint64_t m_Io;
+	uint64_t m_Step;
+};
+
+
+enum Kind_e
+{
+	kPlain,
+	kInterp,
+	kLong,
+	kKThread,
+	kService,
+};
+
+
+// splitmix64; attributes of a pid never depend on the generation order
+static uint64_t Hash(uint64_t seed, uint64_t pid, uint64_t salt)
+{
+	uint64_t z = seed + pid * 0x9E3779B97F4A7C15ULL + salt * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+
+static pid_t PidOf(size_t i)
+{
+	return (pid_t)(100 + i);
+}
+
+
+static Kind_e GetKind(const Options &opt, pid_t pid)
+{
+	unsigned pct = Hash(opt.m_Seed, pid, 1) % 100;
+	if(pct < opt.m_KThread)
+		return kKThread;
+	pct -= opt.m_KThread;
+	if(pct < opt.m_Service)
+		return kService;
+	pct -= opt.m_Service;
+	if(pct < opt.m_Interp)
+		return kInterp;
+	pct -= opt.m_Interp;
+	if(pct < opt.m_Long)
+		return kLong;
+	return kPlain;
+}
+
+
+static std::string GetCmdLine(const Options &opt, pid_t pid, Kind_e kind)
+{
+	std::string cmd;
+	const uint64_t h = Hash(opt.m_Seed, pid, 2);
+	char buf[128];
+	switch(kind)
+	{
+	case kKThread:
+		break;
+	case kService:
+	{
+		// Every tenth service is a script, matched by argv[1]
+		const size_t svc = h % opt.m_Services;
+		if(svc % 10 == 9)
+			snprintf(buf, sizeof(buf), "/usr/bin/python3|/opt/svc%03zu|-D|", svc);
+		else
+			snprintf(buf, sizeof(buf), "/usr/sbin/svc%03zu|-D|", svc);
+		cmd = buf;
+		break;
+	}
+	case kInterp:
+		snprintf(buf, sizeof(buf), "/usr/bin/python3.11|/opt/app%u/main.py|--config|/etc/app%u.conf|"
+			, (unsigned)(h % 1000), (unsigned)(h / 1000 % 1000));
+		cmd = buf;
+		break;
+	case kLong:
+		cmd = "/usr/lib/jvm/bin/java|";
+		for(size_t i = 0; i < opt.m_LongArgs; ++i)
+		{
+			snprintf(buf, sizeof(buf), "-Dprop%zu=value%u|", i, (unsigned)(Hash(opt.m_Seed, pid, 10 + i) % 100000));
+			cmd += buf;
+		}
+		break;
+	default:
+		snprintf(buf, sizeof(buf), "/usr/bin/tool%u|--verbose|", (unsigned)(h % 5000));
+		cmd = buf;
+		break;
+	}
+	// Arguments are '\0' terminated
+	std::replace(cmd.begin(), cmd.end(), '|', '\0');
+	return cmd;
+}
+
+
+static bool WriteFile(const std::string &path, const std::string &data)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+	{
+		fprintf(stderr, "ERROR: Cannot create '%s' (error code %d)\n", path.c_str(), errno);
+		return false;
+	}
+	bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+	ok = (close(fd) == 0) && ok;
+	if(!ok)
+		fprintf(stderr, "ERROR: Failed to write '%s'\n", path.c_str());
+	return ok;
+}
+
+
+// Files with counters; rewritten on each step
+static bool WriteCounters(const Options &opt, const std::string &dir, pid_t pid, pid_t ppid, Kind_e kind, const std::string &cmd)
+{
+	const bool active = (Hash(opt.m_Seed, pid, 3) % 100) < opt.m_Active;
+	const uint64_t step = active ? opt.m_Step : 0;
+	const uint64_t h = Hash(opt.m_Seed, pid, 4);
+	// 4/5 of the time in user mode
+	const uint64_t utime = h % 1000 + step * (opt.m_Cpu - opt.m_Cpu / 5);
+	const uint64_t stime = h % 100 + step * (opt.m_Cpu / 5);
+	const uint64_t rbytes = (h % 1000) * 4096 + step * (opt.m_Io / 2);
+	const uint64_t wbytes = (h % 100) * 4096 + step * (opt.m_Io - opt.m_Io / 2);
+	// Same name truncation as the kernel
+	std::string comm;
+	if(kind == kKThread)
+		comm = "kworker/" + std::to_string(pid % 8);
+	else
+	{
+		comm = cmd.c_str();
+		size_t slash = comm.rfind('/');
+		if(slash != std::string::npos)
+			comm.erase(0, slash + 1);
+		comm.resize(std::min(comm.size(), (size_t)15));
+	}
+	char buf[512];
+	snprintf(buf, sizeof(buf)
+		, "%d (%s) S %d %d %d 0 -1 4194560 100 0 0 0 %llu %llu 0 0 20 0 1 0 %llu 1000000 100 "
+		  "18446744073709551615 0 0 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n"
+		, (int)pid, comm.c_str(), (int)ppid, (int)pid, (int)pid
+		, (unsigned long long)utime, (unsigned long long)stime, (unsigned long long)(pid * 7));
+	if(!WriteFile(dir + "/stat", buf))
+		return false;
+	snprintf(buf, sizeof(buf)
+		, "rchar: %llu\nwchar: %llu\nsyscr: 0\nsyscw: 0\nread_bytes: %llu\nwrite_bytes: %llu\ncancelled_write_bytes: 0\n"
+		, (unsigned long long)rbytes, (unsigned long long)wbytes, (unsigned long long)rbytes, (unsigned long long)wbytes);
+	return WriteFile(dir + "/io", buf);
+}
+
+
+static int Usage(const char *argv0)
+{
+	std::cerr << "USAGE: " << argv0 << " <root> [options]\n"
+			  << "    --pids=<n>        : number of processes (default 10000)\n"
+			  << "    --seed=<n>        : seed of the generated attributes (default 1)\n"
+			  << "    --interp=<pct>    : interpreters running a script (default 20)\n"
+			  << "    --long=<pct>      : processes with long argument lists (default 10)\n"
+			  << "    --long-args=<n>   : arguments of the long lists (default 40)\n"
+			  << "    --kthread=<pct>   : kernel threads, with empty cmdline (default 10)\n"
+			  << "    --service=<pct>   : processes named 'svcNNN' (default 10)\n"
+			  << "    --services=<n>    : number of distinct service names (default 500)\n"
+			  << "    --children=<pct>  : plain processes forked by a service (default 0)\n"
+			  << "    --active=<pct>    : processes whose counters grow (default 100)\n"
+			  << "    --cpu=<ticks>     : CPU ticks added per step (default 100)\n"
+			  << "    --io=<bytes>      : disk bytes added per step (default 1048576)\n"
+			  << "    --advance         : next step of an existing tree; counters only\n";
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	if(argc < 2 || *argv[1] == '-')
+		return Usage(argv[0]);
+	const std::string root = argv[1];
+	const std::string opt_file = root + "/.mkprocfs";
+	Options opt;
+	bool advance = false;
+	for(int i = 2; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const char *val = strchr(arg, '=');
+		unsigned long long num = val ? strtoull(val + 1, NULL, 10) : 0;
+		std::string name(arg, val ? val - arg : strlen(arg));
+		if(name == "--advance")
+			advance = true;
+		else if(val == NULL)
+			return Usage(argv[0]);
+		else if(name == "--pids")
+			opt.m_Pids = num;
+		else if(name == "--seed")
+			opt.m_Seed = num;
+		else if(name == "--interp")
+			opt.m_Interp = num;
+		else if(name == "--long")
+			opt.m_Long = num;
+		else if(name == "--long-args")
+			opt.m_LongArgs = num;
+		else if(name == "--kthread")
+			opt.m_KThread = num;
+		else if(name == "--service")
+			opt.m_Service = num;
+		else if(name == "--services")
+			opt.m_Services = num ? num : 1;
+		else if(name == "--children")
+			opt.m_Children = num;
+		else if(name == "--active")
+			opt.m_Active = num;
+		else if(name == "--cpu")
+			opt.m_Cpu = num;
+		else if(name == "--io")
+			opt.m_Io = num;
+		else
+			return Usage(argv[0]);
+	}
+	if(opt.m_Interp + opt.m_Long + opt.m_KThread + opt.m_Service > 100)
+	{
+		std::cerr << "ERROR: Shape percentages exceed 100%!\n";
+		return 1;
+	}
+	if(advance)
+	{
+		// Shape of the tree is preserved
+		if(!opt.Load(opt_file.c_str()))
+		{
+			std::cerr << "ERROR: '" << root << "' was not created by this tool!\n";
+			return 1;
+		}
+		++opt.m_Step;
+	}
+	else if(mkdir(root.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		std::cerr << "ERROR: Cannot create '" << root << "' (error code " << errno << ")\n";
+		return 1;
+	}
+	// Services forking children
+	std::vector<pid_t> services;
+	for(size_t i = 0; i < opt.m_Pids; ++i)
+	{
+		if(GetKind(opt, PidOf(i)) == kService)
+			services.push_back(PidOf(i));
+	}
+	for(size_t i = 0; i < opt.m_Pids; ++i)
+	{
+		const pid_t pid = PidOf(i);
+		const Kind_e kind = GetKind(opt, pid);
+		pid_t ppid = (kind == kKThread) ? 2 : 1;
+		if(kind == kPlain && !services.empty()
+			&& Hash(opt.m_Seed, pid, 5) % 100 < opt.m_Children)
+		{
+			ppid = services[Hash(opt.m_Seed, pid, 6) % services.size()];
+		}
+		const std::string dir = root + '/' + std::to_string(pid);
+		const std::string cmd = GetCmdLine(opt, pid, kind);
+		if(!advance)
+		{
+			if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+			{
+				std::cerr << "ERROR: Cannot create '" << dir << "' (error code " << errno << ")\n";
+				return 1;
+			}
+			if(!WriteFile(dir + "/cmdline", cmd))
+				return 1;
+		}
+		if(!WriteCounters(opt, dir, pid, ppid, kind, cmd))
+			return 1;
+	}
+	if(!opt.Save(opt_file.c_str()))
+	{
+		std::cerr << "ERROR: Cannot write '" << opt_file << "'!\n";
+		return 1;
+	}
+	std::cerr << "Step " << opt.m_Step << ": " << opt.m_Pids << " processes in '" << root << "'\n";
+	return 0;
+}